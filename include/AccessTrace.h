@@ -0,0 +1,189 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <atomic>
+
+/*
+ * Stage timestamps along the unlock paths.
+ *
+ * Each access attempt gets an id when it starts and every stage it passes
+ * through drops a {attempt, stage, esp_timer_get_time()} record into a ring.
+ * Writers claim a slot with one fetch_add and publish it with a sequence
+ * number, so the input task, the loop task and the console never take a
+ * lock. The reader copies the ring, discards slots that changed while it
+ * was copying, and turns neighbouring records of an attempt into stage
+ * durations.
+ */
+
+enum TracePath : uint8_t {
+    TRACE_KEYPAD,
+    TRACE_FINGER,
+    TRACE_CLOUD,
+    TRACE_PATH_COUNT
+};
+
+enum TraceStage : uint8_t {
+    TRACE_START,     // '#' edge, sensor poll or V0 handler entry
+    TRACE_VERIFY,    // PIN hashed and compared
+    TRACE_IMAGE,     // getImage
+    TRACE_FEATURES,  // image2Tz
+    TRACE_SEARCH,    // fingerFastSearch
+    TRACE_LIFTED,    // "Remove your finger" wait
+    TRACE_DISPLAY,   // Result posted to the display queue
+    TRACE_SERVO,     // unlockTemporarily
+    TRACE_EVENT,     // sendBlynkEvent
+    TRACE_TOTAL,     // Start to last stage, only in summaries
+    TRACE_STAGE_COUNT
+};
+
+// Stage durations in us, over the attempts still in the ring
+struct TraceSummary {
+    uint16_t count;
+    uint32_t p50;
+    uint32_t p95;
+    uint32_t max;
+};
+
+class AccessTrace {
+   public:
+    static const uint16_t RING_SIZE = 128;
+
+    // Opens a new attempt on this path, `start` defaults to now
+    void begin(TracePath path, int64_t start = 0) {
+        uint32_t attempt = _nextAttempt.fetch_add(1, std::memory_order_relaxed);
+        _current[path].store(attempt, std::memory_order_relaxed);
+        record(attempt, path, TRACE_START,
+               start ? start : esp_timer_get_time());
+    }
+
+    // Stamps a stage of the attempt most recently begun on this path
+    void mark(TracePath path, TraceStage stage) {
+        uint32_t attempt = _current[path].load(std::memory_order_relaxed);
+        if (attempt) record(attempt, path, stage, esp_timer_get_time());
+    }
+
+    // Copies the ring for summary(), returns the number of records kept.
+    // Only the console calls this, so the copy needs no guarding.
+    uint16_t snapshot() {
+        uint32_t head = _head.load(std::memory_order_acquire);
+        uint32_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+
+        _viewCount = 0;
+        for (uint32_t seq = first; seq < head; seq++) {
+            const Slot &slot = _slots[seq % RING_SIZE];
+            if (slot.seq.load(std::memory_order_acquire) != seq + 1) continue;
+            Record copy = slot.record;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // Overwritten while copying
+            if (slot.seq.load(std::memory_order_relaxed) != seq + 1) continue;
+            _view[_viewCount++] = copy;
+        }
+
+        // Oldest first, so the previous record of an attempt is found by
+        // looking back
+        for (uint16_t i = 0; i < _viewCount; i++) {
+            _hasPrevious[i] = false;
+            _isLast[i] = true;
+            for (int16_t j = i - 1; j >= 0; j--) {
+                if (_view[j].attempt != _view[i].attempt) continue;
+                _durations[i] = _view[i].time - _view[j].time;
+                _hasPrevious[i] = true;
+                _isLast[j] = false;
+                break;
+            }
+        }
+        return _viewCount;
+    }
+
+    bool summary(TracePath path, TraceStage stage, TraceSummary &out) const {
+        uint32_t samples[RING_SIZE];
+        uint16_t count = 0;
+
+        for (uint16_t i = 0; i < _viewCount; i++) {
+            const Record &r = _view[i];
+            if (r.path != path || r.stage == TRACE_START) continue;
+
+            if (stage == TRACE_TOTAL) {
+                if (!_isLast[i]) continue;
+                const Record *start = findStart(i);
+                if (start) samples[count++] = r.time - start->time;
+            } else if (r.stage == stage && _hasPrevious[i]) {
+                samples[count++] = _durations[i];
+            }
+        }
+
+        out = {};
+        if (!count) return false;
+        std::sort(samples, samples + count);
+        out.count = count;
+        out.p50 = samples[(count - 1) * 50 / 100];
+        out.p95 = samples[(count - 1) * 95 / 100];
+        out.max = samples[count - 1];
+        return true;
+    }
+
+    void clear() {
+        for (Slot &slot : _slots) slot.seq.store(0, std::memory_order_relaxed);
+        _viewCount = 0;
+    }
+
+    static const char *pathName(TracePath path) {
+        static const char *const names[] = {"keypad", "finger", "cloud"};
+        return path < TRACE_PATH_COUNT ? names[path] : "?";
+    }
+
+    static const char *stageName(TraceStage stage) {
+        static const char *const names[] = {
+            "start",  "verify",  "image", "features", "search",
+            "lifted", "display", "servo", "event",    "total"};
+        return stage < TRACE_STAGE_COUNT ? names[stage] : "?";
+    }
+
+   private:
+    struct Record {
+        uint32_t attempt;
+        TracePath path;
+        TraceStage stage;
+        int64_t time;
+    };
+
+    struct Slot {
+        std::atomic<uint32_t> seq{0};  // Ring position + 1, 0 while written
+        Record record;
+    };
+
+    void record(uint32_t attempt, TracePath path, TraceStage stage,
+                int64_t time) {
+        uint32_t seq = _head.fetch_add(1, std::memory_order_relaxed);
+        Slot &slot = _slots[seq % RING_SIZE];
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.record = {attempt, path, stage, time};
+        slot.seq.store(seq + 1, std::memory_order_release);
+    }
+
+    const Record *findStart(uint16_t index) const {
+        for (int16_t j = index; j >= 0; j--) {
+            if (_view[j].attempt == _view[index].attempt &&
+                _view[j].stage == TRACE_START) {
+                return &_view[j];
+            }
+        }
+        return nullptr;
+    }
+
+    Slot _slots[RING_SIZE];
+    std::atomic<uint32_t> _head{0};
+    std::atomic<uint32_t> _nextAttempt{1};
+    std::atomic<uint32_t> _current[TRACE_PATH_COUNT] = {};
+
+    Record _view[RING_SIZE];
+    uint32_t _durations[RING_SIZE];
+    bool _hasPrevious[RING_SIZE];
+    bool _isLast[RING_SIZE];
+    uint16_t _viewCount = 0;
+};
+
+AccessTrace accessTrace;
@@ -5,6 +5,13 @@ extern "C"
 }
 
 #include "Settings.h"
+
+// The stand-in build trusts only the throwaway CA written by
+// scripts/tls_standin.py, the certificate is still verified
+#if defined(SMARTLOCK_TLS_STANDIN)
+#include "tls_standin_ca.h"
+#endif
+
 #include <BlynkSimpleEsp32_SSL.h>
 
 #ifndef BLYNK_NEW_LIBRARY
@@ -25,7 +32,9 @@ extern "C"
 
 BlynkTimer edgentTimer;
 
+#include "BootTimeline.h"
 #include "SysUtils.h"
+#include "TlsResume.h"
 #include "BlynkState.h"
 #include "ConfigStore.h"
 #include "ResetButton.h"
@@ -39,6 +48,10 @@ inline void BlynkState::set(State m)
   if (state != m && m < MODE_MAX_VALUE)
   {
     DEBUG_PRINT(String(StateStr[state]) + " => " + StateStr[m]);
+    uint32_t now = millis();
+    totalMs[state] += now - enteredMs;
+    enteredMs = now;
+    changes++;
     state = m;
 
     // You can put your state handling here,
@@ -91,6 +104,10 @@ void runBlynkWithChecks()
         BlynkState::set(MODE_CONNECTING_NET);
       }
     }
+    else
+    {
+      ota_check_resume();
+    }
   }
 }
 
@@ -101,6 +118,11 @@ public:
   void begin()
   {
     WiFi.persistent(false);
+    // Reconnects are paced by enterConnectNet(), not the driver
+    WiFi.setAutoReconnect(false);
+    WiFi.onEvent(onWiFiEvent);
+    // Same TLS setup as the stock client, plus session resumption
+    _blynkTransport.setClient(&blynkTlsClient);
     WiFi.enableSTA(true); // Needed to get MAC
 #if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 0, 0))
     WiFi.setMinSecurity(WIFI_AUTH_WEP);
@@ -113,6 +135,7 @@ public:
     config_init();
     printDeviceBanner();
     console_init();
+    ota_init();
 
     if (configStore.getFlag(CONFIG_FLAG_VALID))
     {
@@ -178,4 +201,6 @@ void app_loop()
 {
   edgentTimer.run();
   edgentConsole.run();
+  config_run();
+  ota_run();
 }
@@ -13,7 +13,6 @@ enum State {
   MODE_MAX_VALUE
 };
 
-#if defined(APP_DEBUG)
 const char* StateStr[MODE_MAX_VALUE+1] = {
   "WAIT_CONFIG",
   "CONFIGURING",
@@ -27,14 +26,21 @@ const char* StateStr[MODE_MAX_VALUE+1] = {
 
   "INIT"
 };
-#endif
 
 namespace BlynkState
 {
   volatile State state = MODE_MAX_VALUE;
+  uint32_t changes = 0;      // Bumped on every transition
+  uint32_t enteredMs = 0;
+  uint64_t totalMs[MODE_MAX_VALUE + 1] = {};  // Earlier stays in each state
 
   State get()        { return state; }
   bool  is (State m) { return (state == m); }
   void  set(State m);
+
+  // Including the current stay
+  uint64_t timeIn(State m) {
+    return totalMs[m] + ((state == m) ? millis() - enteredMs : 0);
+  }
 };
 
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Boot steps, when they started and how long they took.
+ *
+ * setup() times a step on its own task with run(), or hands a step that
+ * nothing waits for right away to a task of its own with spawn(), and
+ * join()s it where something depends on it. mark() records a milestone,
+ * like the keypad taking input. Times are esp_timer us, counted from early
+ * in app startup, so the implicit "startup" step covers ESP-IDF and Arduino
+ * init up to begin().
+ *
+ * Only setup() adds steps; spawned tasks only stamp the end of their own,
+ * so printing from another task shows a step in progress as running.
+ */
+
+class BootTimeline {
+   public:
+    static const uint8_t MAX_STEPS = 16;
+
+    typedef void (*Init)();
+
+    void begin() {
+        _steps[0].name = "startup";
+        _steps[0].milestone = false;
+        _steps[0].start = 0;
+        _steps[0].end = now();
+        _count = 1;
+    }
+
+    void run(const char *name, Init init) {
+        Step *step = add(name);
+        init();
+        if (step) step->end = now();
+    }
+
+    // Returns the step to join(), or -1 when it already ran inline
+    int8_t spawn(const char *name, Init init, uint32_t stack = 4096) {
+        Step *step = add(name);
+        if (!step) {
+            init();
+            return -1;
+        }
+        step->init = init;
+        if (xTaskCreatePinnedToCore(stepTask, name, stack, step, 1, NULL, 0) !=
+            pdPASS) {
+            init();
+            step->end = now();
+        }
+        return step - _steps;
+    }
+
+    bool done(int8_t step) const {
+        return step < 0 || step >= _count || _steps[step].end != 0;
+    }
+
+    // Every step so far, spawned ones included, has ended
+    bool finished() const {
+        for (uint8_t i = 0; i < _count; i++) {
+            if (!done(i)) return false;
+        }
+        return true;
+    }
+
+    // Polls every tick, the few joins at boot wait for tens of ms at most
+    void join(int8_t step) {
+        while (!done(step)) vTaskDelay(1);
+    }
+
+    void mark(const char *name) {
+        Step *step = add(name);
+        if (step) {
+            step->milestone = true;
+            step->end = step->start;
+        }
+    }
+
+    template <typename Out>
+    void print(Out &out) const {
+        out.printf(" %-16s %10s %11s\n", "Boot step", "start us", "took us");
+        for (uint8_t i = 0; i < _count; i++) {
+            const Step &step = _steps[i];
+            uint32_t end = step.end;
+            if (!end) {
+                out.printf("   %-14s %10lu     running\n", step.name,
+                           (unsigned long)step.start);
+            } else if (step.milestone) {
+                out.printf("   %-14s %10lu\n", step.name,
+                           (unsigned long)step.start);
+            } else {
+                out.printf("   %-14s %10lu %11lu\n", step.name,
+                           (unsigned long)step.start,
+                           (unsigned long)(end - step.start));
+            }
+        }
+    }
+
+   private:
+    struct Step {
+        const char *name;
+        Init init;
+        bool milestone;
+        uint32_t start;
+        std::atomic<uint32_t> end{0};  // 0 while running
+    };
+
+    static uint32_t now() {
+        // Never 0, that means still running
+        return max<uint32_t>(esp_timer_get_time(), 1);
+    }
+
+    Step *add(const char *name) {
+        if (_count >= MAX_STEPS) return nullptr;
+        Step &step = _steps[_count];
+        step.name = name;
+        step.milestone = false;
+        step.start = now();
+        step.end = 0;
+        _count++;
+        return &step;
+    }
+
+    static void stepTask(void *parameter) {
+        Step *step = static_cast<Step *>(parameter);
+        step->init();
+        step->end = now();
+        vTaskDelete(NULL);
+    }
+
+    Step _steps[MAX_STEPS];
+    std::atomic<uint8_t> _count{0};
+};
+
+BootTimeline bootTimeline;
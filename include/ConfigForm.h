@@ -0,0 +1,53 @@
+#pragma once
+
+// Generated by scripts/gzip_assets.py from portal/config.html,
+// edit that file instead.
+
+// 675 bytes, 1458 before compression
+static const char configFormEtag[] = "\"9632153c\"";
+
+static const uint8_t configFormGz[] PROGMEM = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x9d, 0x54, 0x6d, 0x6b, 0xdb, 0x30,
+  0x10, 0xfe, 0x9e, 0x5f, 0xa1, 0x79, 0x0c, 0x36, 0xa8, 0x93, 0x2c, 0x7d, 0x81, 0x39, 0x8e, 0xa1,
+  0xec, 0x85, 0x7d, 0xd8, 0xd8, 0xd8, 0x0a, 0x63, 0x2b, 0x65, 0xc8, 0xd6, 0xd9, 0x16, 0x91, 0x25,
+  0x4f, 0x3a, 0x37, 0x49, 0x4b, 0xff, 0xfb, 0x4e, 0x96, 0xd3, 0xa6, 0x5d, 0xd7, 0x8d, 0x62, 0xb0,
+  0x4f, 0xba, 0xb7, 0xe7, 0xee, 0x9e, 0x73, 0xfa, 0xe4, 0xcd, 0xa7, 0xd7, 0x27, 0xdf, 0x3f, 0xbf,
+  0x65, 0xef, 0x4f, 0x3e, 0x7e, 0xc8, 0x46, 0x69, 0x8d, 0x8d, 0xca, 0xd2, 0x1a, 0xb8, 0xc8, 0x46,
+  0x8c, 0xa5, 0x28, 0x51, 0x41, 0xf6, 0x4d, 0xbe, 0x93, 0xcc, 0x01, 0x76, 0x6d, 0x3a, 0x09, 0x37,
+  0x5e, 0xe7, 0x70, 0x13, 0xa4, 0xdc, 0x88, 0x0d, 0xbb, 0x24, 0x81, 0x44, 0x5e, 0x2c, 0x2b, 0x6b,
+  0x3a, 0x2d, 0xe2, 0xc2, 0x28, 0x63, 0x13, 0xf6, 0xb4, 0x2c, 0xfc, 0x33, 0x0f, 0x6a, 0xb3, 0x8e,
+  0x9d, 0xbc, 0x90, 0xba, 0x4a, 0x48, 0xb6, 0x02, 0x6c, 0x4c, 0x57, 0x5e, 0x77, 0x35, 0xc4, 0xd9,
+  0x63, 0x52, 0xb7, 0x1d, 0x0e, 0xe1, 0x4a, 0xa3, 0x31, 0x2e, 0x79, 0x23, 0xd5, 0x26, 0x61, 0x5f,
+  0x4c, 0x6e, 0xd0, 0xec, 0x31, 0xc7, 0xb5, 0x8b, 0x1d, 0x58, 0x59, 0xce, 0x6f, 0x8c, 0x56, 0x20,
+  0xab, 0x1a, 0x13, 0x76, 0x30, 0x9d, 0xee, 0xdc, 0x52, 0x2e, 0x48, 0xd8, 0xcb, 0xa3, 0xf6, 0x3a,
+  0xc7, 0xb8, 0x00, 0x8d, 0x60, 0x41, 0x0c, 0x19, 0x5a, 0xe3, 0x24, 0x4a, 0xa3, 0x13, 0x56, 0xca,
+  0x35, 0x88, 0xe0, 0x8b, 0xa6, 0x4d, 0xd8, 0xe1, 0xf4, 0x59, 0x38, 0x29, 0x28, 0x71, 0xe7, 0x88,
+  0x96, 0xf2, 0x97, 0xc6, 0x36, 0x49, 0x10, 0x15, 0x47, 0x78, 0x1e, 0x93, 0x7a, 0x8f, 0xf9, 0xf7,
+  0x8b, 0xf9, 0x28, 0x04, 0xe6, 0x42, 0xf4, 0x75, 0xce, 0xa6, 0x21, 0xfb, 0xbd, 0xcd, 0x29, 0x8a,
+  0xeb, 0xce, 0xf4, 0xdd, 0xb0, 0x5c, 0xc8, 0xce, 0x51, 0x19, 0x37, 0x88, 0x91, 0xa0, 0x5e, 0x47,
+  0x9b, 0x32, 0xff, 0x1c, 0x92, 0xb6, 0xd7, 0x29, 0x9e, 0x83, 0x22, 0xf5, 0xaa, 0x96, 0x08, 0xb1,
+  0x6b, 0x79, 0x01, 0x89, 0x36, 0x2b, 0xcb, 0xdb, 0xa0, 0x1f, 0x7a, 0xc9, 0x56, 0x52, 0x60, 0xed,
+  0xa1, 0x40, 0xb3, 0xa3, 0x38, 0xd5, 0xbc, 0x81, 0x45, 0xd4, 0x1a, 0x8b, 0xd1, 0xd9, 0x8d, 0xd5,
+  0xe1, 0x6d, 0x23, 0xdc, 0xb4, 0x64, 0xe4, 0xba, 0xbc, 0x91, 0x64, 0x46, 0xf3, 0x69, 0x2a, 0xb2,
+  0x6d, 0xb8, 0xad, 0x24, 0x75, 0x8d, 0x77, 0x68, 0xe6, 0x4c, 0x48, 0xd7, 0x2a, 0x4e, 0x33, 0xca,
+  0x95, 0x29, 0x96, 0xf3, 0x6d, 0xa4, 0x7d, 0xea, 0x59, 0x1f, 0x29, 0x9d, 0x0c, 0x64, 0x49, 0x27,
+  0x3d, 0xb5, 0x52, 0x3f, 0x6a, 0x3a, 0x09, 0x79, 0xce, 0x0a, 0xc5, 0x9d, 0x5b, 0x44, 0xdb, 0xb9,
+  0x44, 0x3d, 0xb7, 0x7c, 0x7f, 0x59, 0x03, 0x58, 0x1b, 0xb1, 0x88, 0x2a, 0xc0, 0x88, 0xf1, 0xc2,
+  0x8f, 0x89, 0xec, 0x8c, 0x2e, 0x65, 0xd5, 0x5b, 0x91, 0x5d, 0x28, 0x30, 0x40, 0xac, 0xa5, 0x10,
+  0xa0, 0x23, 0x16, 0xaa, 0x92, 0x65, 0xc4, 0xce, 0xb9, 0xea, 0x48, 0x5c, 0xc9, 0x52, 0x6e, 0x1d,
+  0x90, 0xe7, 0x81, 0xb4, 0x5e, 0xb6, 0x59, 0x8a, 0x04, 0x26, 0x74, 0x91, 0x52, 0x52, 0x99, 0x4e,
+  0x12, 0x82, 0x9e, 0xef, 0x1a, 0x70, 0x65, 0xec, 0x32, 0x49, 0x27, 0xbd, 0x3e, 0x23, 0xea, 0x8b,
+  0xcc, 0x7b, 0x91, 0xc7, 0x6e, 0x5a, 0x84, 0x35, 0x6e, 0x93, 0xf6, 0xee, 0xd4, 0x9b, 0xb5, 0x02,
+  0x5d, 0x61, 0xbd, 0x38, 0x3a, 0x60, 0x16, 0x7e, 0x75, 0x92, 0xea, 0x5a, 0x44, 0x5b, 0x29, 0x0a,
+  0xa1, 0xe8, 0x65, 0xff, 0x0e, 0xa4, 0xa5, 0xa6, 0x0c, 0x40, 0xbc, 0x48, 0x48, 0xc4, 0x1d, 0x24,
+  0x0f, 0x02, 0xe9, 0xdd, 0x6f, 0x01, 0xf9, 0x9f, 0xa4, 0xb9, 0xda, 0xe8, 0x65, 0x94, 0x1d, 0x77,
+  0x58, 0xd3, 0x0e, 0x2c, 0x41, 0xdf, 0x2d, 0xfe, 0xe1, 0xa4, 0xc1, 0x9d, 0x11, 0x13, 0x0a, 0xa8,
+  0x8d, 0x22, 0x3e, 0x2f, 0x22, 0x3e, 0xcd, 0x5f, 0x16, 0x33, 0x31, 0x1e, 0x8f, 0x49, 0xc1, 0x91,
+  0x46, 0x4c, 0x33, 0x3c, 0x8d, 0x7f, 0xf2, 0xf8, 0xe2, 0x38, 0xfe, 0x31, 0x8d, 0x5f, 0x9d, 0x5d,
+  0xee, 0xcf, 0xae, 0x08, 0xaa, 0xd4, 0x03, 0xd4, 0x68, 0x7f, 0xb6, 0x8b, 0xbc, 0x3f, 0x3e, 0xb2,
+  0x89, 0xb5, 0x71, 0x18, 0x65, 0x5f, 0xc1, 0x9e, 0x83, 0xfd, 0xa3, 0x14, 0xc6, 0xfe, 0x55, 0x4f,
+  0xef, 0xbe, 0x25, 0xd1, 0x23, 0xc6, 0x3a, 0x09, 0x64, 0x4b, 0x73, 0x3b, 0xb9, 0x87, 0xae, 0xc3,
+  0x46, 0x6d, 0xe3, 0x1f, 0xb7, 0xad, 0xda, 0x04, 0xf2, 0x4f, 0x3c, 0xfb, 0xfd, 0xae, 0xd0, 0x7a,
+  0xf8, 0x4f, 0xbf, 0x2c, 0xb4, 0x39, 0xfe, 0xd7, 0x3c, 0xfa, 0x0d, 0xc1, 0xd4, 0x3a, 0xbc, 0xb2,
+  0x05, 0x00, 0x00,
+};
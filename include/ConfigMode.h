@@ -2,60 +2,176 @@
 #include <WiFiClient.h>
 #include <WebServer.h>
 #include <DNSServer.h>
-#include <Update.h>
-
-static const char configForm[] PROGMEM = R"html(
-<!DOCTYPE HTML>
-<html><head>
-  <title>WiFi setup</title>
-  <style>
-  body {
-    background-color: #fcfcfc;
-    box-sizing: border-box;
-  }
-  body, input {
-    font-family: Roboto, sans-serif;
-    font-weight: 400;
-    font-size: 16px;
-  }
-  .centered {
-    position: fixed;
-    top: 50%;
-    left: 50%;
-    transform: translate(-50%, -50%);
-
-    padding: 20px;
-    background-color: #ccc;
-    border-radius: 4px;
-  }
-  td { padding:0 0 0 5px; }
-  label { white-space:nowrap; }
-  input { width: 20em; }
-  input[name="port"] { width: 5em; }
-  input[type="submit"], img { margin: auto; display: block; width: 30%; }
-  </style>
-</head><body>
-<div class="centered">
-  <form method="get" action="config">
-    <input type="hidden" name="if" value="wifi">
-    <table>
-    <tr><td><label for="ssid">WiFi network:</label></td>  <td><input type="text" name="ssid" maxlength=64 required="required"></td></tr>
-    <tr><td><label for="pass">WiFi password:</label></td> <td><input type="text" name="pass" maxlength=64></td></tr>
-    <tr><td><label for="blynk">Auth token:</label></td>   <td><input type="text" name="blynk" placeholder="a0b1c2d..." pattern="[-_a-zA-Z0-9]{32}" minlength="32" maxlength="32" required="required"></td></tr>
-    <tr><td><label for="host">Server:</label></td>        <td><input type="text" name="host" value="" maxlength=64 required="required"></td></tr>
-    </table><br/>
-    <input type="submit" value="Apply">
-  </form>
-</div>
-</body></html>
-)html";
+
+#include "ConfigForm.h"
+#include "JsonWriter.h"
+#include "OtaPayload.h"
+#include "OtaPipeline.h"
+#include "esp_rom_crc.h"
 
 WebServer server(80);
 DNSServer dnsServer;
 const byte DNS_PORT = 53;
 
+// Chunked application/json reply, fed by a JsonWriter. Output is batched
+// into a small stack buffer, each full buffer goes out as one chunk.
+class JsonReply : public Print {
+public:
+  explicit JsonReply(int code = 200) {
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(code, "application/json", "");
+  }
+
+  ~JsonReply() {
+    sendBuffered();
+    server.sendContent("");
+  }
+
+  size_t write(uint8_t c) override {
+    return write(&c, 1);
+  }
+
+  size_t write(const uint8_t* data, size_t len) override {
+    for (size_t i = 0; i < len; i++) {
+      if (_len == sizeof(_buff)) sendBuffered();
+      _buff[_len++] = data[i];
+    }
+    return len;
+  }
+
+private:
+  void sendBuffered() {
+    if (_len) server.sendContent(_buff, _len);
+    _len = 0;
+  }
+
+  char   _buff[256];
+  size_t _len = 0;
+};
+
+// Passes writes straight on as reply content, for senders that already
+// write in blocks
+class ContentReply : public Print {
+public:
+  size_t write(uint8_t c) override {
+    return write(&c, 1);
+  }
+
+  size_t write(const uint8_t* data, size_t len) override {
+    server.sendContent((const char*)data, len);
+    return len;
+  }
+};
+
+static
+void sendJsonStatus(int code, const char* status, const char* msg) {
+  JsonReply reply(code);
+  JsonWriter(reply).beginObject()
+    .member("status", status)
+    .member("msg", msg)
+    .endObject();
+}
+
 static int connectNetRetries    = WIFI_CLOUD_MAX_RETRIES;
 static int connectBlynkRetries  = WIFI_CLOUD_MAX_RETRIES;
+static bool uploadOk            = false;
+static bool uploadPipelined     = false;
+static bool netJoinedFast       = false;  // This link came from netCache
+static bool netLeaseApplied     = false;  // The cached lease is configured
+static uint32_t bootToRunningMs = 0;
+
+// Connecting to WiFi and to the cloud are state machines, advanced one step
+// per loop pass, so the loop task keeps running the lock meanwhile. WiFi
+// events end a join as soon as the driver knows how it went. Failures back
+// off exponentially, with jitter so devices behind the same AP do not all
+// retry at once, and reset on success.
+//
+// The cloud leg is only partly non-blocking: the DNS lookup, the TCP
+// connect and the TLS handshake still run inside one Blynk.run() call, so
+// a pass that opens the connection holds the loop for up to the socket
+// connect timeout plus the handshake timeout. Without a fresh DnsCache
+// entry add up to 2 x DnsCache::QUERY_TIMEOUT_MS for its query, plus
+// lwIP's resolver timeout when that query fails. That wait is accepted:
+// the timeouts only run out when DNS does not answer, and the device is
+// offline then anyway.
+enum ConnectStep : uint8_t {
+  CONNECT_START,
+  CONNECT_WAIT,     // Until connected, failed or the deadline
+  CONNECT_BACKOFF,  // Until the deadline
+};
+
+struct ConnectMachine {
+  ConnectStep step;
+  uint32_t    stateChange;  // BlynkState::changes when it last ran
+  uint32_t    deadline;
+  uint8_t     failures;     // In a row
+};
+
+static ConnectMachine netConnect   = {};
+static ConnectMachine cloudConnect = {};
+static volatile bool netDropped    = false;
+static volatile uint8_t netDropReason = 0;
+// Each join is a new attempt. Events only count once the driver has
+// started the station for the current one: the disconnect from ending the
+// previous attempt is delivered later, on the event task, and must not
+// fail this one.
+static volatile uint32_t netAttempt   = 0;
+static volatile uint32_t netStarted   = 0;
+
+// Runs on the Arduino event task, only leaves notes for the loop
+static void onWiFiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+  switch (event) {
+  case ARDUINO_EVENT_WIFI_STA_START:
+    netStarted = netAttempt;
+    break;
+  case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+    if (netStarted != netAttempt) break;
+    netDropReason = info.wifi_sta_disconnected.reason;
+    netDropped = true;
+    break;
+  case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+    if (netStarted != netAttempt) break;
+    netDropped = true;
+    break;
+  default:
+    break;
+  }
+}
+
+// A machine starts over whenever its BlynkState was left in between
+static ConnectStep connectStep(ConnectMachine& m) {
+  if (m.stateChange != BlynkState::changes) {
+    m.stateChange = BlynkState::changes;
+    m.step = CONNECT_START;
+  }
+  return m.step;
+}
+
+static bool connectDue(const ConnectMachine& m) {
+  return (int32_t)(millis() - m.deadline) >= 0;
+}
+
+// Schedules the next attempt, returns the delay
+static uint32_t connectBackoff(ConnectMachine& m) {
+  uint32_t delayMs = WIFI_BACKOFF_MAX;
+  if (m.failures < 16) {
+    delayMs = min((uint32_t)WIFI_BACKOFF_MIN << m.failures, (uint32_t)WIFI_BACKOFF_MAX);
+  }
+  if (m.failures < 255) {
+    m.failures++;
+  }
+  // Half of it fixed, the other half random
+  delayMs = delayMs / 2 + esp_random() % (delayMs / 2 + 1);
+  m.step = CONNECT_BACKOFF;
+  m.deadline = millis() + delayMs;
+  return delayMs;
+}
+
+// netCache entries only apply to the credentials they were made with
+static uint32_t netCacheKey() {
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)configStore.wifiSSID, sizeof(configStore.wifiSSID));
+  return esp_rom_crc32_le(crc, (const uint8_t*)configStore.wifiPass, sizeof(configStore.wifiPass));
+}
 
 static const char serverUpdateForm[] PROGMEM = R"html(
 <html><body>
@@ -112,11 +228,181 @@ String getWiFiNetworkBSSID() {
   return WiFi.BSSIDstr();
 }
 
+// Scan results are cached while the AP is up and refreshed in the
+// background, so /wifi_scan.json answers without waiting for the radio
+struct WiFiScanEntry {
+  char              ssid[33];
+  uint8_t           bssid[6];
+  int8_t            rssi;
+  uint8_t           channel;
+  wifi_auth_mode_t  sec;
+};
+
+static const int      WIFI_SCAN_TOP      = 15;    // Networks shown in the portal
+static const uint32_t WIFI_SCAN_INTERVAL = 30000;
+
+static WiFiScanEntry  wifiScanCache[WIFI_SCAN_TOP];
+static int            wifiScanCount   = -1;       // -1 until the first scan is done
+static uint32_t       wifiScanUpdated = 0;
+static bool           wifiScanRunning = false;
+
+static
+void wifiScanStart() {
+  if (WiFi.scanNetworks(true, true) == WIFI_SCAN_FAILED) {
+    DEBUG_PRINT("WiFi scan failed to start");
+    wifiScanUpdated = millis();
+    return;
+  }
+  wifiScanRunning = true;
+}
+
+// Keeps the strongest WIFI_SCAN_TOP named networks, strongest first.
+// Each result is read once, no String copies are made.
+static
+void wifiScanCollect(int found) {
+  int count = 0;
+  for (int i = 0; i < found; i++) {
+    const wifi_ap_record_t* ap = (const wifi_ap_record_t*)WiFi.getScanInfoByIndex(i);
+    if (!ap || !ap->ssid[0]) continue;  // Hidden network
+    if (count == WIFI_SCAN_TOP && ap->rssi <= wifiScanCache[count-1].rssi) continue;
+
+    int pos = (count < WIFI_SCAN_TOP) ? count++ : count - 1;
+    while (pos > 0 && wifiScanCache[pos-1].rssi < ap->rssi) {
+      wifiScanCache[pos] = wifiScanCache[pos-1];
+      pos--;
+    }
+    WiFiScanEntry& entry = wifiScanCache[pos];
+    memcpy(entry.ssid, ap->ssid, sizeof(entry.ssid));
+    entry.ssid[sizeof(entry.ssid)-1] = '\0';
+    memcpy(entry.bssid, ap->bssid, sizeof(entry.bssid));
+    entry.rssi    = ap->rssi;
+    entry.channel = ap->primary;
+    entry.sec     = ap->authmode;
+  }
+  wifiScanCount = count;
+  DEBUG_PRINT(String("Found networks: ") + found + ", cached " + count);
+}
+
+// Called from the config loop: collects a finished scan and starts the next
+static
+void wifiScanPoll() {
+  if (wifiScanRunning) {
+    int found = WiFi.scanComplete();
+    if (found == WIFI_SCAN_RUNNING) return;
+    wifiScanRunning = false;
+    wifiScanUpdated = millis();
+    if (found >= 0) {
+      wifiScanCollect(found);
+    }
+    WiFi.scanDelete();
+  } else if (millis() - wifiScanUpdated >= WIFI_SCAN_INTERVAL) {
+    wifiScanStart();
+  }
+}
+
+// Waits for the upload to reach flash and checks it, true when the new
+// image is ready to boot
+static
+bool uploadFinish() {
+  bool ok = uploadOk;
+  if (uploadPipelined) {
+    uploadPipelined = false;
+    if (!otaPipeline.finish() && ok) {
+      DEBUG_PRINT(otaPipeline.error());
+      ok = false;
+    }
+    otaPipeline.end();
+    DEBUG_PRINT("Upload: " + otaPipeline.stats().summary());
+  }
+  if (ok && !otaPayload.finish()) {
+    DEBUG_PRINT(otaPayload.error());
+    ok = false;
+  }
+  if (ok && !otaImage.finish()) {
+    DEBUG_PRINT(otaImage.error());
+    ok = false;
+  }
+  otaPayload.close();
+  otaImage.close();
+  return ok;
+}
+
+// Sends the ETag, and a bodyless 304 when the browser already has it
+static
+bool portalNotModified(const String& etag) {
+  server.sendHeader("ETag", etag);
+  if (server.header("If-None-Match") == etag) {
+    server.send(304);
+    return true;
+  }
+  return false;
+}
+
 static
 void handleRoot() {
-  server.send(200, "text/html", configForm);
+  if (portalNotModified(configFormEtag)) return;
+  server.sendHeader("Cache-Control", "no-cache");
+  server.sendHeader("Content-Encoding", "gzip");
+  server.send_P(200, "text/html", (const char*)configFormGz, sizeof(configFormGz));
 }
 
+#ifdef BLYNK_FS
+// Portal files from the data/ image, preferably the .gz copies that
+// scripts/gzip_assets.py puts there
+struct PortalAsset {
+  const char* uri;
+  const char* path;
+  const char* type;
+  const char* cache;
+  String      file;   // Path actually served
+  String      etag;   // CRC32 of its content
+};
+
+static PortalAsset portalAssets[] = {
+  { "/",                "/index.html",       "text/html", "no-cache"        },
+  { "/img/logo.png",    "/img/logo.png",     "image/png", "max-age=86400"   },
+  { "/img/favicon.png", "/img/favicon.png",  "image/png", "max-age=86400"   },
+};
+
+static
+bool portalAssetOpen(PortalAsset& asset) {
+  asset.file = String(asset.path) + ".gz";
+  if (!BLYNK_FS.exists(asset.file)) {
+    asset.file = asset.path;
+  }
+
+  File f = BLYNK_FS.open(asset.file, FILE_READ);
+  if (!f) return false;
+
+  uint8_t buff[256];
+  uint32_t crc = 0;
+  while (size_t len = f.read(buff, sizeof(buff))) {
+    crc = BlynkCRC32(buff, len, crc);
+  }
+  f.close();
+
+  char etag[12];
+  snprintf(etag, sizeof(etag), "\"%08x\"", crc);
+  asset.etag = etag;
+  return true;
+}
+
+static
+void portalAssetServe(const PortalAsset& asset) {
+  if (portalNotModified(asset.etag)) return;
+
+  File f = BLYNK_FS.open(asset.file, FILE_READ);
+  if (!f) {
+    server.send(404, "text/plain", "Not found");
+    return;
+  }
+  server.sendHeader("Cache-Control", asset.cache);
+  // streamFile adds Content-Encoding: gzip for .gz files
+  server.streamFile(f, asset.type);
+  f.close();
+}
+#endif
+
 void enterConfigMode()
 {
   WiFi.mode(WIFI_OFF);
@@ -144,7 +430,7 @@ void enterConfigMode()
   });
   server.on("/update", HTTP_POST, []() {
     server.sendHeader("Connection", "close");
-    if (!Update.hasError()) {
+    if (uploadOk) {
       server.send(200, "text/plain", "OK");
     } else {
       server.send(500, "text/plain", "FAIL");
@@ -156,13 +442,24 @@ void enterConfigMode()
       DEBUG_PRINT(String("Update: ") + upload.filename);
       //WiFiUDP::stop();
 
-      if (!Update.begin(UPDATE_SIZE_UNKNOWN)) { //start with max available size
-        DEBUG_PRINT(Update.errorString());
+      // Plain, gzipped or delta, the size comes from the image itself
+      uploadOk = otaImage.open("");
+      if (uploadOk) {
+        otaImage.restart(false);
+        otaPayload.begin(0, nullptr);
+        // Flash is written in the background while the next part arrives
+        uploadOk = uploadPipelined = otaPipeline.begin(true);
+        if (!uploadOk) {
+          DEBUG_PRINT(otaPipeline.error());
+        }
+      } else {
+        DEBUG_PRINT(otaImage.error());
       }
     } else if (upload.status == UPLOAD_FILE_WRITE) {
       /* flashing firmware to ESP*/
-      if (Update.write(upload.buf, upload.currentSize) != upload.currentSize) {
-        DEBUG_PRINT(Update.errorString());
+      if (uploadOk && !otaPipeline.push(upload.buf, upload.currentSize)) {
+        DEBUG_PRINT(otaPipeline.error());
+        uploadOk = false;
       }
 #ifdef BLYNK_PRINT
       BLYNK_PRINT.print(".");
@@ -172,11 +469,13 @@ void enterConfigMode()
       BLYNK_PRINT.println();
 #endif
       DEBUG_PRINT("Finishing...");
-      if (Update.end(true)) { //true to set the size to the current progress
+      uploadOk = uploadFinish();
+      if (uploadOk) {
         DEBUG_PRINT("Update Success. Rebooting");
-      } else {
-        DEBUG_PRINT(Update.errorString());
       }
+    } else if (upload.status == UPLOAD_FILE_ABORTED) {
+      uploadOk = false;
+      uploadFinish();
     }
   });
   server.on("/config", []() {
@@ -199,8 +498,6 @@ void enterConfigMode()
 
     bool forceSave  = server.arg("save").toInt();
 
-    String content;
-
     DEBUG_PRINT(String("WiFi SSID: ") + ssid + " Pass: " + pass);
     DEBUG_PRINT(String("Blynk cloud: ") + token + " @ " + host + ":" + port);
 
@@ -239,20 +536,18 @@ void enterConfigMode()
 
       if (forceSave) {
         configStore.setFlag(CONFIG_FLAG_VALID, true);
-        config_save();
+        config_save(CONFIG_DIRTY_CREDENTIALS | CONFIG_DIRTY_NETWORK | CONFIG_DIRTY_STATE);
 
-        content = R"json({"status":"ok","msg":"Configuration saved"})json";
+        sendJsonStatus(200, "ok", "Configuration saved");
       } else {
-        content = R"json({"status":"ok","msg":"Trying to connect..."})json";
+        sendJsonStatus(200, "ok", "Trying to connect...");
       }
-      server.send(200, "application/json", content);
 
       connectNetRetries = connectBlynkRetries = 1;
       BlynkState::set(MODE_SWITCH_TO_STA);
     } else {
       DEBUG_PRINT("Configuration invalid");
-      content = R"json({"status":"error","msg":"Configuration invalid"})json";
-      server.send(500, "application/json", content);
+      sendJsonStatus(500, "error", "Configuration invalid");
     }
   });
   server.on("/board_info.json", []() {
@@ -262,103 +557,109 @@ void enterConfigMode()
     DEBUG_PRINT("Sending board info...");
     const char* tmpl = BLYNK_TEMPLATE_ID;
 
-    char buff[512];
-    snprintf(buff, sizeof(buff),
-      R"json({"board":"%s","tmpl_id":"%s","fw_type":"%s","fw_ver":"%s","uid":"%s","ssid":"%s","bssid":"%s","mac":"%s","last_error":%d,"wifi_scan":true,"static_ip":true})json",
-      BLYNK_TEMPLATE_NAME,
-      tmpl ? tmpl : "Unknown",
-      BLYNK_FIRMWARE_TYPE,
-      BLYNK_FIRMWARE_VERSION,
-      systemGetDeviceUID().c_str(),
-      systemGetDeviceName().c_str(),
-      getWiFiApBSSID().c_str(),
-      getWiFiMacAddress().c_str(),
-      configStore.last_error
-    );
-    server.send(200, "application/json", buff);
+    JsonReply reply;
+    JsonWriter(reply).beginObject()
+      .member("board",      BLYNK_TEMPLATE_NAME)
+      .member("tmpl_id",    tmpl ? tmpl : "Unknown")
+      .member("fw_type",    BLYNK_FIRMWARE_TYPE)
+      .member("fw_ver",     BLYNK_FIRMWARE_VERSION)
+      .member("uid",        systemGetDeviceUID().c_str())
+      .member("ssid",       systemGetDeviceName().c_str())
+      .member("bssid",      getWiFiApBSSID().c_str())
+      .member("mac",        getWiFiMacAddress().c_str())
+      .member("last_error", configStore.last_error)
+      .member("wifi_scan",  true)
+      .member("static_ip",  true)
+      .endObject();
   });
   server.on("/wifi_scan.json", []() {
-    DEBUG_PRINT("Scanning networks...");
-    int wifi_nets = WiFi.scanNetworks(true, true);
-    const uint32_t t = millis();
-    while (wifi_nets < 0 &&
-           millis() - t < 20000)
-    {
-      delay(20);
-      wifi_nets = WiFi.scanComplete();
+    // Never waits for the radio: until the first scan is in, the list is
+    // empty and the client is told when to ask again
+    if (wifiScanCount < 0) {
+      server.sendHeader("Retry-After", "2");
     }
-    DEBUG_PRINT(String("Found networks: ") + wifi_nets);
-
-    if (wifi_nets > 0) {
-      // Sort networks
-      int indices[wifi_nets];
-      for (int i = 0; i < wifi_nets; i++) {
-        indices[i] = i;
-      }
-      for (int i = 0; i < wifi_nets; i++) {
-        for (int j = i + 1; j < wifi_nets; j++) {
-          if (WiFi.RSSI(indices[j]) > WiFi.RSSI(indices[i])) {
-            std::swap(indices[i], indices[j]);
-          }
-        }
-      }
-
-      wifi_nets = BlynkMin(15, wifi_nets); // Show top 15 networks
-
-      // TODO: skip empty names
-      String result = "[\n";
 
-      char buff[256];
-      for (int i = 0; i < wifi_nets; i++){
-        int id = indices[i];
-
-        String ssid = WiFi.SSID(id);
-        ssid.replace("\"", "\\\"");
-
-        snprintf(buff, sizeof(buff),
-          R"json(  {"ssid":"%s","bssid":"%s","rssi":%i,"sec":"%s","ch":%i})json",
-          ssid.c_str(),
-          WiFi.BSSIDstr(id).c_str(),
-          WiFi.RSSI(id),
-          wifiSecToStr(WiFi.encryptionType(id)),
-          WiFi.channel(id)
-        );
-
-        result += buff;
-        if (i != wifi_nets-1) result += ",\n";
-      }
-      WiFi.scanDelete();
-      server.send(200, "application/json", result + "\n]");
-    } else {
-      server.send(200, "application/json", "[]");
+    JsonReply reply;
+    JsonWriter json(reply);
+    json.beginArray();
+    for (int i = 0; i < wifiScanCount; i++) {
+      const WiFiScanEntry& net = wifiScanCache[i];
+
+      char bssid[18];
+      snprintf(bssid, sizeof(bssid), "%02X:%02X:%02X:%02X:%02X:%02X",
+               net.bssid[0], net.bssid[1], net.bssid[2],
+               net.bssid[3], net.bssid[4], net.bssid[5]);
+
+      json.beginObject()
+        .member("ssid",  net.ssid)
+        .member("bssid", bssid)
+        .member("rssi",  net.rssi)
+        .member("sec",   wifiSecToStr(net.sec))
+        .member("ch",    net.channel)
+        .endObject();
+    }
+    json.endArray();
+  });
+  // coredump.bin, or coredump.bin.gz with ?gz=1
+  server.on("/coredump", HTTP_GET, []() {
+    CoreDumpExport dump;
+    uint32_t crc = 0;
+    if (!dump.begin() || !dump.checksum(crc)) {
+      sendJsonStatus(404, "error", dump.error());
+      return;
     }
+    const bool gzip = server.arg("gz") == "1";
+    char crcHex[9];
+    snprintf(crcHex, sizeof(crcHex), "%08lx", (unsigned long)crc);
+    server.sendHeader("X-Coredump-Size", String(dump.size()));
+    server.sendHeader("X-Coredump-CRC32", crcHex);
+    server.sendHeader("Content-Disposition", gzip ?
+                      "attachment; filename=coredump.bin.gz" :
+                      "attachment; filename=coredump.bin");
+    // Raw is sent with its length, gzip in chunks
+    server.setContentLength(gzip ? CONTENT_LENGTH_UNKNOWN : dump.size());
+    server.send(200, "application/octet-stream", "");
+    ContentReply reply;
+    if (dump.send(reply, gzip)) {
+      DEBUG_PRINT(String("Coredump: ") + dump.size() + " bytes sent as " +
+                  dump.sent() + " in " + dump.elapsedMs() + " ms");
+    }
+    if (gzip) server.sendContent("");
   });
   server.on("/reset", []() {
     BlynkState::set(MODE_RESET_CONFIG);
-    server.send(200, "application/json", R"json({"status":"ok","msg":"Configuration reset"})json");
+    sendJsonStatus(200, "ok", "Configuration reset");
   });
   server.on("/reboot", []() {
     edgentTimer.setTimeout(50, systemReboot);
-    server.send(200, "application/json", R"json({"status":"ok","msg":"Rebooting"})json");
+    sendJsonStatus(200, "ok", "Rebooting");
   });
 
 #ifdef BLYNK_FS
-  if (BLYNK_FS.exists("/index.html")) {
-    server.serveStatic("/img/favicon.png", BLYNK_FS, "/img/favicon.png");
-    server.serveStatic("/img/logo.png", BLYNK_FS, "/img/logo.png");
-    server.serveStatic("/", BLYNK_FS, "/index.html");
+  if (portalAssetOpen(portalAssets[0])) {
+    for (PortalAsset& asset : portalAssets) {
+      if (&asset != &portalAssets[0] && !portalAssetOpen(asset)) continue;
+      server.on(asset.uri, HTTP_GET, [&asset]() { portalAssetServe(asset); });
+    }
   } else
 #endif
   { /* if no BLYNK_FS or index.html not found */
     server.on("/", handleRoot);
   }
 
+  const char* cacheHeaders[] = { "If-None-Match" };
+  server.collectHeaders(cacheHeaders, 1);
   server.begin();
 
+  wifiScanCount = -1;
+  wifiScanUpdated = 0;
+  wifiScanStart();
+
   while (BlynkState::is(MODE_WAIT_CONFIG) || BlynkState::is(MODE_CONFIGURING)) {
     delay(10);
     dnsServer.processNextRequest();
     server.handleClient();
+    wifiScanPoll();
     app_loop();
     if (BlynkState::is(MODE_CONFIGURING) && WiFi.softAPgetStationNum() == 0) {
       BlynkState::set(MODE_WAIT_CONFIG);
@@ -366,12 +667,21 @@ void enterConfigMode()
   }
 
   server.stop();
+  if (wifiScanRunning) {
+    wifiScanRunning = false;
+    WiFi.scanDelete();
+  }
 }
 
-void enterConnectNet() {
-  BlynkState::set(MODE_CONNECTING_NET);
+// Starts a join, with the cached BSSID and lease when there are any
+static void netJoin() {
   DEBUG_PRINT(String("Connecting to WiFi: ") + configStore.wifiSSID);
 
+  // Anything the driver reports before it restarts the station below is
+  // left over from the previous attempt
+  netAttempt++;
+  netDropped = false;
+
   // Needed for setHostname to work
   WiFi.enableSTA(false);
 
@@ -379,6 +689,8 @@ void enterConnectNet() {
   hostname.replace(" ", "-");
   WiFi.setHostname(hostname.c_str());
 
+  bool fast = netCache.valid(netCacheKey());
+
   if (configStore.getFlag(CONFIG_FLAG_STATIC_IP)) {
     if (!WiFi.config(configStore.staticIP,
                     configStore.staticGW,
@@ -391,20 +703,43 @@ void enterConnectNet() {
       BlynkState::set(MODE_ERROR);
       return;
     }
+  } else if (fast && netCache.hasLease) {
+    // The router still holds the lease from before the reset, skip DHCP
+    netLeaseApplied = WiFi.config(netCache.ip, netCache.gateway, netCache.mask,
+                                  netCache.dns, netCache.dns2);
+  } else if (netLeaseApplied) {
+    // Back to DHCP after the cached lease did not work out
+    WiFi.config((uint32_t)0, (uint32_t)0, (uint32_t)0);
+    netLeaseApplied = false;
   }
 
-  WiFi.begin(configStore.wifiSSID, configStore.wifiPass);
+  netJoinedFast = fast;
+  if (fast) {
+    DEBUG_PRINT(String("Rejoining on channel ") + netCache.channel);
+    netCache.fastJoins.tried++;
+    WiFi.begin(configStore.wifiSSID, configStore.wifiPass, netCache.channel, netCache.bssid);
+    netConnect.deadline = millis() + WIFI_FAST_CONNECT_TIMEOUT;
+  } else {
+    WiFi.begin(configStore.wifiSSID, configStore.wifiPass);
+    netConnect.deadline = millis() + WIFI_NET_CONNECT_TIMEOUT;
+  }
+  netConnect.step = CONNECT_WAIT;
+}
 
-  unsigned long timeoutMs = millis() + WIFI_NET_CONNECT_TIMEOUT;
-  while ((timeoutMs > millis()) && (WiFi.status() != WL_CONNECTED))
-  {
-    delay(10);
-    app_loop();
+void enterConnectNet() {
+  BlynkState::set(MODE_CONNECTING_NET);
 
-    if (!BlynkState::is(MODE_CONNECTING_NET)) {
-      WiFi.disconnect();
-      return;
+  switch (connectStep(netConnect)) {
+  case CONNECT_START:
+    netJoin();
+    return;
+  case CONNECT_BACKOFF:
+    if (connectDue(netConnect)) {
+      netConnect.step = CONNECT_START;
     }
+    return;
+  case CONNECT_WAIT:
+    break;
   }
 
   if (WiFi.status() == WL_CONNECTED) {
@@ -415,38 +750,79 @@ void enterConnectNet() {
       BLYNK_LOG_IP("Using Dynamic IP: ", localip);
     }
 
+    netCache.key = netCacheKey();
+    memcpy(netCache.bssid, WiFi.BSSID(), sizeof(netCache.bssid));
+    netCache.channel = WiFi.channel();
+    netCache.hasLease = !configStore.getFlag(CONFIG_FLAG_STATIC_IP);
+    netCache.ip = localip;
+    netCache.gateway = WiFi.gatewayIP();
+    netCache.mask = WiFi.subnetMask();
+    netCache.dns = WiFi.dnsIP(0);
+    netCache.dns2 = WiFi.dnsIP(1);
+
     connectNetRetries = WIFI_CLOUD_MAX_RETRIES;
+    netConnect.failures = 0;
+    netConnect.step = CONNECT_START;
     BlynkState::set(MODE_CONNECTING_CLOUD);
+    return;
+  }
+
+  // The driver gives up on a wrong password or a missing AP long before
+  // the timeout, no need to wait for it
+  if (!netDropped && !connectDue(netConnect)) {
+    return;
+  }
+  if (netDropped) {
+    DEBUG_PRINT(String("WiFi join failed, reason ") + netDropReason);
+  } else {
+    DEBUG_PRINT("WiFi join timed out");
+  }
+  WiFi.disconnect();
+
+  if (netJoinedFast) {
+    // The AP moved or went away, not worth a retry: scan right away
+    DEBUG_PRINT("Cached network not found, scanning");
+    netCache.fastJoins.failed++;
+    netCache.forget();
+    netConnect.step = CONNECT_START;
   } else if (--connectNetRetries <= 0) {
     config_set_last_error(BLYNK_PROV_ERR_NETWORK);
     BlynkState::set(MODE_ERROR);
+  } else {
+    DEBUG_PRINT(String("Retrying WiFi in ") + connectBackoff(netConnect) + " ms");
   }
 }
 
 void enterConnectCloud() {
   BlynkState::set(MODE_CONNECTING_CLOUD);
 
-  Blynk.config(configStore.cloudToken, configStore.cloudHost, configStore.cloudPort);
-  Blynk.connect(0);
-
-  unsigned long timeoutMs = millis() + WIFI_CLOUD_CONNECT_TIMEOUT;
-  while ((timeoutMs > millis()) &&
-        (WiFi.status() == WL_CONNECTED) &&
-        (!Blynk.isTokenInvalid()) &&
-        (Blynk.connected() == false))
-  {
-    delay(10);
-    Blynk.run();
-    app_loop();
-    if (!BlynkState::is(MODE_CONNECTING_CLOUD)) {
-      Blynk.disconnect();
-      return;
+  switch (connectStep(cloudConnect)) {
+  case CONNECT_START:
+    Blynk.config(configStore.cloudToken, configStore.cloudHost, configStore.cloudPort);
+    Blynk.connect(0);
+    cloudConnect.deadline = millis() + WIFI_CLOUD_CONNECT_TIMEOUT;
+    cloudConnect.step = CONNECT_WAIT;
+    return;
+  case CONNECT_BACKOFF:
+    if (WiFi.status() != WL_CONNECTED) {
+      BlynkState::set(MODE_CONNECTING_NET);
+    } else if (connectDue(cloudConnect)) {
+      cloudConnect.step = CONNECT_START;
     }
+    return;
+  case CONNECT_WAIT:
+    break;
   }
 
-  if (millis() > timeoutMs) {
-    DEBUG_PRINT("Timeout");
+  Blynk.run();
+  if ((WiFi.status() == WL_CONNECTED) &&
+      (!Blynk.isTokenInvalid()) &&
+      (Blynk.connected() == false) &&
+      !connectDue(cloudConnect))
+  {
+    return;
   }
+  cloudConnect.step = CONNECT_START;
 
   if (Blynk.isTokenInvalid()) {
     config_set_last_error(BLYNK_PROV_ERR_TOKEN);
@@ -456,6 +832,11 @@ void enterConnectCloud() {
   } else if (Blynk.connected()) {
     BlynkState::set(MODE_RUNNING);
     connectBlynkRetries = WIFI_CLOUD_MAX_RETRIES;
+    cloudConnect.failures = 0;
+    if (!bootToRunningMs) {
+      bootToRunningMs = systemUptime();
+      DEBUG_PRINT(String("Online ") + bootToRunningMs + " ms after boot");
+    }
 
     if (0 != strcmp(configStore.version, BLYNK_FIRMWARE_VERSION)) {
       Blynk.logEvent("sys_ota", String("Firmware updated to ") + BLYNK_FIRMWARE_VERSION);
@@ -466,15 +847,29 @@ void enterConnectCloud() {
     if (!configStore.getFlag(CONFIG_FLAG_VALID)) {
       configStore.last_error = BLYNK_PROV_ERR_NONE;
       configStore.setFlag(CONFIG_FLAG_VALID, true);
-      config_save();
+      config_save(CONFIG_DIRTY_STATE | CONFIG_DIRTY_ERROR);
 
       Blynk.sendInternal("meta", "set", "Device UID",   systemGetDeviceUID());
       Blynk.sendInternal("meta", "set", "Hotspot Name", systemGetDeviceName());
       Blynk.sendInternal("meta", "set", "Network",      configStore.wifiSSID);
     }
-  } else if (--connectBlynkRetries <= 0) {
-    config_set_last_error(BLYNK_PROV_ERR_CLOUD);
-    BlynkState::set(MODE_ERROR);
+  } else {
+    DEBUG_PRINT("Timeout");
+    // Blynk would keep retrying on its own, the backoff decides when
+    Blynk.disconnect();
+
+    if (netLeaseApplied) {
+      // The cached lease may be stale, rejoin with DHCP
+      netCache.forget();
+      netJoinedFast = false;
+      WiFi.disconnect();
+      BlynkState::set(MODE_CONNECTING_NET);
+    } else if (--connectBlynkRetries <= 0) {
+      config_set_last_error(BLYNK_PROV_ERR_CLOUD);
+      BlynkState::set(MODE_ERROR);
+    } else {
+      DEBUG_PRINT(String("Retrying cloud in ") + connectBackoff(cloudConnect) + " ms");
+    }
   }
 }
 
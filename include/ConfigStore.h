@@ -108,32 +108,221 @@ static bool config_load_blnkopt() {
 
 #include <Preferences.h>
 
-void config_load() {
-    Preferences prefs;
-    if (prefs.begin("blynk", true)) {  // read-only
-        memset(&configStore, 0, sizeof(configStore));
-        prefs.getBytes("config", &configStore, sizeof(configStore));
-        if (configStore.magic != configDefault.magic) {
-            DEBUG_PRINT("Using default config.");
-            configStore = configDefault;
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+
+/*
+ * The config lives in NVS as one record: a header with the schema version,
+ * the body size and a CRC32 of the body, then the ConfigStore bytes.
+ *
+ * Changes are marked with config_changed() and written together once
+ * CONFIG_SAVE_DELAY has passed, so a burst of failed connection attempts
+ * costs one write instead of one per attempt. A record that matches what
+ * is already in flash is not written at all. config_save() writes at once,
+ * and pending changes are flushed before a reboot.
+ *
+ * Older records are upgraded by config_migrate(). Fields appended to the
+ * end of ConfigStore need no migration, they keep their defaults.
+ */
+
+#define CONFIG_SCHEMA 2
+#define CONFIG_RECORD_MAGIC 0x46434C53  // "SLCF"
+#define CONFIG_SAVE_DELAY 10000
+
+// What changed, for the log
+#define CONFIG_DIRTY_CREDENTIALS 0x01  // WiFi and cloud login
+#define CONFIG_DIRTY_NETWORK 0x02      // Static IP settings
+#define CONFIG_DIRTY_STATE 0x04        // Flags and firmware version
+#define CONFIG_DIRTY_ERROR 0x08        // last_error
+#define CONFIG_DIRTY_ALL 0x0F
+
+struct ConfigHeader {
+    uint32_t magic;
+    uint16_t schema;
+    uint16_t size;  // Of the body that follows
+    uint32_t crc;
+} __attribute__((packed));
+
+struct ConfigStats {
+    uint32_t writes;
+    uint32_t unchanged;  // Flushes skipped, flash already held the same
+    uint32_t coalesced;  // Changes folded into a pending write
+};
+
+ConfigStats configStats = {};
+
+static ConfigStore configSaved;  // What flash holds, to skip equal writes
+static bool configSavedValid = false;
+static bool configLegacyKey = false;  // Schema 1 record still in NVS
+static uint8_t configDirty = 0;
+static uint32_t configDueMs = 0;
+
+// Brings a body from an older schema up to CONFIG_SCHEMA, one step at a time
+static bool config_migrate(uint16_t schema, uint8_t* body, size_t size) {
+    for (; schema < CONFIG_SCHEMA; schema++) {
+        switch (schema) {
+            case 1:
+                // The bare struct from before the header, same layout.
+                // Its own magic field was the only check it had.
+                if (size < sizeof(uint32_t) ||
+                    memcmp(body, &configDefault.magic, sizeof(uint32_t))) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
         }
-    } else {
-        DEBUG_PRINT("Config read failed");
     }
+    return true;
+}
+
+static bool config_read_record(Preferences& prefs) {
+    uint8_t record[sizeof(ConfigHeader) + sizeof(ConfigStore)];
+    size_t len = prefs.getBytesLength("cfg");
+    if (len < sizeof(ConfigHeader) || len > sizeof(record) ||
+        prefs.getBytes("cfg", record, len) != len) {
+        return false;
+    }
+
+    ConfigHeader header;
+    memcpy(&header, record, sizeof(header));
+    uint8_t* body = record + sizeof(header);
+    size_t size = len - sizeof(header);
+    if (header.magic != CONFIG_RECORD_MAGIC || header.size != size) {
+        DEBUG_PRINT("Config record is malformed");
+        return false;
+    }
+    if (esp_rom_crc32_le(0, body, size) != header.crc) {
+        DEBUG_PRINT("Config record CRC mismatch");
+        return false;
+    }
+    if (header.schema > CONFIG_SCHEMA) {
+        DEBUG_PRINT(String("Config schema ") + header.schema +
+                    " is newer than this firmware");
+        return false;
+    }
+    if (!config_migrate(header.schema, body, size)) {
+        DEBUG_PRINT(String("Config schema ") + header.schema +
+                    " cannot be migrated");
+        return false;
+    }
+
+    memcpy(&configStore, body, min(size, sizeof(configStore)));
+    if (header.schema == CONFIG_SCHEMA && size == sizeof(configStore)) {
+        configSaved = configStore;
+        configSavedValid = true;
+    }
+    return true;
+}
+
+// Firmware before the versioned record stored the bare struct
+static bool config_read_legacy(Preferences& prefs) {
+    uint8_t body[sizeof(ConfigStore)];
+    size_t len = prefs.getBytesLength("config");
+    if (!len || len > sizeof(body) || prefs.getBytes("config", body, len) != len) {
+        return false;
+    }
+    configLegacyKey = true;
+    if (!config_migrate(1, body, len)) return false;
+    memcpy(&configStore, body, len);
+    DEBUG_PRINT("Migrating config to the versioned record");
+    return true;
 }
 
-bool config_save() {
+void config_load() {
+    configStore = configDefault;
+    configSavedValid = false;
+    configLegacyKey = false;
+    configDirty = 0;
+
     Preferences prefs;
-    if (prefs.begin("blynk", false)) {  // writeable
-        prefs.putBytes("config", &configStore, sizeof(configStore));
-        DEBUG_PRINT("Configuration stored to flash");
+    if (!prefs.begin("blynk", true)) {  // read-only
+        // Also the case on first boot, before the namespace exists
+        DEBUG_PRINT("Using default config.");
+        return;
+    }
+    bool loaded = config_read_record(prefs) || config_read_legacy(prefs);
+    prefs.end();
+
+    if (!loaded) {
+        DEBUG_PRINT("Using default config.");
+        configStore = configDefault;
+    }
+    if (!configSavedValid && (loaded || configLegacyKey)) {
+        // Rewrite in the current schema, and drop the old key
+        configDirty = CONFIG_DIRTY_ALL;
+        configDueMs = millis();
+    }
+}
+
+// Writes pending changes now, unless flash already holds the same
+bool config_flush() {
+    if (!configDirty) return true;
+    if (configSavedValid && !configLegacyKey &&
+        !memcmp(&configSaved, &configStore, sizeof(configStore))) {
+        configStats.unchanged++;
+        configDirty = 0;
         return true;
-    } else {
+    }
+
+    uint8_t record[sizeof(ConfigHeader) + sizeof(ConfigStore)];
+    ConfigHeader header = {CONFIG_RECORD_MAGIC, CONFIG_SCHEMA,
+                           sizeof(ConfigStore), 0};
+    memcpy(record + sizeof(header), &configStore, sizeof(configStore));
+    header.crc = esp_rom_crc32_le(0, record + sizeof(header),
+                                  sizeof(configStore));
+    memcpy(record, &header, sizeof(header));
+
+    Preferences prefs;
+    if (!prefs.begin("blynk", false) ||  // writeable
+        prefs.putBytes("cfg", record, sizeof(record)) != sizeof(record)) {
         DEBUG_PRINT("Config write failed");
+        configDueMs = millis() + CONFIG_SAVE_DELAY;
         return false;
     }
+    if (configLegacyKey) {
+        prefs.remove("config");
+        configLegacyKey = false;
+    }
+    prefs.end();
+
+    configSaved = configStore;
+    configSavedValid = true;
+    configStats.writes++;
+    DEBUG_PRINT(String("Configuration stored to flash, changed ") +
+                ((configDirty & CONFIG_DIRTY_CREDENTIALS) ? "credentials " : "") +
+                ((configDirty & CONFIG_DIRTY_NETWORK) ? "network " : "") +
+                ((configDirty & CONFIG_DIRTY_STATE) ? "state " : "") +
+                ((configDirty & CONFIG_DIRTY_ERROR) ? "error" : ""));
+    configDirty = 0;
+    return true;
+}
+
+// Schedules a write of the marked fields within CONFIG_SAVE_DELAY
+void config_changed(uint8_t fields) {
+    if (configDirty) {
+        configStats.coalesced++;
+    } else {
+        configDueMs = millis() + CONFIG_SAVE_DELAY;
+    }
+    configDirty |= fields;
+}
+
+// Writes at once, for changes that must survive a power cut
+bool config_save(uint8_t fields = CONFIG_DIRTY_ALL) {
+    configDirty |= fields;
+    return config_flush();
+}
+
+// Polled from the application loop
+void config_run() {
+    if (configDirty && (int32_t)(millis() - configDueMs) >= 0) {
+        config_flush();
+    }
 }
 
+static void config_shutdown() { config_flush(); }
+
 // bool pin_reset() {
 //     Preferences prefs;
 //     if (prefs.begin("smartlock", false)) {
@@ -147,7 +336,12 @@ bool config_save() {
 //     }
 // }
 
+// Picked up by the application loop without polling flash. The NVS copy is
+// only read back at boot, in case power is lost before the reset is handled.
+volatile bool factoryResetPending = false;
+
 bool flag_reset() {
+    factoryResetPending = true;
     Preferences prefs;
     if (prefs.begin("smartlock", false)) {
         prefs.putBool("flag_reset", true);
@@ -162,6 +356,7 @@ bool flag_reset() {
 
 bool config_init() {
     config_load();
+    esp_register_shutdown_handler(config_shutdown);
     return true;
 }
 
@@ -179,6 +374,6 @@ void config_set_last_error(int error) {
         configStore = configDefault;
         configStore.last_error = error;
         BLYNK_LOG2("Last error code: ", error);
-        config_save();
+        config_changed(CONFIG_DIRTY_ERROR);
     }
 }
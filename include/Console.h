@@ -1,8 +1,19 @@
 
 #include <Blynk/BlynkConsole.h>
+#include "AccessTrace.h"
+#include "JsonWriter.h"
 
 BlynkConsole    edgentConsole;
 
+static
+void consoleJsonStatus(const char* status, const char* msg = nullptr) {
+  JsonWriter json(edgentConsole.getStream());
+  json.beginObject().member("status", status);
+  if (msg) json.member("msg", msg);
+  json.endObject();
+  edgentConsole.print("\n");
+}
+
 void console_init()
 {
 #ifdef BLYNK_PRINT
@@ -12,25 +23,25 @@ void console_init()
   edgentConsole.print("\n>");
 
   edgentConsole.addCommand("reboot", []() {
-    edgentConsole.print(R"json({"status":"OK","msg":"rebooting wifi module"})json" "\n");
+    consoleJsonStatus("OK", "rebooting wifi module");
     edgentTimer.setTimeout(50, systemReboot);
   });
 
   edgentConsole.addCommand("devinfo", []() {
-    edgentConsole.printf(
-        R"json({"name":"%s","board":"%s","tmpl_id":"%s","fw_type":"%s","fw_ver":"%s","uid":"%s"})json" "\n",
-        systemGetDeviceName().c_str(),
-        BLYNK_TEMPLATE_NAME,
-        BLYNK_TEMPLATE_ID,
-        BLYNK_FIRMWARE_TYPE,
-        BLYNK_FIRMWARE_VERSION,
-        systemGetDeviceUID().c_str()
-    );
+    JsonWriter(edgentConsole.getStream()).beginObject()
+      .member("name",    systemGetDeviceName().c_str())
+      .member("board",   BLYNK_TEMPLATE_NAME)
+      .member("tmpl_id", BLYNK_TEMPLATE_ID)
+      .member("fw_type", BLYNK_FIRMWARE_TYPE)
+      .member("fw_ver",  BLYNK_FIRMWARE_VERSION)
+      .member("uid",     systemGetDeviceUID().c_str())
+      .endObject();
+    edgentConsole.print("\n");
   });
 
   edgentConsole.addCommand("connect", [](int argc, const char** argv) {
     if (argc < 2) {
-      edgentConsole.print(R"json({"status":"error","msg":"invalid arguments. expected: <auth> <ssid> <pass>"})json" "\n");
+      consoleJsonStatus("error", "invalid arguments. expected: <auth> <ssid> <pass>");
       return;
     }
     String auth = argv[0];
@@ -38,11 +49,11 @@ void console_init()
     String pass = (argc >= 3) ? argv[2] : "";
 
     if (auth.length() != 32) {
-      edgentConsole.print(R"json({"status":"error","msg":"invalid token size"})json" "\n");
+      consoleJsonStatus("error", "invalid token size");
       return;
     }
 
-    edgentConsole.print(R"json({"status":"OK","msg":"trying to connect..."})json" "\n");
+    consoleJsonStatus("OK", "trying to connect...");
 
     configStore = configDefault;
     CopyString(ssid, configStore.wifiSSID);
@@ -107,13 +118,30 @@ void console_init()
 
     } else if (0 == strcmp(argv[0], "rollback")) {
       if (Update.rollBack()) {
-        edgentConsole.print(R"json({"status":"ok"})json" "\n");
+        consoleJsonStatus("ok");
         edgentTimer.setTimeout(50, systemReboot);
       } else {
-        edgentConsole.print(R"json({"status":"error"})json" "\n");
+        consoleJsonStatus("error");
+      }
+    } else if (0 == strcmp(argv[0], "update") && argc >= 2) {
+      // e.g. against scripts/ota_server.py on the local network
+      if (otaJobState != OTA_JOB_IDLE) {
+        consoleJsonStatus("error", "update in progress");
+        return;
+      }
+      overTheAirURL = argv[1];
+      otaRateLimit = (argc >= 3) ? atoi(argv[2]) * 1024 : OTA_DEFAULT_RATE;
+      consoleJsonStatus("ok", "update scheduled");
+      edgentTimer.setTimeout(50, ota_start);
+    } else if (0 == strcmp(argv[0], "status")) {
+      static const char* const states[] = { "idle", "running", "done", "failed" };
+      edgentConsole.printf(" OTA:       %s\n", states[otaJobState]);
+      if (otaJobState == OTA_JOB_RUNNING) {
+        edgentConsole.printf(" Progress:  %u / %u bytes\n", otaImage.offset(), otaImage.size());
+        edgentConsole.printf(" Rate cap:  %u KB/s\n", otaRateLimit / 1024);
       }
     } else {
-      edgentConsole.getStream().println(F("Available commands: info, rollback"));
+      edgentConsole.getStream().println(F("Available commands: info, rollback, status, update <url> [KB/s]"));
     }
   });
 
@@ -126,6 +154,32 @@ void console_init()
     edgentConsole.printf(" Flash:           %dK, %luM, %s\n", ESP.getFlashChipSize() / 1024,
                                                           ESP.getFlashChipSpeed() / 1000000,
                                                           systemGetFlashMode().c_str());
+    if (bootToRunningMs) {
+      edgentConsole.printf(" Boot to online:  %lu ms%s\n", bootToRunningMs,
+                           netJoinedFast ? " (cached network)" : "");
+    }
+    edgentConsole.printf(" Time in state:   now %s, for %s\n", StateStr[BlynkState::get()],
+                         timeSpanToStr((millis() - BlynkState::enteredMs) / 1000).c_str());
+    for (int m = 0; m < MODE_MAX_VALUE; m++) {
+      uint64_t ms = BlynkState::timeIn((State)m);
+      if (ms) {
+        edgentConsole.printf("   %-16s %s\n", StateStr[m], timeSpanToStr(ms / 1000).c_str());
+      }
+    }
+    edgentConsole.printf(" Retry backoff:   net %u, cloud %u failures in a row\n",
+                         netConnect.failures, cloudConnect.failures);
+    edgentConsole.printf(" Fast rejoins:    %lu / %lu\n",
+                         netCache.fastJoins.tried - netCache.fastJoins.failed, netCache.fastJoins.tried);
+    const TlsStats& tls = blynkTlsClient.stats();
+    edgentConsole.printf(" TLS handshakes:  %lu, %lu of %lu offered sessions resumed (%lu%%)\n",
+                         tls.handshakes, tls.resumed, tls.offered, tls.hitRate());
+    edgentConsole.printf("      avg:        %lu ms full, %lu ms resumed, last %lu ms\n",
+                         tls.fullAvgMs(), tls.resumedAvgMs(), tls.lastMs);
+    const DnsCacheStats& dns = dnsCache.stats();
+    edgentConsole.printf(" DNS cache:       %lu hits, %lu queried, %lu stale, %lu failed\n",
+                         dns.hits, dns.misses, dns.stale, dns.failures);
+    edgentConsole.printf(" Config writes:   %lu (%lu unchanged, %lu coalesced)\n",
+                         configStats.writes, configStats.unchanged, configStats.coalesced);
     edgentConsole.printf(" Stack unused:    %d\n",        uxTaskGetStackHighWaterMark(NULL));
     edgentConsole.printf(" Heap free:       %d / %d\n",   ESP.getFreeHeap(), ESP.getHeapSize());
     edgentConsole.printf("      max alloc:  %d\n",        ESP.getMaxAllocHeap());
@@ -141,6 +195,29 @@ void console_init()
 #endif
   });
 
+  edgentConsole.addCommand("trace", [](int argc, const char** argv) {
+    if (argc > 0 && 0 == strcmp(argv[0], "clear")) {
+      accessTrace.clear();
+      return;
+    }
+    if (!accessTrace.snapshot()) {
+      edgentConsole.print("No access attempts traced\n");
+      return;
+    }
+    edgentConsole.printf(" %-8s %-9s %5s %9s %9s %9s\n", "Path", "Stage", "n", "p50 us", "p95 us", "max us");
+    for (int p = 0; p < TRACE_PATH_COUNT; p++) {
+      for (int s = TRACE_START + 1; s < TRACE_STAGE_COUNT; s++) {
+        TraceSummary sum;
+        if (!accessTrace.summary(TracePath(p), TraceStage(s), sum)) continue;
+        edgentConsole.printf(" %-8s %-9s %5u %9lu %9lu %9lu\n",
+                             AccessTrace::pathName(TracePath(p)),
+                             AccessTrace::stageName(TraceStage(s)),
+                             sum.count, (unsigned long)sum.p50,
+                             (unsigned long)sum.p95, (unsigned long)sum.max);
+      }
+    }
+  });
+
   edgentConsole.addCommand("sys", [](const BlynkParam &param) {
     const String tool = param[0].asStr();
     if (tool == "coredump") {
@@ -148,7 +225,25 @@ void console_init()
       if (cmd == "clear") {
         systemClearCoreDump();
       } else {
-        systemPrintCoreDump(edgentConsole.getStream());
+#ifdef BLYNK_PRINT
+        // A faster rate for the transfer only. Whatever reads the console
+        // switches too once it sees the notice, the pause gives it time.
+        const uint32_t baud = param[2].isValid() ? param[2].asInt() : 0;
+        const uint32_t oldBaud = BLYNK_PRINT.baudRate();
+        if (baud) {
+          edgentConsole.printf("Switching to %lu baud\n", baud);
+          BLYNK_PRINT.flush();
+          BLYNK_PRINT.updateBaudRate(baud);
+          delay(100);
+        }
+#endif
+        systemPrintCoreDump(edgentConsole.getStream(), cmd == "gz");
+#ifdef BLYNK_PRINT
+        if (baud) {
+          BLYNK_PRINT.flush();
+          BLYNK_PRINT.updateBaudRate(oldBaud);
+        }
+#endif
       }
     } else if (tool == "partitions") {
       esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, NULL);
@@ -171,11 +266,11 @@ void console_init()
     } else if (tool == "nodelay") {
       const String cmd = param[1].asStr();
       if (!param[1].isValid() || cmd == "show") {
-        edgentConsole.printf("TCP nodelay: %s\n", _blynkWifiClient.getNoDelay() ? "on" : "off");
+        edgentConsole.printf("TCP nodelay: %s\n", blynkTlsClient.getNoDelay() ? "on" : "off");
       } else if (cmd == "on") {
-        _blynkWifiClient.setNoDelay(true);
+        blynkTlsClient.setNoDelay(true);
       } else if (cmd == "off") {
-        _blynkWifiClient.setNoDelay(false);
+        blynkTlsClient.setNoDelay(false);
       }
     } else if (tool == "cpufreq") {
       const String cmd = param[1].asStr();
@@ -192,7 +287,7 @@ void console_init()
     } else if (tool == "drop_stats") {
       systemStats.clear();
     } else {
-      edgentConsole.getStream().println(F("Available commands: coredump [show|clear], partitions, powersave [show|on|off], nodelay [show|on|off], cpufreq [show|N(MHz), drop_stats]"));
+      edgentConsole.getStream().println(F("Available commands: coredump [show|gz|clear] [baud], partitions, powersave [show|on|off], nodelay [show|on|off], cpufreq [show|N(MHz), drop_stats]"));
     }
   });
 
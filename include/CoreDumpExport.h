@@ -0,0 +1,274 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "esp_core_dump.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+/*
+ * Streams the core dump image out of its partition, raw or gzipped.
+ *
+ * The image is read in CHUNK_SIZE pieces into a word-aligned buffer, so
+ * esp_partition_read() copies straight from flash without a bounce
+ * buffer, and only the bytes of the image are sent: the last chunk is as
+ * long as what is left of it.
+ *
+ * The gzip stream is plain deflate with the fixed Huffman table. Matches
+ * are found with a single-probe hash within the current chunk. That is
+ * crude, but a dump is mostly zeroed stacks and repeated task structures,
+ * and it needs 3 KB on top of the read buffer, where miniz's tdefl needs
+ * about 160 KB. Any gunzip reads it.
+ *
+ * The CRC is the CRC-32 of the image, the same one the gzip trailer holds,
+ * so a download can be checked either way.
+ */
+
+// Deflate, fixed Huffman codes only, in a gzip wrapper
+class CoreDumpGzip {
+   public:
+    static const uint8_t HASH_BITS = 10;
+
+    bool begin(Print &out) {
+        _out = &out;
+        _head = (uint16_t *)malloc(sizeof(uint16_t) << HASH_BITS);
+        if (!_head) return false;
+        _bits = 0;
+        _count = 0;
+        _len = 0;
+        _sent = 0;
+
+        static const uint8_t header[] = {0x1f, 0x8b, 8, 0, 0,
+                                         0,    0,    0, 0, 0xff};
+        for (uint8_t b : header) putByte(b);
+        putBits(1, 1);  // Final block
+        putBits(1, 2);  // Fixed Huffman codes
+        return true;
+    }
+
+    // Matches never reach back into an earlier chunk
+    void write(const uint8_t *data, size_t len) {
+        memset(_head, 0, sizeof(uint16_t) << HASH_BITS);
+        size_t pos = 0;
+        while (pos < len) {
+            size_t match = 0;
+            size_t distance = 0;
+            if (pos + 3 <= len) {
+                uint16_t &head = _head[hash(data + pos)];
+                if (head) {
+                    size_t from = head - 1;
+                    size_t limit = min<size_t>(258, len - pos);
+                    while (match < limit &&
+                           data[from + match] == data[pos + match]) {
+                        match++;
+                    }
+                    distance = pos - from;
+                }
+                head = pos + 1;
+            }
+            if (match >= 3) {
+                putLength(match);
+                putDistance(distance);
+                pos += match;
+            } else {
+                putSymbol(data[pos++]);
+            }
+        }
+    }
+
+    // Ends the block and adds the trailer, returns the bytes sent
+    uint32_t finish(uint32_t crc, uint32_t size) {
+        putSymbol(256);
+        if (_count) putBits(0, 8 - _count);
+        for (uint8_t i = 0; i < 4; i++) putByte(crc >> (i * 8));
+        for (uint8_t i = 0; i < 4; i++) putByte(size >> (i * 8));
+        flush();
+        free(_head);
+        _head = nullptr;
+        return _sent;
+    }
+
+    ~CoreDumpGzip() { free(_head); }
+
+   private:
+    static uint16_t hash(const uint8_t *p) {
+        uint32_t v = p[0] | p[1] << 8 | p[2] << 16;
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    void putSymbol(uint16_t symbol) {
+        if (symbol < 144) {
+            putCode(0x30 + symbol, 8);
+        } else if (symbol < 256) {
+            putCode(0x190 + symbol - 144, 9);
+        } else if (symbol < 280) {
+            putCode(symbol - 256, 7);
+        } else {
+            putCode(0xc0 + symbol - 280, 8);
+        }
+    }
+
+    void putLength(size_t length) {
+        static const uint16_t base[] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                        11, 13, 15, 17,  19,  23,  27,  31,
+                                        35, 43, 51, 59,  67,  83,  99,  115,
+                                        131, 163, 195, 227, 258};
+        uint8_t code = 28;
+        while (base[code] > length) code--;
+        uint8_t extra = (code < 8 || code == 28) ? 0 : (code - 4) / 4;
+        putSymbol(257 + code);
+        putBits(length - base[code], extra);
+    }
+
+    void putDistance(size_t distance) {
+        static const uint16_t base[] = {
+            1,    2,    3,    4,     5,     7,     9,    13,  17,  25,
+            33,   49,   65,   97,    129,   193,   257,  385, 513, 769,
+            1025, 1537, 2049, 3073,  4097,  6145,  8193, 12289, 16385, 24577};
+        uint8_t code = 29;
+        while (base[code] > distance) code--;
+        uint8_t extra = code < 4 ? 0 : (code - 2) / 2;
+        putCode(code, 5);
+        putBits(distance - base[code], extra);
+    }
+
+    // Huffman codes go out most significant bit first
+    void putCode(uint16_t code, uint8_t length) {
+        uint16_t reversed = 0;
+        for (uint8_t i = 0; i < length; i++) {
+            reversed = reversed << 1 | (code & 1);
+            code >>= 1;
+        }
+        putBits(reversed, length);
+    }
+
+    void putBits(uint32_t value, uint8_t length) {
+        _bits |= value << _count;
+        _count += length;
+        while (_count >= 8) {
+            putByte(_bits);
+            _bits >>= 8;
+            _count -= 8;
+        }
+    }
+
+    void putByte(uint8_t b) {
+        if (_len == sizeof(_buff)) flush();
+        _buff[_len++] = b;
+    }
+
+    void flush() {
+        _out->write(_buff, _len);
+        _sent += _len;
+        _len = 0;
+    }
+
+    Print *_out = nullptr;
+    uint16_t *_head = nullptr;  // Last position + 1 per hash, 0 for none
+    uint32_t _bits = 0;
+    uint8_t _count = 0;
+    uint8_t _buff[512];
+    size_t _len = 0;
+    uint32_t _sent = 0;
+};
+
+class CoreDumpExport {
+   public:
+    static const size_t CHUNK_SIZE = 4096;
+
+    // False when there is no image
+    bool begin() {
+        size_t address = 0;
+        size_t size = 0;
+        if (esp_core_dump_image_get(&address, &size) != ESP_OK) {
+            return fail("No coredump found");
+        }
+        _partition = esp_partition_find_first(
+            ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, NULL);
+        if (!_partition) return fail("Partition NULL");
+        if (address < _partition->address ||
+            address + size > _partition->address + _partition->size) {
+            return fail("Image outside the partition");
+        }
+        _offset = address - _partition->address;
+        _size = size;
+
+        // malloc() hands out word-aligned blocks
+        if (!_chunk) _chunk = (uint8_t *)malloc(CHUNK_SIZE);
+        if (!_chunk) return fail("Out of memory");
+        return true;
+    }
+
+    uint32_t size() const { return _size; }
+
+    // Reads the image once, for a CRC to announce before sending it
+    bool checksum(uint32_t &crc) {
+        crc = 0;
+        for (size_t done = 0; done < _size;) {
+            size_t n = min<size_t>(CHUNK_SIZE, _size - done);
+            if (!read(done, n)) return false;
+            crc = esp_rom_crc32_le(crc, _chunk, n);
+            done += n;
+        }
+        return true;
+    }
+
+    // Sends the image, or its gzip stream, to out
+    bool send(Print &out, bool gzip) {
+        uint32_t start = millis();
+        CoreDumpGzip deflate;
+        if (gzip && !deflate.begin(out)) return fail("Out of memory");
+
+        _crc = 0;
+        _sent = 0;
+        for (size_t done = 0; done < _size;) {
+            size_t n = min<size_t>(CHUNK_SIZE, _size - done);
+            if (!read(done, n)) return false;
+            _crc = esp_rom_crc32_le(_crc, _chunk, n);
+            if (gzip) {
+                deflate.write(_chunk, n);
+            } else {
+                _sent += out.write(_chunk, n);
+            }
+            done += n;
+        }
+        if (gzip) _sent = deflate.finish(_crc, _size);
+        _elapsedMs = millis() - start;
+        return true;
+    }
+
+    // After send()
+    uint32_t crc() const { return _crc; }
+    uint32_t sent() const { return _sent; }
+    uint32_t elapsedMs() const { return _elapsedMs; }
+    const char *error() const { return _error ? _error : "none"; }
+
+    ~CoreDumpExport() { free(_chunk); }
+
+   private:
+    bool read(size_t offset, size_t len) {
+        esp_err_t err =
+            esp_partition_read(_partition, _offset + offset, _chunk, len);
+        if (err != ESP_OK) {
+            _error = esp_err_to_name(err);
+            return false;
+        }
+        return true;
+    }
+
+    bool fail(const char *error) {
+        _error = error;
+        return false;
+    }
+
+    const esp_partition_t *_partition = nullptr;
+    size_t _offset = 0;
+    uint32_t _size = 0;
+    uint8_t *_chunk = nullptr;
+    uint32_t _crc = 0;
+    uint32_t _sent = 0;
+    uint32_t _elapsedMs = 0;
+    const char *_error = nullptr;
+};
+
+const size_t CoreDumpExport::CHUNK_SIZE;
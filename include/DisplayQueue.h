@@ -0,0 +1,266 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "LcdRenderer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+/*
+ * Prioritized, non-blocking message layer on top of the LCD framebuffer.
+ *
+ * The screen shows, in order of precedence:
+ *   1. the current timed message, until its hold time runs out
+ *   2. the status line (a message posted without a hold time), until a timed
+ *      message of at least the same priority ends that state
+ *   3. the passcode prompt, which is the fallback whenever nothing else is up
+ *
+ * Every timed message ends in one call of the fallback hook, whether it ran
+ * its hold time, outlived its time-to-live or was dropped. Messages a key
+ * echo dismisses are the exception: the user is typing again, so there is
+ * no entry to clear. The keypad uses the hook to clear a passcode entry
+ * once the message about it is gone.
+ *
+ * Timed messages that cannot be shown right away wait in a short priority
+ * list and are discarded once their time-to-live has passed. A higher
+ * priority message preempts the current one, which goes back to the list
+ * with whatever hold time it had left. Posting only copies into a FreeRTOS
+ * queue, so callers never wait for the display.
+ */
+
+enum DisplayPriority : uint8_t {
+    DISPLAY_LOW,     // Countdowns and other status lines
+    DISPLAY_NORMAL,  // Informational messages
+    DISPLAY_HIGH,    // Access results, not dismissed by typing
+    DISPLAY_ALARM,   // Security alarms
+};
+
+struct DisplayStats {
+    uint32_t shown;
+    uint32_t preempted;
+    uint32_t expired;
+    uint32_t dropped;
+};
+
+class DisplayQueue {
+   public:
+    static const uint8_t QUEUE_LENGTH = 16;
+    static const uint8_t PENDING_MAX = 8;
+    static const uint32_t DEFAULT_TTL = 5000;
+
+    void begin() {
+        memset(&_prompt, 0, sizeof(_prompt));
+        _queue = xQueueCreate(QUEUE_LENGTH, sizeof(Request));
+        xTaskCreatePinnedToCore(queueTask, "DisplayQueue", 3072, this, 1,
+                                NULL, 0);
+    }
+
+    // A hold time of 0 makes the message the status line
+    void post(const char *line1, const char *line2, uint16_t hold,
+              DisplayPriority priority, uint32_t ttl = DEFAULT_TTL) {
+        Request request = {REQUEST_MESSAGE, priority, hold, ttl, millis(), 0};
+        copyLine(request.line1, line1);
+        copyLine(request.line2, line2);
+        send(request);
+    }
+
+    // Updates the fallback prompt. A key echo also dismisses messages below
+    // DISPLAY_HIGH, so the user sees what they type.
+    void setPrompt(const char *line1, const char *line2,
+                   int64_t echoTimestamp = 0) {
+        Request request = {REQUEST_PROMPT, DISPLAY_LOW, 0, 0, millis(),
+                           echoTimestamp};
+        copyLine(request.line1, line1);
+        copyLine(request.line2, line2);
+        send(request);
+    }
+
+    // Runs on the display task, or on the poster's when its queue is full
+    void setFallbackHook(void (*hook)()) { _fallbackHook = hook; }
+
+    const DisplayStats &stats() const { return _stats; }
+    void clearStats() { memset(&_stats, 0, sizeof(_stats)); }
+
+   private:
+    enum RequestKind : uint8_t {
+        REQUEST_MESSAGE,
+        REQUEST_PROMPT,
+    };
+
+    struct Request {
+        RequestKind kind;
+        uint8_t priority;
+        uint16_t hold;
+        uint32_t ttl;
+        uint32_t postedAt;
+        int64_t echoTimestamp;
+        char line1[LcdRenderer::COLS + 1];
+        char line2[LcdRenderer::COLS + 1];
+    };
+
+    static void copyLine(char *dst, const char *src) {
+        strncpy(dst, src ? src : "", LcdRenderer::COLS);
+        dst[LcdRenderer::COLS] = '\0';
+    }
+
+    void send(const Request &request) {
+        if (xQueueSend(_queue, &request, 0) != pdTRUE) {
+            _stats.dropped++;
+            if (request.kind == REQUEST_MESSAGE && request.hold) fallBack();
+        }
+    }
+
+    void fallBack() {
+        if (_fallbackHook) _fallbackHook();
+    }
+
+    void start(const Request &request, uint32_t now) {
+        _current = request;
+        _currentStart = now;
+        _hasCurrent = true;
+        _stats.shown++;
+    }
+
+    // Keeps the list ordered by priority, first come first served within one
+    void enqueue(const Request &request) {
+        if (_pendingCount == PENDING_MAX) {
+            if (_pending[PENDING_MAX - 1].priority >= request.priority) {
+                _stats.dropped++;
+                fallBack();
+                return;
+            }
+            _pendingCount--;
+            _stats.dropped++;
+            fallBack();
+        }
+        uint8_t pos = _pendingCount;
+        while (pos > 0 && _pending[pos - 1].priority < request.priority) {
+            _pending[pos] = _pending[pos - 1];
+            pos--;
+        }
+        _pending[pos] = request;
+        _pendingCount++;
+    }
+
+    void preemptCurrent(uint32_t now) {
+        if (!_hasCurrent) return;
+        _hasCurrent = false;
+        _stats.preempted++;
+
+        uint32_t elapsed = now - _currentStart;
+        if (elapsed < _current.hold) {
+            _current.hold -= elapsed;
+            _current.postedAt = now;
+            enqueue(_current);
+        } else {
+            // Its hold time ran out before expire() got to it
+            fallBack();
+        }
+    }
+
+    void handle(const Request &request, uint32_t now) {
+        if (request.kind == REQUEST_PROMPT) {
+            _prompt = request;
+            if (request.echoTimestamp && _hasCurrent &&
+                _current.priority < DISPLAY_HIGH) {
+                // Dismissed without the hook, the new entry must stay
+                _hasCurrent = false;
+            }
+            if (request.echoTimestamp && !_hasCurrent && !_hasStatus) {
+                _echoTimestamp = request.echoTimestamp;
+            }
+            return;
+        }
+
+        if (request.hold == 0) {
+            if (_hasCurrent && request.priority > _current.priority) {
+                preemptCurrent(now);
+            }
+            _status = request;
+            _hasStatus = true;
+            return;
+        }
+
+        // A timed message ends the state the status line was describing
+        if (_hasStatus && request.priority >= _status.priority) {
+            _hasStatus = false;
+        }
+        if (_hasCurrent && request.priority > _current.priority) {
+            preemptCurrent(now);
+        }
+        if (_hasCurrent) {
+            enqueue(request);
+        } else {
+            start(request, now);
+        }
+    }
+
+    // Retires the current message and promotes the next one still in date
+    void expire(uint32_t now) {
+        while (_hasCurrent && now - _currentStart >= _current.hold) {
+            _hasCurrent = false;
+            fallBack();
+            while (_pendingCount > 0) {
+                Request next = _pending[0];
+                memmove(&_pending[0], &_pending[1],
+                        --_pendingCount * sizeof(Request));
+                if (now - next.postedAt <= next.ttl) {
+                    start(next, now);
+                    break;
+                }
+                _stats.expired++;
+                fallBack();
+            }
+        }
+    }
+
+    TickType_t nextWakeup(uint32_t now) const {
+        if (!_hasCurrent) return portMAX_DELAY;
+        uint32_t elapsed = now - _currentStart;
+        uint32_t left = elapsed < _current.hold ? _current.hold - elapsed : 0;
+        return pdMS_TO_TICKS(left) + 1;
+    }
+
+    void render() {
+        const Request &shown =
+            _hasCurrent ? _current : (_hasStatus ? _status : _prompt);
+        lcdRenderer.show(shown.line1, shown.line2);
+        if (_echoTimestamp) {
+            lcdRenderer.trackEcho(_echoTimestamp);
+            _echoTimestamp = 0;
+        }
+    }
+
+    static void queueTask(void *parameter) {
+        DisplayQueue *self = static_cast<DisplayQueue *>(parameter);
+        for (;;) {
+            Request request;
+            if (xQueueReceive(self->_queue, &request,
+                              self->nextWakeup(millis())) == pdTRUE) {
+                do {
+                    self->handle(request, millis());
+                } while (xQueueReceive(self->_queue, &request, 0) == pdTRUE);
+            }
+            self->expire(millis());
+            self->render();
+        }
+    }
+
+    QueueHandle_t _queue = NULL;
+    void (*_fallbackHook)() = nullptr;
+
+    // Owned by the queue task
+    Request _current;
+    Request _status;
+    Request _prompt;
+    Request _pending[PENDING_MAX];
+    uint8_t _pendingCount = 0;
+    bool _hasCurrent = false;
+    bool _hasStatus = false;
+    uint32_t _currentStart = 0;
+    int64_t _echoTimestamp = 0;
+    DisplayStats _stats = {};
+};
+
+DisplayQueue displayQueue;
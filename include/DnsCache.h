@@ -0,0 +1,255 @@
+#pragma once
+
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <time.h>
+
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+
+/*
+ * Remembers DNS answers for the cloud host, for as long as their TTL says.
+ *
+ * lwIP does not hand out TTLs, so resolve() sends its own A query to the
+ * configured DNS servers. A fresh entry answers without any traffic. When
+ * the query fails lwIP's resolver gets a try, and when that fails too an
+ * expired entry is used anyway: the cloud rarely moves, and a stale
+ * address beats no connection during a DNS outage.
+ *
+ * resolve() runs on the loop task and waits for the answers, up to
+ * QUERY_TIMEOUT_MS per DNS server and then lwIP's own timeout.
+ *
+ * Entries live in noinit memory next to SystemStats and are checked by
+ * CRC, so they also serve the first connect after a soft reboot. Expiry is
+ * kept in system time, which ESP-IDF carries across soft reboots.
+ */
+
+struct DnsCacheStats {
+    uint32_t hits;      // Fresh entry, no query
+    uint32_t misses;    // Queried
+    uint32_t stale;     // Both lookups failed, expired entry used
+    uint32_t failures;  // Both lookups failed, nothing cached
+};
+
+class DnsCache {
+   public:
+    static const uint8_t ENTRIES = 4;
+    static const uint32_t MIN_TTL = 30;
+    static const uint32_t MAX_TTL = 24 * 3600;
+    static const uint32_t FALLBACK_TTL = 300;  // For lwIP answers, no TTL there
+    static const uint32_t QUERY_TIMEOUT_MS = 500;
+
+    bool resolve(const char *host, IPAddress &ip) {
+        if (ip.fromString(host)) return true;
+
+        check();
+        Entry *entry = find(host);
+        uint32_t now = time(nullptr);
+        if (entry && (int32_t)(entry->expires - now) > 0) {
+            _stats.hits++;
+            ip = entry->ip;
+            return true;
+        }
+
+        uint32_t ttl = 0;
+        bool found = query(host, ip, ttl);
+        // lwIP's resolver, for answers the query could not use
+        if (!found && WiFi.hostByName(host, ip) == 1) {
+            found = true;
+            ttl = FALLBACK_TTL;
+        }
+        if (!found && entry) {
+            _stats.stale++;
+            ip = entry->ip;
+            DEBUG_PRINT(String("DNS failed, using the last address of ") + host);
+            return true;
+        }
+        if (!found) {
+            _stats.failures++;
+            return false;
+        }
+        _stats.misses++;
+        ttl = max(MIN_TTL, min(ttl, MAX_TTL));
+        store(entry, host, ip, now + ttl);
+        return true;
+    }
+
+    const DnsCacheStats &stats() const { return _stats; }
+
+   private:
+    struct Entry {
+        char host[64];
+        uint32_t ip;
+        uint32_t expires;  // time() seconds
+    };
+
+    struct Store {
+        uint32_t magic;
+        uint32_t crc;
+        uint8_t next;  // Slot to replace when all are taken
+        Entry entries[ENTRIES];
+    };
+
+    static const uint32_t MAGIC = 0x444e5331;  // "DNS1"
+
+    // Wipes the store when it does not survive the reset intact
+    void check() {
+        if (_checked) return;
+        _checked = true;
+        if (_store.magic != MAGIC || _store.crc != crc()) {
+            memset(&_store, 0, sizeof(_store));
+            seal();
+        }
+    }
+
+    Entry *find(const char *host) {
+        for (Entry &entry : _store.entries) {
+            if (!strncmp(entry.host, host, sizeof(entry.host))) return &entry;
+        }
+        return nullptr;
+    }
+
+    void store(Entry *entry, const char *host, IPAddress ip,
+               uint32_t expires) {
+        if (!entry) {
+            if (strlen(host) >= sizeof(entry->host)) return;
+            entry = &_store.entries[_store.next];
+            _store.next = (_store.next + 1) % ENTRIES;
+            strcpy(entry->host, host);
+        }
+        entry->ip = ip;
+        entry->expires = expires;
+        seal();
+    }
+
+    uint32_t crc() const {
+        return esp_rom_crc32_le(0, (const uint8_t *)&_store.next,
+                                sizeof(_store) - offsetof(Store, next));
+    }
+
+    void seal() {
+        _store.magic = MAGIC;
+        _store.crc = crc();
+    }
+
+    // A single A query over UDP, to each DNS server in turn
+    bool query(const char *host, IPAddress &ip, uint32_t &ttl) {
+        uint8_t packet[300];
+        uint16_t id = esp_random();
+        size_t len = buildQuery(packet, sizeof(packet), id, host);
+        if (!len) return false;
+
+        for (int server = 0; server < 2; server++) {
+            IPAddress dns = WiFi.dnsIP(server);
+            if (!(uint32_t)dns) continue;
+
+            WiFiUDP udp;
+            if (!udp.beginPacket(dns, 53)) continue;
+            udp.write(packet, len);
+            if (!udp.endPacket()) continue;
+
+            uint32_t start = millis();
+            while (millis() - start < QUERY_TIMEOUT_MS) {
+                int n = udp.parsePacket();
+                if (n <= 0) {
+                    delay(5);
+                    continue;
+                }
+                n = udp.read(packet, sizeof(packet));
+                if (parseAnswer(packet, n, id, ip, ttl)) {
+                    udp.stop();
+                    return true;
+                }
+            }
+            udp.stop();
+        }
+        return false;
+    }
+
+    static size_t buildQuery(uint8_t *out, size_t size, uint16_t id,
+                             const char *host) {
+        static const uint8_t header[] = {0, 0, 0x01, 0x00,  // RD
+                                         0, 1, 0, 0, 0, 0, 0, 0};
+        if (size < sizeof(header) + strlen(host) + 6) return 0;
+        memcpy(out, header, sizeof(header));
+        out[0] = id >> 8;
+        out[1] = id;
+        size_t pos = sizeof(header);
+        while (*host) {
+            const char *dot = strchr(host, '.');
+            size_t label = dot ? dot - host : strlen(host);
+            if (!label || label > 63) return 0;
+            out[pos++] = label;
+            memcpy(out + pos, host, label);
+            pos += label;
+            host += label + (dot ? 1 : 0);
+        }
+        out[pos++] = 0;
+        out[pos++] = 0;  // QTYPE A
+        out[pos++] = 1;
+        out[pos++] = 0;  // QCLASS IN
+        out[pos++] = 1;
+        return pos;
+    }
+
+    // Takes the first A record, with the lowest TTL along the CNAME chain
+    static bool parseAnswer(const uint8_t *in, int len, uint16_t id,
+                            IPAddress &ip, uint32_t &ttl) {
+        if (len < 12 || u16(in) != id || !(in[2] & 0x80) || (in[3] & 0x0F)) {
+            return false;
+        }
+        int questions = u16(in + 4);
+        int answers = u16(in + 6);
+        int pos = 12;
+        while (questions--) {
+            pos = skipName(in, len, pos);
+            if (pos < 0 || pos + 4 > len) return false;
+            pos += 4;
+        }
+
+        uint32_t lowest = MAX_TTL;
+        while (answers--) {
+            pos = skipName(in, len, pos);
+            if (pos < 0 || pos + 10 > len) return false;
+            uint16_t type = u16(in + pos);
+            uint16_t cls = u16(in + pos + 2);
+            uint32_t recordTtl = (uint32_t)u16(in + pos + 4) << 16 |
+                                 u16(in + pos + 6);
+            uint16_t rdlength = u16(in + pos + 8);
+            pos += 10;
+            if (pos + rdlength > len) return false;
+            lowest = min(lowest, recordTtl);
+            if (type == 1 && cls == 1 && rdlength == 4) {
+                ip = IPAddress(in[pos], in[pos + 1], in[pos + 2], in[pos + 3]);
+                ttl = lowest;
+                return true;
+            }
+            pos += rdlength;
+        }
+        return false;
+    }
+
+    // Returns the offset after the name, or -1
+    static int skipName(const uint8_t *in, int len, int pos) {
+        while (pos >= 0 && pos < len) {
+            uint8_t label = in[pos];
+            if (!label) return pos + 1;
+            if ((label & 0xC0) == 0xC0) return pos + 2;  // Compressed
+            pos += label + 1;
+        }
+        return -1;
+    }
+
+    static uint16_t u16(const uint8_t *p) { return p[0] << 8 | p[1]; }
+
+    static Store _store;
+    bool _checked = false;
+    DnsCacheStats _stats = {};
+};
+
+const uint32_t DnsCache::MIN_TTL;
+const uint32_t DnsCache::MAX_TTL;
+
+BLYNK_NOINIT_ATTR DnsCache::Store DnsCache::_store;
+
+DnsCache dnsCache;
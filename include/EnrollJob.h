@@ -0,0 +1,303 @@
+#pragma once
+
+#include <Adafruit_Fingerprint.h>
+#include <Arduino.h>
+
+#include <atomic>
+
+#include "DisplayQueue.h"
+#include "FingerSlots.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+/*
+ * Fingerprint enrollment as a background job.
+ *
+ * The job task walks an explicit state machine and polls the sensor between
+ * short sleeps, so nothing on the Blynk loop waits for the user's finger:
+ *
+ *   WAIT_FINGER (1) -> CAPTURE (2) -> WAIT_REMOVE (3) -> WAIT_FINGER (4)
+ *                   -> CAPTURE (5) -> MODEL (6) -> STORE (7)
+ *
+ * Progress lines are queued for the loop task to forward to the app, and
+ * cancel() is honoured between any two steps. Each step holds the sensor
+ * lock, which the access path and the delete handler take too, so their
+ * packets never interleave on the UART.
+ */
+
+enum EnrollState : uint8_t {
+    ENROLL_IDLE,
+    ENROLL_WAIT_FINGER,
+    ENROLL_CAPTURE,
+    ENROLL_WAIT_REMOVE,
+    ENROLL_MODEL,
+    ENROLL_STORE,
+};
+
+struct EnrollProgress {
+    bool finished;
+    bool success;
+    char text[64];
+};
+
+class EnrollJob {
+   public:
+    static const uint32_t PLACE_TIMEOUT = 20000;
+    static const uint32_t REMOVE_TIMEOUT = 5000;
+    static const uint32_t POLL_INTERVAL = 100;
+    static const uint8_t MAX_ERRORS = 3;
+    static const uint8_t STEPS = 7;
+
+    void begin(Adafruit_Fingerprint &finger, FingerSlots &slots,
+               SemaphoreHandle_t sensorLock) {
+        _finger = &finger;
+        _slots = &slots;
+        _sensorLock = sensorLock;
+        _progress = xQueueCreate(8, sizeof(EnrollProgress));
+        xTaskCreatePinnedToCore(jobTask, "EnrollJob", 4096, this, 1,
+                                &_taskHandle, 0);
+    }
+
+    bool start() {
+        if (!_taskHandle) return false;
+        bool expected = false;
+        if (!_busy.compare_exchange_strong(expected, true)) return false;
+        _cancel = false;
+        xTaskNotifyGive(_taskHandle);
+        return true;
+    }
+
+    void cancel() { _cancel = true; }
+    bool active() const { return _busy; }
+    EnrollState state() const { return _state; }
+
+    // Drained by the loop task, which owns the Blynk connection
+    bool poll(EnrollProgress &progress) {
+        return xQueueReceive(_progress, &progress, 0) == pdTRUE;
+    }
+
+   private:
+    void report(bool finished, bool success, const char *text) {
+        EnrollProgress progress = {finished, success};
+        strncpy(progress.text, text, sizeof(progress.text) - 1);
+        progress.text[sizeof(progress.text) - 1] = '\0';
+        // Never stall the sensor on a slow cloud link, drop the oldest line
+        if (xQueueSend(_progress, &progress, 0) != pdTRUE) {
+            EnrollProgress stale;
+            xQueueReceive(_progress, &stale, 0);
+            xQueueSend(_progress, &progress, 0);
+        }
+    }
+
+    void step(uint8_t number, const char *line1, const char *line2,
+              const char *text) {
+        char buff[64];
+        snprintf(buff, sizeof(buff), "Step %u/%u: %s", number, STEPS, text);
+        report(false, false, buff);
+        displayQueue.post(line1, line2, 0, DISPLAY_NORMAL);
+    }
+
+    void enter(EnrollState state) {
+        _state = state;
+        _stateStart = millis();
+        _errors = 0;
+
+        char line1[LcdRenderer::COLS + 1];
+        switch (state) {
+            case ENROLL_WAIT_FINGER:
+                if (_pass == 1) {
+                    snprintf(line1, sizeof(line1), "Enrolling ID #%u", _id);
+                    step(1, line1, "Place finger", "place finger on sensor");
+                } else {
+                    step(4, "Place same", "finger again",
+                         "place the same finger again");
+                }
+                break;
+            case ENROLL_CAPTURE:
+                step(_pass == 1 ? 2 : 5, "Image taken", "Processing...",
+                     "image taken, processing");
+                break;
+            case ENROLL_WAIT_REMOVE:
+                step(3, "Remove finger", "from sensor", "remove finger");
+                break;
+            case ENROLL_MODEL:
+                step(6, "Creating model", "Please wait", "creating model");
+                break;
+            case ENROLL_STORE:
+                snprintf(line1, sizeof(line1), "Storing as ID #%u", _id);
+                step(7, line1, "Please wait", "storing template");
+                break;
+            default:
+                break;
+        }
+    }
+
+    void finish(bool success, const char *line1, const char *line2,
+                const char *text) {
+        _state = ENROLL_IDLE;
+        displayQueue.post(line1, line2, 2000, DISPLAY_NORMAL);
+        report(false, success, text);
+        report(true, success, text);
+        Serial.println(String("Enrollment finished: ") + text);
+    }
+
+    static const char *imageError(uint8_t p) {
+        switch (p) {
+            case FINGERPRINT_IMAGEMESS:
+                return "Image too messy";
+            case FINGERPRINT_PACKETRECIEVEERR:
+                return "Communication error";
+            case FINGERPRINT_FEATUREFAIL:
+            case FINGERPRINT_INVALIDIMAGE:
+                return "No features found";
+            default:
+                return "Processing failed";
+        }
+    }
+
+    static const char *storeError(uint8_t p) {
+        switch (p) {
+            case FINGERPRINT_PACKETRECIEVEERR:
+                return "Communication error";
+            case FINGERPRINT_BADLOCATION:
+                return "Invalid location";
+            case FINGERPRINT_FLASHERR:
+                return "Flash write error";
+            default:
+                return "Storage failed";
+        }
+    }
+
+    // One non-blocking step of the state machine
+    void advance() {
+        uint32_t elapsed = millis() - _stateStart;
+        uint8_t p;
+
+        switch (_state) {
+            case ENROLL_WAIT_FINGER:
+                p = _finger->getImage();
+                if (p == FINGERPRINT_OK) {
+                    enter(ENROLL_CAPTURE);
+                } else if (p != FINGERPRINT_NOFINGER &&
+                           ++_errors >= MAX_ERRORS) {
+                    finish(false, "Too many errors", "Try again",
+                           "too many sensor errors");
+                } else if (p != FINGERPRINT_NOFINGER) {
+                    displayQueue.post(p == FINGERPRINT_IMAGEFAIL
+                                          ? "Imaging error"
+                                          : "Comm error",
+                                      "Try again", 0, DISPLAY_NORMAL);
+                } else if (elapsed > PLACE_TIMEOUT) {
+                    finish(false, "No finger", "Try again",
+                           "no finger placed in time");
+                }
+                break;
+
+            case ENROLL_CAPTURE:
+                p = _finger->image2Tz(_pass);
+                if (p != FINGERPRINT_OK) {
+                    finish(false, imageError(p), "Try again", imageError(p));
+                } else if (_pass == 2) {
+                    enter(ENROLL_MODEL);
+                } else if (_finger->fingerFastSearch() == FINGERPRINT_OK) {
+                    char line2[LcdRenderer::COLS + 1];
+                    snprintf(line2, sizeof(line2), "ID #%u",
+                             _finger->fingerID);
+                    finish(false, "Already exists", line2,
+                           "fingerprint already enrolled");
+                } else {
+                    enter(ENROLL_WAIT_REMOVE);
+                }
+                break;
+
+            case ENROLL_WAIT_REMOVE:
+                if (_finger->getImage() == FINGERPRINT_NOFINGER) {
+                    _pass = 2;
+                    enter(ENROLL_WAIT_FINGER);
+                } else if (elapsed > REMOVE_TIMEOUT) {
+                    finish(false, "Remove timeout", "Try again",
+                           "finger not removed");
+                }
+                break;
+
+            case ENROLL_MODEL:
+                p = _finger->createModel();
+                if (p == FINGERPRINT_ENROLLMISMATCH) {
+                    finish(false, "Fingers didn't", "match - Try again",
+                           "fingers did not match");
+                } else if (p != FINGERPRINT_OK) {
+                    finish(false, "Model error", String(p).c_str(),
+                           "could not create model");
+                } else {
+                    enter(ENROLL_STORE);
+                }
+                break;
+
+            case ENROLL_STORE:
+                p = _slots->store(_id);
+                if (p == FINGERPRINT_OK) {
+                    finish(true, "Success!", "Fingerprint stored",
+                           "fingerprint stored");
+                } else {
+                    finish(false, storeError(p), "Try again", storeError(p));
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    void run() {
+        _id = _slots->findFree();
+        if (!_id) {
+            finish(false, "No free slots", "Database full",
+                   "no free fingerprint slots");
+            return;
+        }
+
+        Serial.println("Enrolling fingerprint as #" + String(_id));
+        _pass = 1;
+        enter(ENROLL_WAIT_FINGER);
+        while (_state != ENROLL_IDLE) {
+            if (_cancel) {
+                finish(false, "Registration", "Canceled",
+                       "registration canceled");
+                break;
+            }
+            xSemaphoreTake(_sensorLock, portMAX_DELAY);
+            advance();
+            xSemaphoreGive(_sensorLock);
+            if (_state != ENROLL_IDLE) {
+                vTaskDelay(pdMS_TO_TICKS(POLL_INTERVAL));
+            }
+        }
+    }
+
+    static void jobTask(void *parameter) {
+        EnrollJob *self = static_cast<EnrollJob *>(parameter);
+        for (;;) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            self->run();
+            self->_busy = false;
+        }
+    }
+
+    Adafruit_Fingerprint *_finger = nullptr;
+    FingerSlots *_slots = nullptr;
+    SemaphoreHandle_t _sensorLock = NULL;
+    QueueHandle_t _progress = NULL;
+    TaskHandle_t _taskHandle = NULL;
+
+    std::atomic<bool> _busy{false};
+    std::atomic<bool> _cancel{false};
+    volatile EnrollState _state = ENROLL_IDLE;
+    uint32_t _stateStart = 0;
+    uint16_t _id = 0;
+    uint8_t _pass = 1;
+    uint8_t _errors = 0;
+};
+
+EnrollJob enrollJob;
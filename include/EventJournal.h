@@ -0,0 +1,226 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <mutex>
+
+/*
+ * Offline journal for cloud events that could not be delivered.
+ *
+ * Records are fixed-size and CRC-protected, appended to one of two segment
+ * files on the storage partition. When the active segment is full the other
+ * one is truncated and reused, so the journal behaves as a ring and flash
+ * writes only ever happen at the tail of a small file. A torn record at the
+ * tail is padded over and skipped on the next read.
+ *
+ * The sequence number of the last delivered record is kept in a separate
+ * cursor file, written once per replay batch. Once everything has been
+ * replayed both segments are deleted.
+ *
+ * Only the loop task appends, after begin(). Events from the keypad and the
+ * fingerprint sensor reach it through a queue, so flash writes stay off the
+ * unlock path and events raised before the partition is mounted wait there.
+ */
+
+enum JournalKind : uint8_t {
+    JOURNAL_EVENT,          // Blynk.logEvent(name, text)
+    JOURNAL_VIRTUAL_WRITE,  // Blynk.virtualWrite(pin, text)
+};
+
+struct JournalRecord {
+    uint32_t seq;
+    uint32_t boot;    // Reset counter when the record was queued
+    uint32_t uptime;  // Seconds since that boot
+    uint8_t kind;
+    uint8_t pin;
+    char name[22];
+    char text[52];
+    uint32_t crc;
+} __attribute__((packed));
+
+struct JournalStats {
+    uint32_t queued;
+    uint32_t replayed;
+    uint32_t dropped;
+};
+
+class EventJournal {
+   public:
+    static const uint8_t SEGMENT_RECORDS = 32;
+
+    void begin(uint32_t bootId) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _bootId = bootId;
+        _pending = 0;
+#ifdef BLYNK_FS
+        if (File f = BLYNK_FS.open(CURSOR_PATH, FILE_READ)) {
+            f.read((uint8_t *)&_replayedSeq, sizeof(_replayedSeq));
+        }
+
+        uint32_t lastSeq = _replayedSeq;
+        for (uint8_t i = 0; i < 2; i++) {
+            _segments[i] = scanSegment(SEGMENT_PATHS[i]);
+            _pending += _segments[i].pending;
+            if (_segments[i].lastSeq > lastSeq) {
+                lastSeq = _segments[i].lastSeq;
+                _active = i;
+            }
+        }
+        _nextSeq = lastSeq + 1;
+#endif
+    }
+
+    bool append(JournalKind kind, uint8_t pin, const char *name,
+                const char *text) {
+        JournalRecord record = {};
+        record.kind = kind;
+        record.pin = pin;
+        record.boot = _bootId;
+        record.uptime = millis() / 1000;
+        strncpy(record.name, name, sizeof(record.name) - 1);
+        strncpy(record.text, text, sizeof(record.text) - 1);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        return write(record);
+    }
+
+    // Hands up to `batch` records, oldest first, to send(). Stops at the
+    // first one send() refuses and returns how many were delivered.
+    uint8_t replay(uint8_t batch, bool (*send)(const JournalRecord &)) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint8_t sent = 0;
+#ifdef BLYNK_FS
+        uint8_t order[2] = {(uint8_t)(_active ^ 1), _active};
+        bool refused = false;
+        for (uint8_t i = 0; i < 2 && sent < batch && !refused; i++) {
+            File f = BLYNK_FS.open(SEGMENT_PATHS[order[i]], FILE_READ);
+            if (!f) continue;
+
+            JournalRecord record;
+            while (sent < batch && f.read((uint8_t *)&record, sizeof(record)) ==
+                                       sizeof(record)) {
+                if (!isValid(record) || record.seq <= _replayedSeq) continue;
+                if (!send(record)) {
+                    refused = true;
+                    break;
+                }
+                _replayedSeq = record.seq;
+                _segments[order[i]].pending--;
+                _pending--;
+                _stats.replayed++;
+                sent++;
+            }
+        }
+
+        if (sent) {
+            if (File f = BLYNK_FS.open(CURSOR_PATH, FILE_WRITE)) {
+                f.write((const uint8_t *)&_replayedSeq, sizeof(_replayedSeq));
+            }
+        }
+        if (_pending == 0 && (_segments[0].slots || _segments[1].slots)) {
+            BLYNK_FS.remove(SEGMENT_PATHS[0]);
+            BLYNK_FS.remove(SEGMENT_PATHS[1]);
+            _segments[0] = _segments[1] = Segment();
+        }
+#endif
+        return sent;
+    }
+
+    uint32_t pending() const { return _pending; }
+    uint32_t bootId() const { return _bootId; }
+    const JournalStats &stats() const { return _stats; }
+
+   private:
+    struct Segment {
+        uint8_t slots = 0;    // Record-sized slots used in the file
+        uint8_t pending = 0;  // Valid records not replayed yet
+        uint32_t lastSeq = 0;
+    };
+
+    static uint32_t recordCrc(const JournalRecord &record) {
+        return BlynkCRC32(&record, offsetof(JournalRecord, crc));
+    }
+
+    static bool isValid(const JournalRecord &record) {
+        return record.seq != 0 && record.crc == recordCrc(record);
+    }
+
+    // Called with the mutex held
+    bool write(JournalRecord &record) {
+#ifdef BLYNK_FS
+        record.seq = _nextSeq;
+        record.crc = recordCrc(record);
+
+        if (_segments[_active].slots >= SEGMENT_RECORDS) {
+            // Reusing the older segment loses whatever was not replayed yet
+            _active ^= 1;
+            _stats.dropped += _segments[_active].pending;
+            _pending -= _segments[_active].pending;
+            _segments[_active] = Segment();
+            BLYNK_FS.remove(SEGMENT_PATHS[_active]);
+        }
+
+        Segment &segment = _segments[_active];
+        File f = BLYNK_FS.open(SEGMENT_PATHS[_active], FILE_APPEND);
+        if (f) {
+            // Realign after a torn write, the padding fails its CRC check
+            static const uint8_t padding[sizeof(JournalRecord)] = {};
+            size_t size = f.size();
+            if (size % sizeof(JournalRecord)) {
+                size_t pad = sizeof(JournalRecord) - size % sizeof(record);
+                size += f.write(padding, pad);
+            }
+
+            if (f.write((const uint8_t *)&record, sizeof(record)) ==
+                sizeof(record)) {
+                segment.slots = size / sizeof(JournalRecord) + 1;
+                segment.pending++;
+                segment.lastSeq = record.seq;
+                _nextSeq++;
+                _pending++;
+                _stats.queued++;
+                return true;
+            }
+        }
+#endif
+        _stats.dropped++;
+        return false;
+    }
+
+#ifdef BLYNK_FS
+    Segment scanSegment(const char *path) {
+        Segment segment;
+        File f = BLYNK_FS.open(path, FILE_READ);
+        if (!f) return segment;
+
+        segment.slots = min<size_t>(
+            (f.size() + sizeof(JournalRecord) - 1) / sizeof(JournalRecord),
+            SEGMENT_RECORDS);
+        JournalRecord record;
+        while (f.read((uint8_t *)&record, sizeof(record)) == sizeof(record)) {
+            if (!isValid(record)) continue;
+            segment.lastSeq = max(segment.lastSeq, record.seq);
+            if (record.seq > _replayedSeq) segment.pending++;
+        }
+        return segment;
+    }
+#endif
+
+    static constexpr const char *SEGMENT_PATHS[2] = {"/journal0.bin",
+                                                     "/journal1.bin"};
+    static constexpr const char *CURSOR_PATH = "/journal.pos";
+
+    std::mutex _mutex;
+    Segment _segments[2];
+    uint8_t _active = 0;
+    uint32_t _nextSeq = 1;
+    uint32_t _replayedSeq = 0;
+    uint32_t _pending = 0;
+    uint32_t _bootId = 0;
+    JournalStats _stats = {};
+};
+
+constexpr const char *EventJournal::SEGMENT_PATHS[2];
+constexpr const char *EventJournal::CURSOR_PATH;
+
+EventJournal eventJournal;
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Adafruit_Fingerprint.h>
+#include <Arduino.h>
+
+#ifndef FINGERPRINT_READINDEXTABLE
+#define FINGERPRINT_READINDEXTABLE 0x1F  // Read one page of the index table
+#endif
+
+/*
+ * RAM mirror of which template slots on the sensor are in use.
+ *
+ * It is read once at boot with the ReadIndexTable command (one round trip
+ * per 256 slots), or with a single loadModel sweep on modules that do not
+ * implement it. Every store/delete/empty goes through this class so the
+ * mirror stays in sync, and lookups never touch the UART. Until begin()
+ * has found a sensor they fail with FINGERPRINT_PACKETRECIEVEERR.
+ */
+
+class FingerSlots {
+   public:
+    static const uint16_t MAX_SLOTS = 1024;
+
+    void begin(Adafruit_Fingerprint &finger) {
+        _finger = &finger;
+        _capacity = 128;
+        if (_finger->getParameters() == FINGERPRINT_OK &&
+            _finger->capacity > 0) {
+            _capacity = min<uint16_t>(_finger->capacity, MAX_SLOTS);
+        }
+
+        memset(_bits, 0, sizeof(_bits));
+        if (!readIndexTable()) {
+            Serial.println("Index table not supported, scanning slots");
+            scanModels();
+        }
+
+        _count = 0;
+        for (uint16_t id = 0; id < _capacity; id++) {
+            if (isOccupied(id)) _count++;
+        }
+    }
+
+    bool isOccupied(uint16_t id) const {
+        return id < _capacity && (_bits[id / 8] & (1 << (id % 8)));
+    }
+
+    // Slot 0 is never handed out, 0 means the database is full
+    uint16_t findFree() const {
+        for (uint16_t word = 0; word * 32 < _capacity; word++) {
+            uint32_t used;
+            memcpy(&used, &_bits[word * 4], sizeof(used));
+            if (word == 0) used |= 1;
+            if (used == UINT32_MAX) continue;
+
+            uint16_t id = word * 32 + __builtin_ctz(~used);
+            return id < _capacity ? id : 0;
+        }
+        return 0;
+    }
+
+    uint16_t count() const { return _count; }
+    uint16_t capacity() const { return _capacity; }
+
+    uint8_t store(uint16_t id) {
+        if (!_finger) return FINGERPRINT_PACKETRECIEVEERR;
+        uint8_t p = _finger->storeModel(id);
+        if (p == FINGERPRINT_OK) mark(id, true);
+        return p;
+    }
+
+    uint8_t remove(uint16_t id) {
+        if (!_finger) return FINGERPRINT_PACKETRECIEVEERR;
+        uint8_t p = _finger->deleteModel(id);
+        if (p == FINGERPRINT_OK) mark(id, false);
+        return p;
+    }
+
+    uint8_t clear() {
+        if (!_finger) return FINGERPRINT_PACKETRECIEVEERR;
+        uint8_t p = _finger->emptyDatabase();
+        if (p == FINGERPRINT_OK) {
+            memset(_bits, 0, sizeof(_bits));
+            _count = 0;
+        }
+        return p;
+    }
+
+   private:
+    void mark(uint16_t id, bool used) {
+        if (id >= _capacity || isOccupied(id) == used) return;
+        if (used) {
+            _bits[id / 8] |= (1 << (id % 8));
+            _count++;
+        } else {
+            _bits[id / 8] &= ~(1 << (id % 8));
+            _count--;
+        }
+    }
+
+    bool readIndexTable() {
+        for (uint8_t page = 0; page * 256 < _capacity; page++) {
+            uint8_t data[] = {FINGERPRINT_READINDEXTABLE, page};
+            Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET,
+                                               sizeof(data), data);
+            _finger->writeStructuredPacket(packet);
+            if (_finger->getStructuredPacket(&packet) != FINGERPRINT_OK ||
+                packet.type != FINGERPRINT_ACKPACKET ||
+                packet.data[0] != FINGERPRINT_OK) {
+                return false;
+            }
+            // 32 bytes per page, LSB of each byte is the lowest id
+            memcpy(&_bits[page * 32], &packet.data[1], 32);
+        }
+
+        // Ignore bits past the end of the library
+        for (uint16_t id = _capacity; id < MAX_SLOTS; id++) {
+            _bits[id / 8] &= ~(1 << (id % 8));
+        }
+        return true;
+    }
+
+    void scanModels() {
+        for (uint16_t id = 0; id < _capacity; id++) {
+            if (_finger->loadModel(id) == FINGERPRINT_OK) {
+                _bits[id / 8] |= (1 << (id % 8));
+            }
+        }
+    }
+
+    Adafruit_Fingerprint *_finger = nullptr;
+    uint16_t _capacity = 0;
+    uint16_t _count = 0;
+    uint8_t _bits[MAX_SLOTS / 8];
+};
+
+const uint16_t FingerSlots::MAX_SLOTS;
+
+FingerSlots fingerSlots;
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Keypad.h>
+
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+/*
+ * Interrupt-driven input front end.
+ *
+ * While idle the keypad rows are driven LOW and the columns are pulled up,
+ * so any keypress pulls a column down and fires a GPIO interrupt. The ISR
+ * only wakes the scanner task, which lets the Keypad library walk the matrix
+ * until every key is released and then re-arms the interrupts. The PIR
+ * sensor raises its own interrupt. Both push timestamped events into one
+ * queue that the consumer blocks on.
+ */
+
+enum InputEventType : uint8_t {
+    INPUT_EVENT_KEY,
+    INPUT_EVENT_MOTION,
+    INPUT_EVENT_WAKE,    // Re-evaluate timers, posted by other tasks
+    INPUT_EVENT_PROMPT,  // A timed message is gone, clear the passcode entry
+};
+
+struct InputEvent {
+    InputEventType type;
+    char key;
+    int64_t timestamp;  // esp_timer_get_time() at the triggering edge
+};
+
+struct InputStats {
+    uint32_t keys;
+    uint32_t motions;
+    uint32_t dropped;
+    uint32_t latencyLast;
+    uint32_t latencyMax;
+    uint32_t latencyCount;
+    uint64_t latencySum;
+};
+
+class InputEvents {
+   public:
+    static const uint8_t QUEUE_LENGTH = 32;
+    static const uint8_t SCAN_INTERVAL_MS = 5;
+
+    void begin(Keypad &keypad, const uint8_t *rowPins, const uint8_t *colPins,
+               uint8_t rows, uint8_t cols, int motionPin) {
+        _keypad = &keypad;
+        _rowPins = rowPins;
+        _colPins = colPins;
+        _rows = rows;
+        _cols = cols;
+
+        // Keypad only scans when more than debounceTime ms have passed
+        _keypad->setDebounceTime(1);
+
+        _queue = xQueueCreate(QUEUE_LENGTH, sizeof(InputEvent));
+        xTaskCreatePinnedToCore(scannerTask, "KeypadScan", 2048, this, 3,
+                                &_scannerHandle, 0);
+
+        armKeypad();
+        for (uint8_t c = 0; c < _cols; c++) {
+            attachInterruptArg(_colPins[c], keypadIsr, this, FALLING);
+        }
+
+        pinMode(motionPin, INPUT);
+        attachInterruptArg(motionPin, motionIsr, this, RISING);
+    }
+
+    bool receive(InputEvent &event, TickType_t wait) {
+        return xQueueReceive(_queue, &event, wait) == pdTRUE;
+    }
+
+    bool pending() const { return uxQueueMessagesWaiting(_queue) > 0; }
+
+    // Wakes the consumer so it re-evaluates lock state changed elsewhere
+    void wake() { notify(INPUT_EVENT_WAKE); }
+
+    // Posts an event without a key from another task
+    void notify(InputEventType type) {
+        if (!_queue) return;
+        InputEvent event = {type, 0, esp_timer_get_time()};
+        xQueueSend(_queue, &event, 0);
+    }
+
+    // Called once the consumer has echoed a key on the LCD
+    void recordLatency(int64_t timestamp) {
+        uint32_t latency = esp_timer_get_time() - timestamp;
+        _stats.latencyLast = latency;
+        _stats.latencyMax = max(_stats.latencyMax, latency);
+        _stats.latencySum += latency;
+        _stats.latencyCount++;
+    }
+
+    // The counters are bumped from ISRs and several tasks, so callers get
+    // a snapshot rather than a reference into live state
+    InputStats stats() const {
+        InputStats stats = _stats;
+        stats.keys = _keys.load(std::memory_order_relaxed);
+        stats.motions = _motions.load(std::memory_order_relaxed);
+        stats.dropped = _dropped.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void clearStats() {
+        memset(&_stats, 0, sizeof(_stats));
+        _keys = 0;
+        _motions = 0;
+        _dropped = 0;
+    }
+
+   private:
+    // Idle levels: rows pull a pressed key's column down
+    void armKeypad() {
+        for (uint8_t r = 0; r < _rows; r++) {
+            pinMode(_rowPins[r], OUTPUT);
+            digitalWrite(_rowPins[r], LOW);
+        }
+        for (uint8_t c = 0; c < _cols; c++) {
+            pinMode(_colPins[c], INPUT_PULLUP);
+        }
+    }
+
+    bool keysHeld() const {
+        for (uint8_t i = 0; i < LIST_MAX; i++) {
+            if (_keypad->key[i].kchar != NO_KEY) return true;
+        }
+        return false;
+    }
+
+    void push(const InputEvent &event) {
+        if (xQueueSend(_queue, &event, 0) != pdTRUE) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    static void IRAM_ATTR keypadIsr(void *arg) {
+        InputEvents *self = static_cast<InputEvents *>(arg);
+        // Scanning drives the column pins itself, ignore those edges
+        if (self->_scanning) return;
+        self->_scanning = true;
+        self->_edgeTime = esp_timer_get_time();
+
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(self->_scannerHandle, &woken);
+        if (woken) portYIELD_FROM_ISR();
+    }
+
+    static void IRAM_ATTR motionIsr(void *arg) {
+        InputEvents *self = static_cast<InputEvents *>(arg);
+        InputEvent event = {INPUT_EVENT_MOTION, 0, esp_timer_get_time()};
+
+        BaseType_t woken = pdFALSE;
+        if (xQueueSendFromISR(self->_queue, &event, &woken) != pdTRUE) {
+            self->_dropped.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            self->_motions.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (woken) portYIELD_FROM_ISR();
+    }
+
+    static void scannerTask(void *parameter) {
+        InputEvents *self = static_cast<InputEvents *>(parameter);
+        for (;;) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+            // The first key reuses the edge time, rollover keys are stamped
+            // when the scan sees them
+            int64_t timestamp = self->_edgeTime;
+            do {
+                // getKey() only reports the first slot, walk the whole list
+                // so rollover typing is not lost
+                if (self->_keypad->getKeys()) {
+                    for (uint8_t i = 0; i < LIST_MAX; i++) {
+                        const Key &key = self->_keypad->key[i];
+                        if (!key.stateChanged || key.kstate != PRESSED) {
+                            continue;
+                        }
+                        self->push({INPUT_EVENT_KEY, key.kchar, timestamp});
+                        self->_keys.fetch_add(1, std::memory_order_relaxed);
+                        timestamp = esp_timer_get_time();
+                    }
+                }
+                vTaskDelay(pdMS_TO_TICKS(SCAN_INTERVAL_MS));
+            } while (self->keysHeld());
+
+            self->armKeypad();
+            self->_scanning = false;
+
+            // A key pressed while re-arming left no edge to trigger on
+            for (uint8_t c = 0; c < self->_cols; c++) {
+                if (digitalRead(self->_colPins[c]) == LOW) {
+                    self->_scanning = true;
+                    self->_edgeTime = esp_timer_get_time();
+                    xTaskNotifyGive(self->_scannerHandle);
+                    break;
+                }
+            }
+        }
+    }
+
+    Keypad *_keypad = nullptr;
+    const uint8_t *_rowPins = nullptr;
+    const uint8_t *_colPins = nullptr;
+    uint8_t _rows = 0;
+    uint8_t _cols = 0;
+
+    QueueHandle_t _queue = NULL;
+    TaskHandle_t _scannerHandle = NULL;
+    volatile bool _scanning = false;
+    volatile int64_t _edgeTime = 0;
+    InputStats _stats = {};  // Latency fields, only the consumer writes them
+    std::atomic<uint32_t> _keys{0};
+    std::atomic<uint32_t> _motions{0};
+    std::atomic<uint32_t> _dropped{0};
+};
+
+InputEvents inputEvents;
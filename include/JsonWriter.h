@@ -0,0 +1,158 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+ * Streaming JSON writer.
+ *
+ * Values go straight to a Print as they are added, so a reply is never
+ * assembled in RAM and nothing is allocated. Strings are escaped on the
+ * way out. Nesting depth is tracked in a bitmask, one bit per level that
+ * already has a member, which is all that is needed to place the commas.
+ *
+ *     JsonWriter json(out);
+ *     json.beginObject().member("status", "ok").member("rssi", -60);
+ *     json.endObject();
+ */
+
+class JsonWriter {
+   public:
+    static const uint8_t MAX_DEPTH = 32;
+
+    explicit JsonWriter(Print &out) : _out(out) {}
+
+    JsonWriter &beginObject() { return open('{'); }
+    JsonWriter &endObject() { return close('}'); }
+    JsonWriter &beginArray() { return open('['); }
+    JsonWriter &endArray() { return close(']'); }
+
+    JsonWriter &key(const char *name) {
+        separate();
+        string(name);
+        raw(":", 1);
+        _afterKey = true;
+        return *this;
+    }
+
+    JsonWriter &value(const char *text) {
+        separate();
+        if (text) {
+            string(text);
+        } else {
+            raw("null", 4);
+        }
+        return *this;
+    }
+
+    JsonWriter &value(bool flag) {
+        separate();
+        if (flag) {
+            raw("true", 4);
+        } else {
+            raw("false", 5);
+        }
+        return *this;
+    }
+
+    JsonWriter &value(long n) {
+        char buff[24];
+        return literal(buff, snprintf(buff, sizeof(buff), "%ld", n));
+    }
+
+    JsonWriter &value(unsigned long n) {
+        char buff[24];
+        return literal(buff, snprintf(buff, sizeof(buff), "%lu", n));
+    }
+
+    JsonWriter &value(int n) { return value((long)n); }
+    JsonWriter &value(unsigned n) { return value((unsigned long)n); }
+
+    template <typename T>
+    JsonWriter &member(const char *name, T v) {
+        key(name);
+        return value(v);
+    }
+
+    // Bytes handed to the Print so far
+    size_t written() const { return _written; }
+
+   private:
+    JsonWriter &open(char bracket) {
+        separate();
+        raw(&bracket, 1);
+        if (_depth < MAX_DEPTH) _depth++;
+        _hasMembers &= ~level();
+        return *this;
+    }
+
+    JsonWriter &close(char bracket) {
+        if (_depth) _depth--;
+        raw(&bracket, 1);
+        return *this;
+    }
+
+    JsonWriter &literal(const char *text, int len) {
+        separate();
+        raw(text, len);
+        return *this;
+    }
+
+    uint32_t level() const { return _depth ? 1UL << (_depth - 1) : 0; }
+
+    // Emits the comma before every member but the first of its level
+    void separate() {
+        if (_afterKey) {
+            _afterKey = false;
+            return;
+        }
+        if (_hasMembers & level()) raw(",", 1);
+        _hasMembers |= level();
+    }
+
+    // Copies runs of plain characters in one write, escapes the rest
+    void string(const char *text) {
+        raw("\"", 1);
+        const char *run = text;
+        for (; *text; text++) {
+            uint8_t c = *text;
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+            raw(run, text - run);
+            run = text + 1;
+            switch (c) {
+                case '"':
+                    raw("\\\"", 2);
+                    break;
+                case '\\':
+                    raw("\\\\", 2);
+                    break;
+                case '\n':
+                    raw("\\n", 2);
+                    break;
+                case '\r':
+                    raw("\\r", 2);
+                    break;
+                case '\t':
+                    raw("\\t", 2);
+                    break;
+                default: {
+                    char buff[7];
+                    snprintf(buff, sizeof(buff), "\\u%04x", c);
+                    raw(buff, 6);
+                }
+            }
+        }
+        raw(run, text - run);
+        raw("\"", 1);
+    }
+
+    void raw(const char *text, size_t len) {
+        if (len) _written += _out.write((const uint8_t *)text, len);
+    }
+
+    Print &_out;
+    size_t _written = 0;
+    uint32_t _hasMembers = 0;
+    uint8_t _depth = 0;
+    bool _afterKey = false;
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LiquidCrystal_I2C.h>
+
+#include <mutex>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Shadow framebuffer for the 16x2 character LCD.
+ *
+ * Callers only write into RAM and poke the display task. The task diffs the
+ * requested frame against what is already on the glass and sends just the
+ * changed cells, moving the cursor only when a run of changes is not
+ * contiguous. lcd.clear() is slow and flickers, so it only runs in begin().
+ */
+
+struct LcdStats {
+    uint32_t frames;
+    uint32_t cells;
+    uint32_t cursorMoves;
+};
+
+class LcdRenderer {
+   public:
+    static const uint8_t COLS = 16;
+    static const uint8_t ROWS = 2;
+
+    void begin(LiquidCrystal_I2C &lcd) {
+        _lcd = &lcd;
+        _lcd->clear();
+        memset(_frame, ' ', sizeof(_frame));
+        memset(_shown, ' ', sizeof(_shown));
+
+        // Same priority as the writers, so back-to-back updates coalesce
+        xTaskCreatePinnedToCore(displayTask, "Display", 2048, this, 1,
+                                &_taskHandle, 0);
+    }
+
+    // Replaces the whole frame with two lines
+    void show(const char *line1, const char *line2) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            memset(_frame, ' ', sizeof(_frame));
+            put(0, 0, line1);
+            put(0, 1, line2);
+        }
+        xTaskNotifyGive(_taskHandle);
+    }
+
+    void print(uint8_t col, uint8_t row, const String &text,
+               bool clearFirst = false) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (clearFirst) memset(_frame, ' ', sizeof(_frame));
+            put(col, row, text.c_str());
+        }
+        xTaskNotifyGive(_taskHandle);
+    }
+
+    // Call after the write to be timed: the hook runs with this timestamp
+    // once a frame that includes it reached the glass
+    void trackEcho(int64_t timestamp) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_echoTimestamp) _echoTimestamp = timestamp;
+        }
+        xTaskNotifyGive(_taskHandle);
+    }
+    void setEchoHook(void (*hook)(int64_t)) { _echoHook = hook; }
+
+    const LcdStats &stats() const { return _stats; }
+    void clearStats() { memset(&_stats, 0, sizeof(_stats)); }
+
+   private:
+    void put(uint8_t col, uint8_t row, const char *text) {
+        if (row >= ROWS) return;
+        for (; *text && col < COLS; text++, col++) {
+            _frame[row][col] = *text;
+        }
+    }
+
+    void flush() {
+        char frame[ROWS][COLS];
+        int64_t echoTimestamp;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            memcpy(frame, _frame, sizeof(frame));
+            echoTimestamp = _echoTimestamp;
+            _echoTimestamp = 0;
+        }
+
+        bool changed = false;
+        for (uint8_t row = 0; row < ROWS; row++) {
+            // The controller auto-increments, so only jump over unchanged
+            // cells. Past the last column it wraps to an unrelated address.
+            uint8_t cursorCol = COLS;
+            for (uint8_t col = 0; col < COLS; col++) {
+                if (frame[row][col] == _shown[row][col]) continue;
+                if (cursorCol != col) {
+                    _lcd->setCursor(col, row);
+                    _stats.cursorMoves++;
+                }
+                _lcd->write(frame[row][col]);
+                _shown[row][col] = frame[row][col];
+                _stats.cells++;
+                cursorCol = col + 1;
+                changed = true;
+            }
+        }
+        if (changed) _stats.frames++;
+
+        if (echoTimestamp && _echoHook) _echoHook(echoTimestamp);
+    }
+
+    static void displayTask(void *parameter) {
+        LcdRenderer *self = static_cast<LcdRenderer *>(parameter);
+        for (;;) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            self->flush();
+        }
+    }
+
+    LiquidCrystal_I2C *_lcd = nullptr;
+    TaskHandle_t _taskHandle = NULL;
+    std::mutex _mutex;
+    char _frame[ROWS][COLS];
+    char _shown[ROWS][COLS];
+    int64_t _echoTimestamp = 0;
+    void (*_echoHook)(int64_t) = nullptr;
+    LcdStats _stats = {};
+};
+
+LcdRenderer lcdRenderer;
@@ -3,10 +3,67 @@
 #include <Update.h>
 #include <HTTPClient.h>
 
+#include "OtaImage.h"
+#include "OtaPayload.h"
+#include "OtaPipeline.h"
+#include "OtaThrottle.h"
+
 String overTheAirURL;
 
 extern BlynkTimer edgentTimer;
 
+// A download that keeps failing without making progress is given up after
+// OTA_MAX_STALLS attempts. The checkpoint stays, so the next boot resumes.
+static const uint8_t  OTA_MAX_STALLS      = 10;
+static const uint32_t OTA_RETRY_DELAY     = 5000;
+static const uint32_t OTA_READ_TIMEOUT    = 15000;
+static const uint32_t OTA_WIFI_TIMEOUT    = 30000;
+
+// The download runs on its own task at idle priority and at most
+// otaRateLimit bytes/s (0 for no cap), so the lock and the cloud connection
+// carry on meanwhile. Only the final reboot interrupts them.
+static const uint32_t OTA_DEFAULT_RATE    = 32 * 1024;
+static const uint32_t OTA_TASK_STACK      = 8192;
+
+uint32_t otaRateLimit = OTA_DEFAULT_RATE;
+
+enum OtaJobState : uint8_t {
+  OTA_JOB_IDLE,
+  OTA_JOB_RUNNING,
+  OTA_JOB_DONE,     // New image is bootable, waiting for the loop to reboot
+  OTA_JOB_FAILED,
+};
+
+static volatile OtaJobState otaJobState = OTA_JOB_IDLE;
+static bool otaResumePending = false;
+static bool otaTryDelta = true;
+static bool otaTryGzip = true;
+static OtaThrottle otaThrottle;
+
+enum OtaFetchResult {
+  OTA_FETCH_DONE,
+  OTA_FETCH_DROPPED,  // Worth another Range request
+  OTA_FETCH_FAILED,   // Start over from scratch later, if at all
+};
+
+static void otaTask(void*);
+
+static
+void ota_start() {
+  if (otaJobState != OTA_JOB_IDLE) {
+    DEBUG_PRINT("OTA already in progress");
+    return;
+  }
+  Blynk.logEvent("sys_ota", "OTA started");
+
+  otaJobState = OTA_JOB_RUNNING;
+  if (xTaskCreatePinnedToCore(otaTask, "OTA", OTA_TASK_STACK, NULL,
+                              tskIDLE_PRIORITY, NULL, 1) != pdPASS) {
+    DEBUG_PRINT("Could not start the OTA task");
+    otaJobState = OTA_JOB_FAILED;
+  }
+}
+
 BLYNK_WRITE(InternalPinOTA) {
   overTheAirURL = param.asString();
 #if defined(ESP32)
@@ -16,82 +73,254 @@ BLYNK_WRITE(InternalPinOTA) {
     }
 #endif
 
-  edgentTimer.setTimeout(2000L, [](){
-    // Start OTA
-    Blynk.logEvent("sys_ota", "OTA started");
-
-    // Disconnect, not to interfere with OTA process
-    Blynk.disconnect();
+  edgentTimer.setTimeout(2000L, ota_start);
+}
 
-    BlynkState::set(MODE_OTA_UPGRADE);
-  });
+// Looks for a download that was interrupted by a reboot
+void ota_init() {
+  if (OtaImage::pending(overTheAirURL)) {
+    DEBUG_PRINT("Interrupted firmware update found");
+    otaResumePending = true;
+  }
 }
 
-void enterOTA() {
-  BlynkState::set(MODE_OTA_UPGRADE);
+// Resumes it once the device is back online
+void ota_check_resume() {
+  if (otaResumePending) {
+    otaResumePending = false;
+    edgentTimer.setTimeout(2000L, ota_start);
+  }
+}
 
-  DEBUG_PRINT(String("Firmware update URL: ") + overTheAirURL);
+// One GET, with a Range header when continuing where the last one stopped
+static
+OtaFetchResult otaFetch() {
+  uint32_t from = otaImage.offset();
 
   HTTPClient http;
   http.begin(overTheAirURL);
+  http.setTimeout(OTA_READ_TIMEOUT);
 
-  const char* headerkeys[] = { "x-MD5" };
+  const char* headerkeys[] = { "x-MD5", "Content-Range" };
   http.collectHeaders(headerkeys, sizeof(headerkeys)/sizeof(char*));
+  if (from) {
+    http.addHeader("Range", String("bytes=") + from + "-");
+  } else if (otaTryDelta) {
+    // Lets the server answer with a patch against this build
+    http.addHeader("x-Base-MD5", ESP.getSketchMD5());
+  }
+  http.addHeader("Accept-Encoding", otaTryGzip ? "gzip" : "identity");
 
   int httpCode = http.GET();
-  if (httpCode != HTTP_CODE_OK) {
-    DEBUG_PRINT("HTTP response should be 200");
-    BlynkState::set(MODE_ERROR);
-    return;
-  }
-  int contentLength = http.getSize();
-  if (contentLength <= 0) {
-    DEBUG_PRINT("Content-Length not defined");
-    BlynkState::set(MODE_ERROR);
-    return;
+  int contentLength = 0;
+  if (httpCode == HTTP_CODE_PARTIAL_CONTENT && from) {
+    // Content-Range: bytes <from>-<last>/<size>
+    String range = http.header("Content-Range");
+    int slash = range.indexOf('/');
+    if (!range.startsWith(String("bytes ") + from + "-") || slash < 0) {
+      DEBUG_PRINT("Unexpected Content-Range: " + range);
+      otaImage.restart();
+      return OTA_FETCH_DROPPED;
+    }
+    contentLength = range.substring(slash + 1).toInt();
+  } else if (httpCode == HTTP_CODE_OK) {
+    if (from) {
+      DEBUG_PRINT("Server ignored Range, starting over");
+      otaImage.restart();
+    }
+    contentLength = http.getSize();
+  } else if (httpCode < 0 || httpCode >= 500) {
+    DEBUG_PRINT(String("OTA request failed: ") + httpCode);
+    return OTA_FETCH_DROPPED;
+  } else {
+    DEBUG_PRINT(String("HTTP response should be 200, got ") + httpCode);
+    return OTA_FETCH_FAILED;
   }
 
-  bool canBegin = Update.begin(contentLength);
-  if (!canBegin) {
-    DEBUG_PRINT("Not enough space to begin OTA");
-    BlynkState::set(MODE_ERROR);
-    return;
+  int bodyLength = http.getSize();
+  if (contentLength <= 0 || bodyLength <= 0) {
+    DEBUG_PRINT("Content-Length not defined");
+    return OTA_FETCH_FAILED;
   }
 
+  String md5;
   if (http.hasHeader("x-MD5")) {
-    String md5 = http.header("x-MD5");
-    if (md5.length() == 32) {
-      md5.toLowerCase();
-      DEBUG_PRINT("Expected MD5: " + md5);
-      Update.setMD5(md5.c_str());
+    md5 = http.header("x-MD5");
+    md5.toLowerCase();
+    if (md5.length() != 32) {
+      md5 = "";
     }
   }
 
-#ifdef BLYNK_FS
-  BLYNK_FS.end();
-#endif
+  bool fresh = (otaImage.offset() == 0);
+  if (!fresh && !otaImage.accept(contentLength, md5.c_str())) {
+    DEBUG_PRINT("Firmware changed on the server, starting over");
+    otaImage.restart();
+    return OTA_FETCH_DROPPED;
+  }
+
+  if (fresh) {
+    DEBUG_PRINT(String("Download size: ") + contentLength + (md5.length() ? ", MD5: " + md5 : ""));
+    otaPayload.begin(contentLength, md5.c_str());
+  }
+
+  // Flash is written by the pipeline's own task, this one only receives
+  if (!otaPipeline.begin(fresh, true)) {
+    DEBUG_PRINT(otaPipeline.error());
+    return OTA_FETCH_FAILED;
+  }
 
   Client& client = http.getStream();
-  int written = Update.writeStream(client);
-  if (written != contentLength) {
-    DEBUG_PRINT(String("OTA written ") + written + " / " + contentLength + " bytes");
-    BlynkState::set(MODE_ERROR);
-    return;
+  OtaFetchResult result = OTA_FETCH_DONE;
+  int received = 0;
+  uint8_t buff[1024];
+  uint32_t lastData = millis();
+  while (received < bodyLength) {
+    size_t avail = client.available();
+    if (!avail) {
+      if (!client.connected() || millis() - lastData > OTA_READ_TIMEOUT) {
+        result = OTA_FETCH_DROPPED;
+        break;
+      }
+      delay(1);
+      continue;
+    }
+    size_t want = BlynkMin(avail, sizeof(buff));
+    want = BlynkMin(want, (size_t)(bodyLength - received));
+    int len = client.read(buff, want);
+    if (len <= 0) continue;
+
+    if (!otaPipeline.push(buff, len)) break;
+    received += len;
+    lastData = millis();
+    otaThrottle.consumed(len);
   }
 
-  if (!Update.end()) {
-    DEBUG_PRINT("Error #" + String(Update.getError()));
-    BlynkState::set(MODE_ERROR);
-    return;
+  bool written = otaPipeline.finish();
+  otaPipeline.end();
+  DEBUG_PRINT("OTA transfer: " + otaPipeline.stats().summary());
+  if (!written) {
+    if (fresh && otaPayload.baseMismatch()) {
+      DEBUG_PRINT("Delta is for another build, fetching the full image");
+      otaTryDelta = false;
+      otaImage.restart();
+      return OTA_FETCH_DROPPED;
+    }
+    DEBUG_PRINT(otaPipeline.error());
+    return OTA_FETCH_FAILED;
+  }
+  if (result != OTA_FETCH_DONE) {
+    return result;
   }
 
-  if (!Update.isFinished()) {
-    DEBUG_PRINT("Update failed.");
-    BlynkState::set(MODE_ERROR);
-    return;
+  if (fresh) {
+    if (!otaPayload.finish()) {
+      DEBUG_PRINT(otaPayload.error());
+      return OTA_FETCH_FAILED;
+    }
+    if (otaPayload.compressed() || otaPayload.delta()) {
+      DEBUG_PRINT(String("Rebuilt ") + otaImage.offset() + " byte image from " +
+                  (otaPayload.compressed() ? "compressed " : "") +
+                  (otaPayload.delta() ? "delta" : "image"));
+    }
+  }
+  return OTA_FETCH_DONE;
+}
+
+static
+void otaFailed() {
+  otaPayload.close();
+  otaImage.close();
+}
+
+// Runs on the OTA task, true once the new image is bootable
+static
+bool otaDownload() {
+  DEBUG_PRINT(String("Firmware update URL: ") + overTheAirURL);
+
+  if (!otaImage.open(overTheAirURL.c_str())) {
+    DEBUG_PRINT(otaImage.error());
+    otaFailed();
+    return false;
+  }
+  if (otaImage.offset()) {
+    DEBUG_PRINT(String("Resuming at ") + otaImage.offset() + " / " + otaImage.size() + " bytes");
+  }
+
+  otaTryDelta = true;
+  otaTryGzip = true;
+  otaThrottle.begin(otaRateLimit);
+  uint8_t stalls = 0;
+  for (;;) {
+    uint32_t before = otaImage.offset();
+    OtaFetchResult result = otaFetch();
+    if (result == OTA_FETCH_DONE) {
+      break;
+    }
+    if (result == OTA_FETCH_FAILED) {
+      otaImage.discard();
+      otaFailed();
+      return false;
+    }
+
+    // A rebuilt image starts over from zero, so its progress does not count
+    bool rebuilt = !otaImage.resumable();
+    stalls = (!rebuilt && otaImage.offset() > before) ? 0 : stalls + 1;
+    DEBUG_PRINT(String("OTA interrupted at ") + otaImage.offset() + " / " + otaImage.size() + " bytes");
+    if (rebuilt) {
+      // Rebuilt images cannot continue by offset. Ask for the plain image
+      // for the rest of the job, which can.
+      otaImage.restart();
+      otaTryDelta = false;
+      otaTryGzip = false;
+    }
+    if (stalls >= OTA_MAX_STALLS) {
+      otaFailed();
+      return false;
+    }
+
+    delay(OTA_RETRY_DELAY);
+    unsigned long timeoutMs = millis() + OTA_WIFI_TIMEOUT;
+    while (WiFi.status() != WL_CONNECTED && timeoutMs > millis()) {
+      delay(100);
+    }
+  }
+
+  if (!otaImage.finish()) {
+    DEBUG_PRINT(otaImage.error());
+    otaImage.discard();
+    otaFailed();
+    return false;
+  }
+  otaImage.close();
+  if (otaThrottle.sleptMs()) {
+    DEBUG_PRINT(String("OTA rate cap held the download back ") + otaThrottle.sleptMs() + " ms");
+  }
+  return true;
+}
+
+static
+void otaTask(void*) {
+  otaJobState = otaDownload() ? OTA_JOB_DONE : OTA_JOB_FAILED;
+  vTaskDelete(NULL);
+}
+
+// Polled by the loop task, which owns the Blynk connection
+void ota_run() {
+  if (otaJobState == OTA_JOB_DONE) {
+    BlynkState::set(MODE_OTA_UPGRADE);
+  } else if (otaJobState == OTA_JOB_FAILED) {
+    otaJobState = OTA_JOB_IDLE;
+    Blynk.logEvent("sys_ota", "OTA failed");
   }
+}
 
+// The new image is in place, only the reboot is left
+void enterOTA() {
   DEBUG_PRINT("=== Update successfully completed. Rebooting.");
+  Blynk.disconnect();
+#ifdef BLYNK_FS
+  BLYNK_FS.end();
+#endif
   systemReboot();
 }
-
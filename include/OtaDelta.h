@@ -0,0 +1,208 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "OtaImage.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+
+/*
+ * Rebuilds a firmware image from a patch against the running one.
+ *
+ * Patches come from scripts/make_delta.py. After a 40 byte header
+ *
+ *     "SLD1" | base MD5 (16) | target size (u32 LE) | target MD5 (16)
+ *
+ * follow ops, all lengths and offsets u32 little endian:
+ *
+ *     COPY   base offset, length          bytes taken from the running app
+ *     DIFF   base offset, length, bytes   base bytes plus these, mod 256
+ *     INSERT length, bytes                new bytes
+ *
+ * DIFF covers code that only moved, where most differences are shifted
+ * addresses and the added bytes are mostly zero, which compresses well.
+ * The patch is decoded as it arrives and the result goes straight to
+ * otaImage, so RAM use is a small scratch buffer whatever the image size.
+ */
+
+enum OtaDeltaOp : uint8_t {
+    OTA_DELTA_COPY = 1,
+    OTA_DELTA_DIFF = 2,
+    OTA_DELTA_INSERT = 3,
+};
+
+class OtaDelta {
+   public:
+    static const size_t HEADER_SIZE = 40;
+    static const size_t SCRATCH_SIZE = 256;
+
+    static bool detect(const uint8_t *data, size_t len) {
+        return len >= 4 && memcmp(data, "SLD1", 4) == 0;
+    }
+
+    void begin() {
+        _state = HEADER;
+        _need = HEADER_SIZE;
+        _have = 0;
+        _error = nullptr;
+        _baseMismatch = false;
+        _base = esp_ota_get_running_partition();
+        _baseSize = ESP.getSketchSize();
+    }
+
+    // Consumes patch bytes, false on a bad patch or a flash error
+    bool write(const uint8_t *data, size_t len) {
+        while (len) {
+            size_t n;
+            switch (_state) {
+                case HEADER:
+                case OP:
+                    n = min(len, _need - _have);
+                    memcpy(_header + _have, data, n);
+                    _have += n;
+                    if (_have == _need && !parse()) return false;
+                    break;
+
+                case DIFF:
+                    n = min(min(len, (size_t)_remaining), SCRATCH_SIZE);
+                    if (!readBase(n)) return false;
+                    for (size_t i = 0; i < n; i++) _scratch[i] += data[i];
+                    if (!emit(_scratch, n)) return false;
+                    break;
+
+                case INSERT:
+                    n = min(len, (size_t)_remaining);
+                    if (!emit(data, n)) return false;
+                    break;
+
+                default:
+                    return fail("Data after the end of the patch");
+            }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    bool done() const { return _state == DONE; }
+
+    // The patch was made for a different build than the one running
+    bool baseMismatch() const { return _baseMismatch; }
+
+    const char *error() const { return _error ? _error : "none"; }
+
+   private:
+    enum State : uint8_t { HEADER, OP, DIFF, INSERT, DONE };
+
+    bool parse() {
+        if (_state == HEADER) {
+            _have = 0;
+            return parseHeader();
+        }
+
+        if (_have == 1) {
+            // Opcode only so far, now the arguments
+            _need = (_header[0] == OTA_DELTA_INSERT) ? 5 : 9;
+            return true;
+        }
+        _have = 0;
+
+        uint8_t op = _header[0];
+        if (op == OTA_DELTA_INSERT) {
+            _remaining = u32(_header + 1);
+        } else if (op == OTA_DELTA_COPY || op == OTA_DELTA_DIFF) {
+            _baseOffset = u32(_header + 1);
+            _remaining = u32(_header + 5);
+            if (_baseOffset > _baseSize || _remaining > _baseSize - _baseOffset) {
+                return fail("Patch reads past the running app");
+            }
+        } else {
+            return fail("Unknown patch op");
+        }
+        if (_remaining > _targetSize - otaImage.offset()) {
+            return fail("Patch writes past the image");
+        }
+        if (!_remaining) {
+            nextOp();
+            return true;
+        }
+
+        if (op == OTA_DELTA_COPY) {
+            // Needs no patch bytes, so it runs right away
+            while (_remaining) {
+                size_t n = min((size_t)_remaining, SCRATCH_SIZE);
+                if (!readBase(n) || !emit(_scratch, n)) return false;
+            }
+        } else {
+            _state = (op == OTA_DELTA_DIFF) ? DIFF : INSERT;
+        }
+        return true;
+    }
+
+    bool parseHeader() {
+        char base[33], target[33];
+        hex(_header + 4, base);
+        hex(_header + 24, target);
+        _targetSize = u32(_header + 20);
+
+        if (ESP.getSketchMD5() != base) {
+            _baseMismatch = true;
+            return fail("Patch is for another build");
+        }
+        if (!otaImage.accept(_targetSize, target)) return fail(otaImage.error());
+        nextOp();
+        return true;
+    }
+
+    bool readBase(size_t n) {
+        if (esp_partition_read(_base, _baseOffset, _scratch, n) != ESP_OK) {
+            return fail("Flash read failed");
+        }
+        _baseOffset += n;
+        return true;
+    }
+
+    bool emit(const uint8_t *data, size_t n) {
+        if (!otaImage.write(data, n)) return fail(otaImage.error());
+        _remaining -= n;
+        if (!_remaining) nextOp();
+        return true;
+    }
+
+    void nextOp() {
+        _state = (otaImage.offset() == _targetSize) ? DONE : OP;
+        _need = 1;
+        _have = 0;
+    }
+
+    bool fail(const char *error) {
+        _error = error;
+        return false;
+    }
+
+    static uint32_t u32(const uint8_t *p) {
+        return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    static void hex(const uint8_t *md5, char *out) {
+        for (int i = 0; i < 16; i++) snprintf(out + 2 * i, 3, "%02x", md5[i]);
+    }
+
+    const esp_partition_t *_base = nullptr;
+    uint32_t _baseSize = 0;
+    uint32_t _targetSize = 0;
+    State _state = DONE;
+    uint8_t _header[HEADER_SIZE];
+    size_t _need = HEADER_SIZE;
+    size_t _have = 0;
+    uint32_t _baseOffset = 0;
+    uint32_t _remaining = 0;
+    uint8_t _scratch[SCRATCH_SIZE];
+    bool _baseMismatch = false;
+    const char *_error = nullptr;
+};
+
+const size_t OtaDelta::HEADER_SIZE;
+const size_t OtaDelta::SCRATCH_SIZE;
+
+OtaDelta otaDelta;
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_rom_md5.h"
+
+/*
+ * Firmware image being written into the inactive OTA partition.
+ *
+ * Bytes are collected into whole flash sectors, each sector is erased and
+ * written in one go and fed to a running MD5. eraseAhead() lets an idle
+ * writer clear the next sectors early, in whole 64 KB blocks where it can,
+ * so a sector is usually ready by the time its data arrives. Every CHECKPOINT_SECTORS the
+ * written length and the MD5 state go to NVS together with the URL, so a
+ * download that was cut off - by a dropped connection or a reboot - picks
+ * up from the last checkpoint instead of from zero. Nothing marks the
+ * partition bootable until finish() has checked size, MD5 and the image
+ * itself.
+ */
+
+class OtaImage {
+   public:
+    static const uint32_t SECTOR_SIZE = 4096;
+    static const uint8_t CHECKPOINT_SECTORS = 16;  // 64 KB
+    static const uint32_t BLOCK_SIZE = 65536;
+    static const uint32_t ERASE_AHEAD = 2 * BLOCK_SIZE;
+
+    // Picks the target partition and restores a checkpoint left for this
+    // URL, if there is one. offset() tells where to continue.
+    bool open(const char *url) {
+        _error = nullptr;
+        _partition = esp_ota_get_next_update_partition(NULL);
+        if (!_partition) return fail("No OTA partition");
+
+        if (!_buffer) _buffer = (uint8_t *)malloc(SECTOR_SIZE);
+        if (!_buffer) return fail("Out of memory");
+        _buffered = 0;
+
+        strncpy(_url, url, sizeof(_url) - 1);
+        _url[sizeof(_url) - 1] = '\0';
+
+        if (!load() || strcmp(_state.partition, _partition->label) != 0 ||
+            _state.offset > _state.size || _state.offset % SECTOR_SIZE) {
+            restart();
+        }
+        _erasedTo = _state.offset;
+        return true;
+    }
+
+    // Checks a response against the download in progress. False means it
+    // is a different image, restart() and take it from the beginning.
+    // A size of 0 is unknown, the image then ends wherever writing stops.
+    bool accept(uint32_t size, const char *md5) {
+        if (offset() == 0) {
+            if (size > _partition->size) return fail("Image too large");
+            _state.size = size;
+            strncpy(_state.md5, md5 ? md5 : "", sizeof(_state.md5) - 1);
+            return true;
+        }
+        return size == _state.size && strcmp(md5 ? md5 : "", _state.md5) == 0;
+    }
+
+    // Drops the checkpoint and starts hashing from scratch. Images that
+    // are not downloaded byte for byte, like ones rebuilt from a delta,
+    // cannot be resumed by offset and are not checkpointed.
+    void restart(bool resumable = true) {
+        _resumable = resumable;
+        memset(&_state, 0, sizeof(_state));
+        strncpy(_state.partition, _partition->label,
+                sizeof(_state.partition) - 1);
+        esp_rom_md5_init(&_state.hash);
+        _buffered = 0;
+        _erasedTo = 0;
+        discard();
+    }
+
+    bool write(const uint8_t *data, size_t len) {
+        if (len > _partition->size - offset()) return fail("Image too large");
+        while (len) {
+            size_t n = min((size_t)(SECTOR_SIZE - _buffered), len);
+            memcpy(_buffer + _buffered, data, n);
+            _buffered += n;
+            data += n;
+            len -= n;
+            if (_buffered == SECTOR_SIZE && !flushSector()) return false;
+        }
+        return true;
+    }
+
+    // Erases one sector, or one block when aligned and allowed, ahead of
+    // the data. A block erase stalls both cores for longer, so background
+    // writers stick to sectors. Returns the bytes erased, 0 when all within
+    // ERASE_AHEAD already is.
+    uint32_t eraseAhead(bool blocks = true) {
+        uint32_t end = _state.size ? _state.size : _partition->size;
+        end = min(end, _state.offset + ERASE_AHEAD);
+        if (_erasedTo >= end) return 0;
+
+        uint32_t len = SECTOR_SIZE;
+        if (blocks && _erasedTo % BLOCK_SIZE == 0 &&
+            _erasedTo + BLOCK_SIZE <= end) {
+            len = BLOCK_SIZE;
+        }
+        if (_erasedTo + len > _partition->size) return 0;
+        if (esp_partition_erase_range(_partition, _erasedTo, len) != ESP_OK) {
+            return 0;
+        }
+        _erasedTo += len;
+        return len;
+    }
+
+    // Verifies what was written and makes it the boot partition
+    bool finish() {
+        if (_buffered && !flushSector()) return false;
+        if (_state.size && _state.offset != _state.size) {
+            return fail("Image incomplete");
+        }
+
+        if (_state.md5[0]) {
+            md5_context_t hash = _state.hash;
+            uint8_t digest[ESP_ROM_MD5_DIGEST_LEN];
+            esp_rom_md5_final(digest, &hash);
+
+            char hex[2 * ESP_ROM_MD5_DIGEST_LEN + 1];
+            for (int i = 0; i < ESP_ROM_MD5_DIGEST_LEN; i++) {
+                snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+            }
+            if (strcmp(hex, _state.md5) != 0) return fail("MD5 mismatch");
+        }
+
+        // Also validates the image headers and checksum
+        if (esp_ota_set_boot_partition(_partition) != ESP_OK) {
+            return fail("Image not valid");
+        }
+        discard();
+        return true;
+    }
+
+    void close() {
+        free(_buffer);
+        _buffer = nullptr;
+    }
+
+    // Forgets the saved checkpoint, e.g. when the URL stopped working
+    void discard() {
+        Preferences prefs;
+        if (prefs.begin(NVS_NAMESPACE, false)) {
+            prefs.clear();
+            prefs.end();
+        }
+    }
+
+    // URL of a download that was interrupted before the last reboot
+    static bool pending(String &url) {
+        Preferences prefs;
+        if (!prefs.begin(NVS_NAMESPACE, true)) return false;
+        url = prefs.getString("url", "");
+        prefs.end();
+        return url.length() > 0;
+    }
+
+    uint32_t offset() const { return _state.offset + _buffered; }
+    bool resumable() const { return _resumable; }
+    uint32_t size() const { return _state.size; }
+    const char *error() const { return _error ? _error : "none"; }
+
+   private:
+    static constexpr const char *NVS_NAMESPACE = "ota";
+
+    struct State {
+        uint32_t size;
+        uint32_t offset;  // Written and hashed, sector aligned
+        char md5[33];     // Expected, empty if the server sent none
+        char partition[17];
+        md5_context_t hash;
+    };
+
+    bool flushSector() {
+        uint32_t addr = _state.offset;
+        if (addr >= _erasedTo) {
+            if (esp_partition_erase_range(_partition, addr, SECTOR_SIZE) !=
+                ESP_OK) {
+                return fail("Flash write failed");
+            }
+            _erasedTo = addr + SECTOR_SIZE;
+        }
+        if (esp_partition_write(_partition, addr, _buffer, _buffered) !=
+            ESP_OK) {
+            return fail("Flash write failed");
+        }
+        esp_rom_md5_update(&_state.hash, _buffer, _buffered);
+        _state.offset += _buffered;
+        _buffered = 0;
+
+        if (_resumable &&
+            _state.offset % (SECTOR_SIZE * CHECKPOINT_SECTORS) == 0) {
+            save();
+        }
+        return true;
+    }
+
+    void save() {
+        Preferences prefs;
+        if (!prefs.begin(NVS_NAMESPACE, false)) return;
+        prefs.putString("url", _url);
+        prefs.putBytes("state", &_state, sizeof(_state));
+        prefs.end();
+    }
+
+    bool load() {
+        Preferences prefs;
+        if (!prefs.begin(NVS_NAMESPACE, true)) return false;
+        bool found = prefs.getString("url", "") == _url &&
+                     prefs.getBytes("state", &_state, sizeof(_state)) ==
+                         sizeof(_state);
+        prefs.end();
+        return found;
+    }
+
+    bool fail(const char *error) {
+        _error = error;
+        return false;
+    }
+
+    const esp_partition_t *_partition = nullptr;
+    uint8_t *_buffer = nullptr;
+    size_t _buffered = 0;
+    uint32_t _erasedTo = 0;  // Sectors below this are blank or written
+    State _state = {};
+    bool _resumable = true;
+    char _url[256];
+    const char *_error = nullptr;
+};
+
+constexpr const char *OtaImage::NVS_NAMESPACE;
+
+OtaImage otaImage;
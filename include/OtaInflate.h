@@ -0,0 +1,276 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "esp_rom_crc.h"
+#include "rom/miniz.h"
+
+/*
+ * Streaming gunzip for firmware images.
+ *
+ * Uses the inflater in the ESP32 ROM with one fixed 32 KB window, the
+ * largest back reference deflate allows, so memory use does not depend on
+ * the image size. Decompressed bytes go to the sink as they come out of
+ * the window. The gzip trailer is checked, CRC32 and length, before done()
+ * turns true.
+ *
+ * scripts/compress_image.py stores the image size and MD5 in a gzip extra
+ * field with the ID "SL", so they can be checked before the image is
+ * complete. Plain gzip files work as well, without that early check.
+ */
+
+typedef bool (*OtaInflateSink)(const uint8_t *data, size_t len);
+
+class OtaInflate {
+   public:
+    static const size_t WINDOW_SIZE = TINFL_LZ_DICT_SIZE;
+
+    static bool detect(const uint8_t *data, size_t len) {
+        return len >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+    }
+
+    bool begin(OtaInflateSink sink) {
+        _sink = sink;
+        _state = HEADER;
+        _need = 10;
+        _have = 0;
+        _flags = 0;
+        _imageSize = 0;
+        _imageMd5[0] = '\0';
+        _crc = 0;
+        _length = 0;
+        _windowPos = 0;
+        _error = nullptr;
+
+        if (!_window) _window = (uint8_t *)malloc(WINDOW_SIZE);
+        if (!_inflator) {
+            _inflator = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+        }
+        if (!_window || !_inflator) {
+            end();
+            return fail("Out of memory");
+        }
+        tinfl_init(_inflator);
+        return true;
+    }
+
+    // Frees the window, about 43 KB with the decoder tables
+    void end() {
+        free(_window);
+        free(_inflator);
+        _window = nullptr;
+        _inflator = nullptr;
+    }
+
+    bool write(const uint8_t *data, size_t len) {
+        while (len) {
+            size_t n;
+            switch (_state) {
+                case DEFLATE:
+                    n = len;
+                    if (!inflate(data, n)) return false;
+                    break;
+
+                case SKIP_STRING:
+                    for (n = 0; n < len && data[n];) n++;
+                    if (n < len) {
+                        n++;
+                        nextHeaderField();
+                    }
+                    break;
+
+                case DONE:
+                    return fail("Data after the end of the image");
+
+                default:
+                    n = min(len, _need - _have);
+                    if (_have < sizeof(_field)) {
+                        memcpy(_field + _have, data,
+                               min(n, sizeof(_field) - _have));
+                    }
+                    _have += n;
+                    if (_have == _need && !parseField()) return false;
+                    break;
+            }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    bool done() const { return _state == DONE; }
+
+    // From the "SL" extra field, 0 and "" if the file has none
+    uint32_t imageSize() const { return _imageSize; }
+    const char *imageMd5() const { return _imageMd5; }
+
+    const char *error() const { return _error ? _error : "none"; }
+
+   private:
+    enum State : uint8_t {
+        HEADER,
+        EXTRA_LENGTH,
+        EXTRA,
+        SKIP_STRING,
+        HEADER_CRC,
+        DEFLATE,
+        TRAILER,
+        DONE
+    };
+
+    enum Flag : uint8_t {
+        FHCRC = 0x02,
+        FEXTRA = 0x04,
+        FNAME = 0x08,
+        FCOMMENT = 0x10,
+    };
+
+    bool parseField() {
+        _have = 0;
+        switch (_state) {
+            case HEADER:
+                if (!detect(_field, 2) || _field[2] != 8) {
+                    return fail("Not a gzip deflate stream");
+                }
+                _flags = _field[3];
+                nextHeaderField();
+                return true;
+
+            case EXTRA_LENGTH:
+                _state = EXTRA;
+                _need = _field[0] | _field[1] << 8;
+                if (!_need) nextHeaderField();
+                return true;
+
+            case EXTRA:
+                parseExtra(min(_need, sizeof(_field)));
+                nextHeaderField();
+                return true;
+
+            case HEADER_CRC:
+                _state = DEFLATE;
+                return true;
+
+            case TRAILER:
+                if (u32(_field) != _crc) return fail("Image CRC mismatch");
+                if (u32(_field + 4) != _length) {
+                    return fail("Image length mismatch");
+                }
+                _state = DONE;
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+    // Optional header fields, in the order they follow the fixed part.
+    // Each flag is cleared once its field is under way.
+    void nextHeaderField() {
+        _have = 0;
+        _need = 0;
+        if (_flags & FEXTRA) {
+            _flags &= ~FEXTRA;
+            _state = EXTRA_LENGTH;
+            _need = 2;
+        } else if (_flags & (FNAME | FCOMMENT)) {
+            _flags &= (_flags & FNAME) ? ~FNAME : ~FCOMMENT;
+            _state = SKIP_STRING;
+        } else if (_flags & FHCRC) {
+            _flags &= ~FHCRC;
+            _state = HEADER_CRC;
+            _need = 2;
+        } else {
+            _state = DEFLATE;
+        }
+    }
+
+    // Subfields are ID (2) | length (2) | data, "SL" holds size and MD5
+    void parseExtra(size_t len) {
+        size_t pos = 0;
+        while (pos + 4 <= len) {
+            size_t n = _field[pos + 2] | _field[pos + 3] << 8;
+            const uint8_t *sub = _field + pos + 4;
+            if (pos + 4 + n > len) break;
+            if (_field[pos] == 'S' && _field[pos + 1] == 'L' && n == 20) {
+                _imageSize = u32(sub);
+                for (int i = 0; i < 16; i++) {
+                    snprintf(_imageMd5 + 2 * i, 3, "%02x", sub[4 + i]);
+                }
+            }
+            pos += 4 + n;
+        }
+    }
+
+    // Consumes all of data, or up to the end of the deflate stream
+    bool inflate(const uint8_t *data, size_t &len) {
+        size_t used = 0;
+        for (;;) {
+            size_t in = len - used;
+            size_t out = WINDOW_SIZE - _windowPos;
+            tinfl_status status = tinfl_decompress(
+                _inflator, data + used, &in, _window, _window + _windowPos,
+                &out, TINFL_FLAG_HAS_MORE_INPUT);
+            used += in;
+
+            if (out) {
+                const uint8_t *produced = _window + _windowPos;
+                _crc = esp_rom_crc32_le(_crc, produced, out);
+                _length += out;
+                _windowPos = (_windowPos + out) & (WINDOW_SIZE - 1);
+                if (!_sink(produced, out)) return fail(nullptr);
+            }
+
+            if (status == TINFL_STATUS_DONE) {
+                _state = TRAILER;
+                _need = 8;
+                _have = 0;
+                returnLookahead();
+                if (_have == _need && !parseField()) return false;
+                break;
+            }
+            if (status < 0) return fail("Corrupt compressed image");
+            if (status == TINFL_STATUS_NEEDS_MORE_INPUT) break;
+        }
+        len = used;
+        return true;
+    }
+
+    // The decoder may have pulled whole trailer bytes into its bit buffer
+    void returnLookahead() {
+        uint32_t bits = _inflator->m_num_bits;
+        uint64_t buf = (uint64_t)_inflator->m_bit_buf >> (bits & 7);
+        for (bits >>= 3; bits && _have < _need; bits--, buf >>= 8) {
+            _field[_have++] = buf & 0xFF;
+        }
+    }
+
+    // A null error means the sink failed and has its own
+    bool fail(const char *error) {
+        _error = error;
+        return false;
+    }
+
+    static uint32_t u32(const uint8_t *p) {
+        return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    OtaInflateSink _sink = nullptr;
+    State _state = DONE;
+    uint8_t _flags = 0;
+    uint8_t _field[64];
+    size_t _need = 0;
+    size_t _have = 0;
+    uint32_t _imageSize = 0;
+    char _imageMd5[33] = "";
+    uint32_t _crc = 0;
+    uint32_t _length = 0;
+    uint8_t *_window = nullptr;
+    size_t _windowPos = 0;
+    tinfl_decompressor *_inflator = nullptr;
+    const char *_error = nullptr;
+};
+
+const size_t OtaInflate::WINDOW_SIZE;
+
+OtaInflate otaInflate;
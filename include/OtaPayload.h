@@ -0,0 +1,143 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "OtaDelta.h"
+#include "OtaImage.h"
+#include "OtaInflate.h"
+
+/*
+ * Works out what an OTA download holds from its first bytes and routes
+ * it to otaImage: a plain image, a delta patch (OtaDelta.h), or either of
+ * those gzipped (OtaInflate.h). Both the HTTP download and the portal
+ * upload feed their bytes through here.
+ *
+ * Compressed and delta downloads are rebuilt rather than copied, so they
+ * cannot be resumed by offset and otaImage is told not to checkpoint them.
+ */
+
+class OtaPayload {
+   public:
+    // size and md5 describe a plain image as the transport announced it,
+    // 0 and null when unknown. Compressed images carry their own.
+    void begin(uint32_t size, const char *md5) {
+        _size = size;
+        strncpy(_md5, md5 ? md5 : "", sizeof(_md5) - 1);
+        _md5[sizeof(_md5) - 1] = '\0';
+        _outerHave = 0;
+        _innerHave = 0;
+        _outer = UNKNOWN;
+        _inner = UNKNOWN;
+        _error = nullptr;
+    }
+
+    bool write(const uint8_t *data, size_t len) {
+        if (_outer == UNKNOWN) {
+            if (!take(_outerHead, _outerHave, 2, data, len)) return true;
+            if (OtaInflate::detect(_outerHead, 2)) {
+                _outer = GZIP;
+                otaImage.restart(false);
+                if (!otaInflate.begin(inflated)) return fail(otaInflate.error());
+            } else {
+                _outer = PLAIN;
+            }
+            if (!forward(_outerHead, _outerHave)) return false;
+        }
+        return forward(data, len);
+    }
+
+    // Checks the whole payload arrived and frees the decompressor
+    bool finish() {
+        bool complete = false;
+        if (_inner == UNKNOWN) {
+            fail("Image too short");
+        } else if (_outer == GZIP && !otaInflate.done()) {
+            fail("Compressed image ended early");
+        } else if (_inner == DELTA && !otaDelta.done()) {
+            fail("Delta patch ended early");
+        } else {
+            complete = true;
+        }
+        close();
+        return complete;
+    }
+
+    void close() { otaInflate.end(); }
+
+    bool compressed() const { return _outer == GZIP; }
+    bool delta() const { return _inner == DELTA; }
+    bool baseMismatch() const { return delta() && otaDelta.baseMismatch(); }
+
+    const char *error() const { return _error ? _error : "none"; }
+
+   private:
+    enum Kind : uint8_t { UNKNOWN, PLAIN, GZIP, DELTA };
+
+    static bool inflated(const uint8_t *data, size_t len);
+
+    bool forward(const uint8_t *data, size_t len) {
+        if (_outer == PLAIN) return route(data, len);
+        if (otaInflate.write(data, len)) return true;
+        // A sink failure already set the error
+        return _error ? false : fail(otaInflate.error());
+    }
+
+    // Decompressed or plain bytes, a patch or an image
+    bool route(const uint8_t *data, size_t len) {
+        if (_inner == UNKNOWN) {
+            if (!take(_innerHead, _innerHave, 4, data, len)) return true;
+            if (OtaDelta::detect(_innerHead, 4)) {
+                _inner = DELTA;
+                otaImage.restart(false);
+                otaDelta.begin();
+            } else {
+                _inner = PLAIN;
+                bool ok = compressed()
+                              ? otaImage.accept(otaInflate.imageSize(),
+                                                otaInflate.imageMd5())
+                              : otaImage.accept(_size, _md5);
+                if (!ok) return fail(otaImage.error());
+            }
+            if (!store(_innerHead, _innerHave)) return false;
+        }
+        return store(data, len);
+    }
+
+    bool store(const uint8_t *data, size_t len) {
+        if (_inner == DELTA) {
+            return otaDelta.write(data, len) || fail(otaDelta.error());
+        }
+        return otaImage.write(data, len) || fail(otaImage.error());
+    }
+
+    // Collects the first bytes, true once there are enough to tell
+    static bool take(uint8_t *head, uint8_t &have, uint8_t want,
+                     const uint8_t *&data, size_t &len) {
+        while (have < want && len) {
+            head[have++] = *data++;
+            len--;
+        }
+        return have == want;
+    }
+
+    bool fail(const char *error) {
+        _error = error;
+        return false;
+    }
+
+    uint32_t _size = 0;
+    char _md5[33] = "";
+    uint8_t _outerHead[2];
+    uint8_t _outerHave = 0;
+    uint8_t _innerHead[4];
+    uint8_t _innerHave = 0;
+    Kind _outer = UNKNOWN;
+    Kind _inner = UNKNOWN;
+    const char *_error = nullptr;
+};
+
+OtaPayload otaPayload;
+
+bool OtaPayload::inflated(const uint8_t *data, size_t len) {
+    return otaPayload.route(data, len);
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "OtaImage.h"
+#include "OtaPayload.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+/*
+ * Overlaps receiving an OTA download with writing it to flash.
+ *
+ * The receiving task - the OTA task for a download, the web server for a
+ * portal upload - copies what it reads into one of SLOTS buffers and goes
+ * straight back to the network. A writer task takes full buffers in order
+ * and feeds them to otaPayload, or to otaImage for a resumed plain image,
+ * so sector erases and decoding no longer hold up the TCP window. While
+ * the writer waits for data it erases ahead with otaImage.eraseAhead().
+ *
+ * Stats report where time went: the receiver waiting for a free buffer
+ * means flash was the bottleneck, the writer waiting for data means the
+ * network was.
+ */
+
+struct OtaPipelineStats {
+    uint32_t bytes;
+    uint32_t elapsedMs;
+    uint32_t receiverStallMs;  // Waiting for a free buffer
+    uint32_t writerStallMs;    // Waiting for data, after erasing ahead
+    uint32_t erasedAhead;      // Bytes erased before their data came
+
+    uint32_t kbPerSecond() const {
+        return elapsedMs ? (uint64_t)bytes * 1000 / 1024 / elapsedMs : 0;
+    }
+
+    String summary() const {
+        // Fits the text with all six numbers at ten digits
+        char buff[160];
+        snprintf(buff, sizeof(buff),
+                 "%lu bytes in %lu ms, %lu KB/s, %lu ms waiting for flash, "
+                 "%lu ms waiting for network, %lu KB erased ahead",
+                 (unsigned long)bytes, (unsigned long)elapsedMs,
+                 (unsigned long)kbPerSecond(), (unsigned long)receiverStallMs,
+                 (unsigned long)writerStallMs,
+                 (unsigned long)erasedAhead / 1024);
+        return buff;
+    }
+};
+
+class OtaPipeline {
+   public:
+    static const uint8_t SLOTS = 3;
+    static const size_t SLOT_SIZE = OtaImage::SECTOR_SIZE;
+
+    // payload routes data through otaPayload, otherwise straight into
+    // otaImage. Both must be set up already. A background writer runs at
+    // idle priority and erases a sector at a time.
+    bool begin(bool payload, bool background = false) {
+        _payload = payload;
+        _background = background;
+        _failed = false;
+        _error = nullptr;
+        _current = -1;
+        _fill = 0;
+        _stats = {};
+        _start = millis();
+
+        for (uint8_t i = 0; i < SLOTS; i++) {
+            if (!_slots[i]) _slots[i] = (uint8_t *)malloc(SLOT_SIZE);
+            if (!_slots[i]) {
+                end();
+                return fail("Out of memory");
+            }
+        }
+        if (!_free) _free = xQueueCreate(SLOTS, sizeof(int8_t));
+        if (!_full) _full = xQueueCreate(SLOTS + 1, sizeof(Filled));
+        if (!_done) _done = xSemaphoreCreateBinary();
+        if (!_free || !_full || !_done) {
+            end();
+            return fail("Out of memory");
+        }
+        xQueueReset(_free);
+        xQueueReset(_full);
+        for (int8_t i = 0; i < SLOTS; i++) xQueueSend(_free, &i, 0);
+
+        if (xTaskCreatePinnedToCore(writerTask, "OtaWriter", 6144, this,
+                                    background ? tskIDLE_PRIORITY : 1, NULL,
+                                    0) != pdPASS) {
+            end();
+            return fail("Out of memory");
+        }
+        return true;
+    }
+
+    // Copies data into the buffers, waiting while all of them are full.
+    // False once the writer has failed, the rest is not worth reading.
+    bool push(const uint8_t *data, size_t len) {
+        while (len) {
+            if (_failed) return false;
+            if (_current < 0) {
+                if (xQueueReceive(_free, &_current, 0) != pdTRUE) {
+                    uint32_t waitStart = millis();
+                    xQueueReceive(_free, &_current, portMAX_DELAY);
+                    _stats.receiverStallMs += millis() - waitStart;
+                }
+                _fill = 0;
+            }
+            size_t n = min(len, SLOT_SIZE - _fill);
+            memcpy(_slots[_current] + _fill, data, n);
+            _fill += n;
+            data += n;
+            len -= n;
+            if (_fill == SLOT_SIZE) send();
+        }
+        return !_failed;
+    }
+
+    // Hands over the last partial buffer and waits for the writer to
+    // finish. Called on every way out, also after a dropped connection.
+    bool finish() {
+        if (_current >= 0) send();
+        Filled last = {-1, 0};
+        xQueueSend(_full, &last, portMAX_DELAY);
+        xSemaphoreTake(_done, portMAX_DELAY);
+        _stats.elapsedMs = millis() - _start;
+        return !_failed;
+    }
+
+    // Frees the buffers, the queues are kept for the next download
+    void end() {
+        for (uint8_t i = 0; i < SLOTS; i++) {
+            free(_slots[i]);
+            _slots[i] = nullptr;
+        }
+    }
+
+    const OtaPipelineStats &stats() const { return _stats; }
+    const char *error() const { return _error ? _error : "none"; }
+
+   private:
+    struct Filled {
+        int8_t slot;  // -1 ends the download
+        uint16_t len;
+    };
+
+    void send() {
+        Filled filled = {_current, (uint16_t)_fill};
+        _stats.bytes += _fill;
+        xQueueSend(_full, &filled, portMAX_DELAY);
+        _current = -1;
+        _fill = 0;
+    }
+
+    void write(const Filled &filled) {
+        // After a failure the rest is only drained
+        if (_failed) return;
+        const uint8_t *data = _slots[filled.slot];
+        bool ok = _payload ? otaPayload.write(data, filled.len)
+                           : otaImage.write(data, filled.len);
+        if (!ok) {
+            _error = _payload ? otaPayload.error() : otaImage.error();
+            _failed = true;
+        }
+    }
+
+    static void writerTask(void *parameter) {
+        OtaPipeline *self = static_cast<OtaPipeline *>(parameter);
+        for (;;) {
+            Filled filled;
+            if (xQueueReceive(self->_full, &filled, 0) != pdTRUE) {
+                uint32_t erased =
+                    self->_failed ? 0 : otaImage.eraseAhead(!self->_background);
+                if (erased) {
+                    self->_stats.erasedAhead += erased;
+                    continue;
+                }
+                uint32_t waitStart = millis();
+                xQueueReceive(self->_full, &filled, portMAX_DELAY);
+                self->_stats.writerStallMs += millis() - waitStart;
+            }
+            if (filled.slot < 0) break;
+
+            self->write(filled);
+            xQueueSend(self->_free, &filled.slot, 0);
+        }
+        xSemaphoreGive(self->_done);
+        vTaskDelete(NULL);
+    }
+
+    bool fail(const char *error) {
+        _error = error;
+        return false;
+    }
+
+    uint8_t *_slots[SLOTS] = {};
+    QueueHandle_t _free = NULL;  // Slot numbers ready to fill
+    QueueHandle_t _full = NULL;  // Filled slots, in download order
+    SemaphoreHandle_t _done = NULL;
+    int8_t _current = -1;
+    size_t _fill = 0;
+    bool _payload = false;
+    bool _background = false;
+    volatile bool _failed = false;
+    const char *_error = nullptr;
+    uint32_t _start = 0;
+    OtaPipelineStats _stats = {};
+};
+
+const size_t OtaPipeline::SLOT_SIZE;
+
+OtaPipeline otaPipeline;
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Byte-rate cap for a background download.
+ *
+ * consumed() is called after every chunk. Ahead of the budget it sleeps
+ * until the average is back at the cap, otherwise it still yields, so the
+ * download never holds the CPU across chunks. A link that fell behind
+ * does not earn more than MAX_CREDIT_MS of catch-up burst.
+ */
+
+class OtaThrottle {
+   public:
+    static const uint32_t MAX_CREDIT_MS = 1000;
+
+    // 0 leaves the rate alone and only yields
+    void begin(uint32_t bytesPerSecond) {
+        _rate = bytesPerSecond;
+        _start = millis();
+        _bytes = 0;
+        _sleptMs = 0;
+    }
+
+    void consumed(size_t len) {
+        _bytes += len;
+        if (!_rate) {
+            taskYIELD();
+            return;
+        }
+
+        uint32_t elapsed = millis() - _start;
+        uint32_t due = (uint64_t)_bytes * 1000 / _rate;
+        if (due > elapsed) {
+            vTaskDelay(pdMS_TO_TICKS(due - elapsed));
+            _sleptMs += due - elapsed;
+            return;
+        }
+        if (elapsed - due > MAX_CREDIT_MS) {
+            // Forget the stall, count from here at the capped rate
+            _start = millis();
+            _bytes = 0;
+        }
+        taskYIELD();
+    }
+
+    uint32_t rate() const { return _rate; }
+    uint32_t sleptMs() const { return _sleptMs; }
+
+   private:
+    uint32_t _rate = 0;
+    uint32_t _start = 0;
+    uint32_t _bytes = 0;
+    uint32_t _sleptMs = 0;
+};
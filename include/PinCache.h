@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <mutex>
+
+#include "mbedtls/sha256.h"
+
+/*
+ * RAM copy of the door PIN for the keypad hot path.
+ *
+ * Only SHA-256(salt || pin) is kept, never the digits. The salt is drawn
+ * from the hardware RNG once per boot and mbedtls runs SHA-256 on the
+ * ESP32's SHA accelerator, so a verification costs one hash block and a
+ * constant-time compare - no NVS access.
+ */
+
+class PinCache {
+   public:
+    static const size_t SALT_SIZE = 16;
+    static const size_t HASH_SIZE = 32;
+
+    // Replaces the cached credential, e.g. after the PIN was saved
+    void set(const String &pin) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_salted) {
+            esp_fill_random(_salt, sizeof(_salt));
+            _salted = true;
+        }
+        digest(pin, _hash);
+        _valid = true;
+    }
+
+    bool verify(const String &pin) {
+        uint8_t hash[HASH_SIZE];
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_valid) return false;
+
+        digest(pin, hash);
+        // Touch every byte so timing does not reveal the matching prefix
+        uint8_t diff = 0;
+        for (size_t i = 0; i < HASH_SIZE; i++) {
+            diff |= hash[i] ^ _hash[i];
+        }
+        return diff == 0;
+    }
+
+   private:
+    void digest(const String &pin, uint8_t *out) {
+        mbedtls_sha256_context ctx;
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_starts_ret(&ctx, 0);
+        mbedtls_sha256_update_ret(&ctx, _salt, sizeof(_salt));
+        mbedtls_sha256_update_ret(&ctx, (const uint8_t *)pin.c_str(),
+                                  pin.length());
+        mbedtls_sha256_finish_ret(&ctx, out);
+        mbedtls_sha256_free(&ctx);
+    }
+
+    std::mutex _mutex;
+    uint8_t _salt[SALT_SIZE];
+    uint8_t _hash[HASH_SIZE];
+    bool _salted = false;
+    bool _valid = false;
+};
+
+PinCache pinCache;
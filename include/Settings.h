@@ -114,6 +114,9 @@
 
 #define WIFI_CLOUD_MAX_RETRIES 500
 #define WIFI_NET_CONNECT_TIMEOUT 50000
+#define WIFI_FAST_CONNECT_TIMEOUT 4000  // Rejoin with the cached BSSID
+#define WIFI_BACKOFF_MIN 1000  // After the first failed attempt
+#define WIFI_BACKOFF_MAX 60000
 #define WIFI_CLOUD_CONNECT_TIMEOUT 50000
 #define WIFI_AP_IP IPAddress(192, 168, 4, 1)
 #define WIFI_AP_Subnet IPAddress(255, 255, 255, 0)
@@ -52,6 +52,8 @@ extern "C" {
   #endif
 }
 
+#include "CoreDumpExport.h"
+
 static char BASE64[65] PROGMEM = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 class Base64Writer
@@ -324,6 +326,60 @@ private:
   uint32_t _magic;
 } systemStats;
 
+// Where the last WiFi connection ended up, so a reboot can rejoin without
+// a scan and without DHCP. Like SystemStats it only survives a reset.
+BLYNK_NOINIT_ATTR
+class NetCache {
+public:
+  uint32_t key;       // Identifies the SSID and password it belongs to
+  uint8_t  bssid[6];
+  uint8_t  channel;   // 0 when there is nothing cached
+  bool     hasLease;  // false when the IP was configured statically
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t mask;
+  uint32_t dns;
+  uint32_t dns2;
+
+  struct {
+    uint32_t tried;
+    uint32_t failed;
+  } fastJoins;
+
+public:
+  NetCache() {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    if (_magic != expectedMagic()) {
+      clear();
+    }
+#pragma GCC diagnostic pop
+  }
+
+  void clear() {
+    memset(this, 0, sizeof(NetCache));
+    _magic = expectedMagic();
+  }
+
+  bool valid(uint32_t forKey) const {
+    return channel && key == forKey;
+  }
+
+  // Keeps the counters
+  void forget() {
+    channel = 0;
+    hasLease = false;
+  }
+
+private:
+  static uint32_t expectedMagic() {
+    return (MAGIC + __LINE__ + sizeof(NetCache));
+  }
+  static const uint32_t MAGIC = 0x6e657463;
+  uint32_t _magic;
+} netCache;
+
 static inline
 uint64_t systemUptime() {
 #if defined(ESP32)
@@ -404,37 +460,32 @@ bool systemHasCoreDump()
   return (esp_core_dump_image_get(&address, &size) == ESP_OK);
 }
 
+// Base64 of the image, or of its gzip stream. The UART paces the output,
+// so there is no need to pause between lines.
 static
-void systemPrintCoreDump(Stream& stream)
+void systemPrintCoreDump(Stream& stream, bool gzip = false)
 {
-  size_t size = 0;
-  size_t address = 0;
-  if (esp_core_dump_image_get(&address, &size) == ESP_OK) {
-    const esp_partition_t* pt = NULL;
-    pt = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, "coredump");
-    if (pt) {
-      uint8_t bf[256];
-      Base64Writer b64(stream);
-      b64.setWidth(120);
-      b64.setDelay(10);
-
-      stream.println(F("================= CORE DUMP START ================="));
-      for (int16_t i = 0; i < (size / 256) + 1; i++) {
-        int16_t toRead = (size - i * 256) > 256 ? 256 : (size - i * 256);
-        esp_err_t er = esp_partition_read(pt, i * 256, bf, toRead);
-        if (er == ESP_OK) {
-          b64.write(bf, 256);
-        } else {
-          stream.printf("FAIL [%x]\n",er);
-        }
-      }
-      b64.flush();
-      stream.println(F("\n================= CORE DUMP END ==================="));
-    } else {
-      stream.println(F("Partition NULL"));
-    }
+  CoreDumpExport dump;
+  if (!dump.begin()) {
+    stream.println(dump.error());
+    return;
+  }
+
+  stream.println(F("================= CORE DUMP START ================="));
+  bool ok;
+  {
+    Base64Writer b64(stream);
+    b64.setWidth(120);
+    ok = dump.send(b64, gzip);
+  }
+  stream.println(F("\n================= CORE DUMP END ==================="));
+  if (ok) {
+    stream.printf("%lu bytes, CRC32 %08lx, %lu bytes %s in %lu ms\n",
+                  (unsigned long)dump.size(), (unsigned long)dump.crc(),
+                  (unsigned long)dump.sent(), gzip ? "gzipped" : "raw",
+                  (unsigned long)dump.elapsedMs());
   } else {
-    stream.println(F("No coredump found"));
+    stream.printf("FAIL [%s]\n", dump.error());
   }
 }
 
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+
+#include "DnsCache.h"
+#include "esp_arduino_version.h"
+#include "esp_rom_crc.h"
+#include "lwip/sockets.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+
+/*
+ * WiFiClientSecure that resumes TLS sessions.
+ *
+ * The stock client runs a full handshake on every connect: certificate
+ * chain, key exchange and two round trips. This one sets up the connection
+ * the same way ssl_client.cpp does, but offers the session of the last
+ * connection to the same host, by ticket or session ID, so the server can
+ * skip all of that. The session is kept in RAM and serialized to noinit
+ * memory, so it also survives a soft reboot.
+ *
+ * The host name goes through dnsCache, so a reconnect skips the lookup.
+ *
+ * Only connect() is replaced. Reads, writes and stop() are the stock ones
+ * and work on the sslclient context set up here.
+ *
+ * The stock start_ssl_client() runs the handshake in the same call as the
+ * setup, which leaves no point to offer a session, so openSocket(),
+ * setupTls() and handshake() follow ssl_client.cpp and use its
+ * sslclient_context, handshake_timeout and _CA_cert. They are written
+ * against the arduino-esp32 release pinned in platformio.ini, and the
+ * build stops on any other one until they have been compared again.
+ */
+
+#if !defined(ESP_ARDUINO_VERSION) || \
+    ESP_ARDUINO_VERSION != ESP_ARDUINO_VERSION_VAL(2, 0, 14)
+#error "TlsResume.h mirrors ssl_client.cpp of arduino-esp32 2.0.14, check it against this core"
+#endif
+
+struct TlsStats {
+    uint32_t handshakes;
+    uint32_t offered;  // With a cached session
+    uint32_t resumed;  // Accepted by the server
+    uint32_t fullMs;   // Total over full handshakes
+    uint32_t resumedMs;
+    uint32_t lastMs;
+
+    uint32_t hitRate() const { return offered ? resumed * 100 / offered : 0; }
+    uint32_t fullAvgMs() const {
+        return (handshakes > resumed) ? fullMs / (handshakes - resumed) : 0;
+    }
+    uint32_t resumedAvgMs() const {
+        return resumed ? resumedMs / resumed : 0;
+    }
+};
+
+// Serialized session, checked by key and CRC before use
+struct TlsSessionStore {
+    static const uint32_t MAGIC = 0x544c5331;  // "TLS1"
+    static const size_t SIZE = 2048;  // Includes the peer certificate
+
+    uint32_t magic;
+    uint32_t key;
+    uint32_t crc;
+    uint32_t len;
+    uint8_t data[SIZE];
+};
+
+BLYNK_NOINIT_ATTR TlsSessionStore tlsSessionStore;
+
+class TlsResumeClient : public WiFiClientSecure {
+   public:
+    static const uint32_t CONNECT_TIMEOUT_MS = 10000;
+
+    TlsResumeClient() { mbedtls_ssl_session_init(&_session); }
+
+    using WiFiClientSecure::connect;
+
+    int connect(IPAddress ip, uint16_t port) override {
+        return connectTo(ip, port, nullptr);
+    }
+
+    int connect(const char *host, uint16_t port) override {
+        IPAddress ip;
+        if (!dnsCache.resolve(host, ip)) return 0;
+        return connectTo(ip, port, host);
+    }
+
+    // Next connect does a full handshake
+    void forgetSession() {
+        mbedtls_ssl_session_free(&_session);
+        mbedtls_ssl_session_init(&_session);
+        _haveSession = false;
+        tlsSessionStore.magic = 0;
+    }
+
+    const TlsStats &stats() const { return _stats; }
+
+   private:
+    int connectTo(IPAddress ip, uint16_t port, const char *host) {
+        stop();
+        uint32_t key = sessionKey(ip, port, host);
+        uint32_t start = millis();
+
+        bool offered = false;
+        int ret = openSocket(ip, port);
+        if (!ret) ret = setupTls(host);
+        if (!ret) {
+            offered = offerSession(key);
+            ret = handshake();
+        }
+        if (ret) {
+            _lastError = ret;
+            DEBUG_PRINT(String("TLS connect failed: ") + ret);
+            // A session the server chokes on is not worth offering again
+            if (offered) forgetSession();
+            stop();
+            return 0;
+        }
+
+        // A resumed session keeps the master secret it was cached with
+        bool resumed = offered && !memcmp(sslclient->ssl_ctx.session->master,
+                                          _session.master,
+                                          sizeof(_session.master));
+        uint32_t ms = millis() - start;
+        _stats.handshakes++;
+        _stats.lastMs = ms;
+        if (offered) _stats.offered++;
+        if (resumed) {
+            _stats.resumed++;
+            _stats.resumedMs += ms;
+        } else {
+            _stats.fullMs += ms;
+        }
+        DEBUG_PRINT(String("TLS handshake ") + ms + " ms" +
+                    (resumed ? ", resumed" : ""));
+
+        keepSession(key);
+        _connected = true;
+        return 1;
+    }
+
+    int openSocket(IPAddress ip, uint16_t port) {
+        int fd = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sslclient->socket = fd;
+        if (fd < 0) return -1;
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = ip;
+        addr.sin_port = htons(port);
+        if (lwip_connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 &&
+            errno != EINPROGRESS) {
+            return -1;
+        }
+
+        fd_set fdset;
+        FD_ZERO(&fdset);
+        FD_SET(fd, &fdset);
+        struct timeval tv = {CONNECT_TIMEOUT_MS / 1000,
+                             (CONNECT_TIMEOUT_MS % 1000) * 1000};
+        if (select(fd + 1, nullptr, &fdset, nullptr, &tv) <= 0) return -1;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            return -1;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+
+        int enable = 1;
+        lwip_setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        lwip_setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        lwip_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        lwip_setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+        return 0;
+    }
+
+    int setupTls(const char *host) {
+        static const char pers[] = "smartlock-tls";
+        sslclient_context *ctx = sslclient;
+        mbedtls_ssl_init(&ctx->ssl_ctx);
+        mbedtls_ssl_config_init(&ctx->ssl_conf);
+        mbedtls_ctr_drbg_init(&ctx->drbg_ctx);
+        mbedtls_entropy_init(&ctx->entropy_ctx);
+        // Freed by stop() whether it was used or not
+        mbedtls_x509_crt_init(&ctx->ca_cert);
+
+        int ret = mbedtls_ctr_drbg_seed(&ctx->drbg_ctx, mbedtls_entropy_func,
+                                        &ctx->entropy_ctx,
+                                        (const unsigned char *)pers,
+                                        strlen(pers));
+        if (ret) return ret;
+        ret = mbedtls_ssl_config_defaults(
+            &ctx->ssl_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+            MBEDTLS_SSL_PRESET_DEFAULT);
+        if (ret) return ret;
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+        mbedtls_ssl_conf_session_tickets(&ctx->ssl_conf,
+                                         MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+        if (!_CA_cert) return -1;
+        ret = mbedtls_x509_crt_parse(&ctx->ca_cert,
+                                     (const unsigned char *)_CA_cert,
+                                     strlen(_CA_cert) + 1);
+        if (ret) return ret;
+        mbedtls_ssl_conf_ca_chain(&ctx->ssl_conf, &ctx->ca_cert, NULL);
+        mbedtls_ssl_conf_authmode(&ctx->ssl_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+
+        mbedtls_ssl_conf_rng(&ctx->ssl_conf, mbedtls_ctr_drbg_random,
+                             &ctx->drbg_ctx);
+        ret = mbedtls_ssl_setup(&ctx->ssl_ctx, &ctx->ssl_conf);
+        if (ret) return ret;
+        if (host) {
+            ret = mbedtls_ssl_set_hostname(&ctx->ssl_ctx, host);
+            if (ret) return ret;
+        }
+        mbedtls_ssl_set_bio(&ctx->ssl_ctx, &ctx->socket, mbedtls_net_send,
+                            mbedtls_net_recv, NULL);
+        return 0;
+    }
+
+    int handshake() {
+        uint32_t start = millis();
+        int ret;
+        while ((ret = mbedtls_ssl_handshake(&sslclient->ssl_ctx)) != 0) {
+            if (ret != MBEDTLS_ERR_SSL_WANT_READ &&
+                ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+                return ret;
+            }
+            if (millis() - start > sslclient->handshake_timeout) return -1;
+            vTaskDelay(2);
+        }
+        if (mbedtls_ssl_get_verify_result(&sslclient->ssl_ctx)) return -1;
+        return 0;
+    }
+
+    bool offerSession(uint32_t key) {
+        if (!(_haveSession && _sessionKey == key) && !loadSession(key)) {
+            return false;
+        }
+        return mbedtls_ssl_set_session(&sslclient->ssl_ctx, &_session) == 0;
+    }
+
+    void keepSession(uint32_t key) {
+        mbedtls_ssl_session_free(&_session);
+        mbedtls_ssl_session_init(&_session);
+        _haveSession =
+            mbedtls_ssl_get_session(&sslclient->ssl_ctx, &_session) == 0;
+        _sessionKey = key;
+        if (!_haveSession) return;
+
+        size_t len = 0;
+        if (mbedtls_ssl_session_save(&_session, tlsSessionStore.data,
+                                     sizeof(tlsSessionStore.data), &len)) {
+            // Too big for the store, RAM only
+            tlsSessionStore.magic = 0;
+            return;
+        }
+        tlsSessionStore.key = key;
+        tlsSessionStore.len = len;
+        tlsSessionStore.crc = esp_rom_crc32_le(0, tlsSessionStore.data, len);
+        tlsSessionStore.magic = TlsSessionStore::MAGIC;
+    }
+
+    // From before a soft reboot
+    bool loadSession(uint32_t key) {
+        const TlsSessionStore &store = tlsSessionStore;
+        if (store.magic != TlsSessionStore::MAGIC || store.key != key ||
+            store.len > sizeof(store.data) ||
+            esp_rom_crc32_le(0, store.data, store.len) != store.crc) {
+            return false;
+        }
+        mbedtls_ssl_session_free(&_session);
+        mbedtls_ssl_session_init(&_session);
+        _haveSession = mbedtls_ssl_session_load(&_session, store.data,
+                                                store.len) == 0;
+        _sessionKey = key;
+        return _haveSession;
+    }
+
+    static uint32_t sessionKey(IPAddress ip, uint16_t port, const char *host) {
+        uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&port, sizeof(port));
+        if (host) {
+            return esp_rom_crc32_le(crc, (const uint8_t *)host, strlen(host));
+        }
+        uint32_t addr = ip;
+        return esp_rom_crc32_le(crc, (const uint8_t *)&addr, sizeof(addr));
+    }
+
+    mbedtls_ssl_session _session;
+    bool _haveSession = false;
+    uint32_t _sessionKey = 0;
+    TlsStats _stats = {};
+};
+
+TlsResumeClient blynkTlsClient;
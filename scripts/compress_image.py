@@ -0,0 +1,57 @@
+"""
+Gzips a firmware image or delta patch for OTA.
+
+    python3 scripts/compress_image.py .pio/build/esp32/firmware.bin
+
+writes firmware.bin.gz next to it. Any gzip file can be sent to the
+device, this one also carries the uncompressed size and MD5 in an "SL"
+extra field, see include/OtaInflate.h, so the device can check the image
+fits and verify it without trusting the transfer headers.
+"""
+
+import argparse
+import hashlib
+import struct
+import zlib
+
+
+def compress(data, name=b""):
+    extra = b"SL" + struct.pack("<H", 20)
+    extra += struct.pack("<I", len(data)) + hashlib.md5(data).digest()
+
+    flags = 0x04 | (0x08 if name else 0)  # FEXTRA, FNAME
+    out = bytearray(b"\x1f\x8b\x08")
+    out += struct.pack("<BIBB", flags, 0, 2, 255)  # mtime 0, best, unknown OS
+    out += struct.pack("<H", len(extra)) + extra
+    if name:
+        out += name + b"\0"
+
+    deflate = zlib.compressobj(9, zlib.DEFLATED, -15, 9)
+    out += deflate.compress(data) + deflate.flush()
+    out += struct.pack("<II", zlib.crc32(data), len(data) & 0xFFFFFFFF)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("image")
+    parser.add_argument("output", nargs="?", help="defaults to <image>.gz")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        data = f.read()
+    name = args.image.replace("\\", "/").rsplit("/", 1)[-1].encode()
+    packed = compress(data, name)
+    if zlib.decompress(packed, 31) != data:
+        raise SystemExit("compressed image does not round trip")
+
+    output = args.output or args.image + ".gz"
+    with open(output, "wb") as f:
+        f.write(packed)
+    print("%s: %d -> %d bytes (%.0f%%), MD5 %s" %
+          (output, len(data), len(packed), 100.0 * len(packed) / len(data),
+           hashlib.md5(data).hexdigest()))
+
+
+if __name__ == "__main__":
+    main()
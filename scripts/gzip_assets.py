@@ -0,0 +1,93 @@
+"""
+Gzips the provisioning portal assets.
+
+As a PlatformIO pre-script it stages data/ into the build directory with
+text assets replaced by .gz files, so `pio run -t buildfs` packs the
+compressed copies, and refreshes include/ConfigForm.h when
+portal/config.html changed. Run it directly to only regenerate the header:
+
+    python3 scripts/gzip_assets.py
+"""
+
+import gzip
+import os
+import shutil
+import zlib
+
+COMPRESSED_TYPES = (".html", ".htm", ".css", ".js", ".json", ".svg", ".txt")
+
+
+def compress(data):
+    # mtime=0 keeps the output, and so the ETag, stable between builds
+    return gzip.compress(data, compresslevel=9, mtime=0)
+
+
+def write_form_header(project_dir):
+    source = os.path.join(project_dir, "portal", "config.html")
+    header = os.path.join(project_dir, "include", "ConfigForm.h")
+    if (os.path.exists(header) and
+            os.path.getmtime(header) >= os.path.getmtime(source)):
+        return
+
+    with open(source, "rb") as f:
+        html = f.read()
+    packed = compress(html)
+
+    lines = [
+        "#pragma once",
+        "",
+        "// Generated by scripts/gzip_assets.py from portal/config.html,",
+        "// edit that file instead.",
+        "",
+        "// %d bytes, %d before compression" % (len(packed), len(html)),
+        "static const char configFormEtag[] = \"\\\"%08x\\\"\";" %
+        zlib.crc32(packed),
+        "",
+        "static const uint8_t configFormGz[] PROGMEM = {",
+    ]
+    for i in range(0, len(packed), 16):
+        chunk = packed[i:i + 16]
+        lines.append("  " + ", ".join("0x%02x" % b for b in chunk) + ",")
+    lines.append("};")
+
+    with open(header, "w") as f:
+        f.write("\n".join(lines) + "\n")
+    print("gzip_assets: %s, %d -> %d bytes" % (header, len(html), len(packed)))
+
+
+def stage_data_dir(source, staging):
+    if os.path.isdir(staging):
+        shutil.rmtree(staging)
+
+    before = after = 0
+    for root, _, files in os.walk(source):
+        target_root = os.path.join(staging, os.path.relpath(root, source))
+        os.makedirs(target_root, exist_ok=True)
+        for name in files:
+            with open(os.path.join(root, name), "rb") as f:
+                data = f.read()
+            before += len(data)
+            if name.lower().endswith(COMPRESSED_TYPES) and data:
+                packed = compress(data)
+                if len(packed) < len(data):
+                    data = packed
+                    name += ".gz"
+            after += len(data)
+            with open(os.path.join(target_root, name), "wb") as f:
+                f.write(data)
+    print("gzip_assets: data image %d -> %d bytes" % (before, after))
+
+
+try:
+    Import("env")  # noqa: F821
+except NameError:
+    env = None
+
+if env is None:
+    write_form_header(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+elif env.get("PIOPLATFORM") != "native":
+    write_form_header(env.subst("$PROJECT_DIR"))
+
+    staging = os.path.join(env.subst("$BUILD_DIR"), "data")
+    stage_data_dir(env.subst("$PROJECT_DATA_DIR"), staging)
+    env.Replace(PROJECT_DATA_DIR=staging)
@@ -0,0 +1,149 @@
+"""
+Makes a delta OTA patch that turns one firmware build into another.
+
+    python3 scripts/make_delta.py old/firmware.bin new/firmware.bin out.patch
+
+The device applies it against its running app, see include/OtaDelta.h for
+the format. Runs of the new image found in the old one become COPY ops.
+After a match the bytes that still mostly agree become a DIFF, so code
+that only moved costs little once the patch is compressed. Whatever is
+left goes in as INSERT.
+"""
+
+import argparse
+import hashlib
+import struct
+
+COPY, DIFF, INSERT = 1, 2, 3
+
+KEY = 16        # Bytes that must agree to start a match
+STRIDE = 4      # Old image positions indexed
+MIN_MATCH = 24  # Shorter matches are cheaper as literals
+WINDOW = 16     # DIFF goes on while half of the last WINDOW bytes agree
+
+
+def index_base(base):
+    index = {}
+    for i in range(0, len(base) - KEY + 1, STRIDE):
+        index.setdefault(base[i:i + KEY], i)
+    return index
+
+
+def make_patch(base, target):
+    index = index_base(base)
+    ops = []
+    literal = bytearray()
+
+    def flush_literal():
+        if literal:
+            ops.append((INSERT, bytes(literal)))
+            literal.clear()
+
+    t = 0
+    while t < len(target):
+        b = index.get(target[t:t + KEY]) if t + KEY <= len(target) else None
+        if b is None:
+            literal.append(target[t])
+            t += 1
+            continue
+
+        n = KEY
+        while (t + n < len(target) and b + n < len(base) and
+               target[t + n] == base[b + n]):
+            n += 1
+        # Take back literal bytes the match also covers
+        while literal and b > 0 and literal[-1] == base[b - 1]:
+            literal.pop()
+            t, b, n = t - 1, b - 1, n + 1
+
+        if n < MIN_MATCH:
+            literal.append(target[t])
+            t += 1
+            continue
+
+        flush_literal()
+        ops.append((COPY, b, n))
+        t, b = t + n, b + n
+
+        # Approximate extension, trimmed back to its last agreeing byte
+        m, agree, last = 0, [], 0
+        while t + m < len(target) and b + m < len(base):
+            agree.append(target[t + m] == base[b + m])
+            m += 1
+            if agree[-1]:
+                last = m
+            if len(agree) >= WINDOW and sum(agree[-WINDOW:]) < WINDOW // 2:
+                break
+        if last >= WINDOW:
+            diff = bytes((target[t + i] - base[b + i]) & 0xFF
+                         for i in range(last))
+            ops.append((DIFF, b, diff))
+            t += last
+
+    flush_literal()
+    return ops
+
+
+def encode(base, target, ops):
+    out = bytearray(b"SLD1")
+    out += hashlib.md5(base).digest()
+    out += struct.pack("<I", len(target))
+    out += hashlib.md5(target).digest()
+    for op in ops:
+        if op[0] == COPY:
+            out += struct.pack("<BII", COPY, op[1], op[2])
+        elif op[0] == DIFF:
+            out += struct.pack("<BII", DIFF, op[1], len(op[2])) + op[2]
+        else:
+            out += struct.pack("<BI", INSERT, len(op[1])) + op[1]
+    return bytes(out)
+
+
+def apply_patch(base, patch):
+    """Reference decoder, used to check every patch that gets written"""
+    pos, out = 40, bytearray()
+    while pos < len(patch):
+        op = patch[pos]
+        if op == INSERT:
+            (n,) = struct.unpack_from("<I", patch, pos + 1)
+            out += patch[pos + 5:pos + 5 + n]
+            pos += 5 + n
+            continue
+        b, n = struct.unpack_from("<II", patch, pos + 1)
+        pos += 9
+        if op == COPY:
+            out += base[b:b + n]
+        else:
+            out += bytes((base[b + i] + patch[pos + i]) & 0xFF
+                         for i in range(n))
+            pos += n
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("base", help="build the devices are running")
+    parser.add_argument("target", help="new build")
+    parser.add_argument("patch")
+    args = parser.parse_args()
+
+    with open(args.base, "rb") as f:
+        base = f.read()
+    with open(args.target, "rb") as f:
+        target = f.read()
+
+    ops = make_patch(base, target)
+    patch = encode(base, target, ops)
+    if apply_patch(base, patch) != target:
+        raise SystemExit("patch does not reproduce the target")
+
+    with open(args.patch, "wb") as f:
+        f.write(patch)
+    counts = {k: sum(1 for op in ops if op[0] == k) for k in (COPY, DIFF, INSERT)}
+    print("%d -> %d bytes (%.1fx), %d copy, %d diff, %d insert ops" %
+          (len(target), len(patch), len(target) / max(len(patch), 1),
+           counts[COPY], counts[DIFF], counts[INSERT]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,130 @@
+"""
+Local firmware server for trying out interrupted OTA downloads.
+
+Serves one image with an x-MD5 header and honours Range requests. With
+--drop-after it cuts every connection after roughly that many bytes, so
+the device has to resume with Range again and again:
+
+    python3 scripts/ota_server.py .pio/build/esp32/firmware.bin --drop-after 200000
+
+then on the device console:
+
+    firmware update http://<this machine>:8080/firmware.bin
+
+With --patch (from scripts/make_delta.py) devices whose x-Base-MD5 header
+matches the patch base get the patch instead. Anything else, including a
+Range request, gets the full image. Either file may be gzipped with
+scripts/compress_image.py. Only requests with "gzip" in Accept-Encoding
+get the gzipped file, others get it unpacked: a device that lost a
+compressed download asks for the plain image, which it can resume.
+"""
+
+import argparse
+import hashlib
+import http.server
+import random
+import re
+import struct
+import zlib
+
+
+def make_handler(image, patch, drop_after, no_range):
+    base_md5 = patch_base(patch) if patch else None
+    plain = {image: unpack(image)}
+    if patch:
+        plain[patch] = unpack(patch)
+
+    class Handler(http.server.BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def do_GET(self):
+            gzip = "gzip" in self.headers.get("Accept-Encoding", "")
+            body = image if gzip else plain[image]
+            start = 0
+            if patch and self.headers.get("x-Base-MD5") == base_md5:
+                body = patch if gzip else plain[patch]
+                self.send_response(200)
+                self.log_message("sending the %d byte patch", len(body))
+                self.send_body(body, start)
+                return
+
+            match = re.match(r"bytes=(\d+)-$", self.headers.get("Range", ""))
+            if match and not no_range:
+                start = int(match.group(1))
+                if start >= len(body):
+                    self.send_response(416)
+                    self.send_header("Content-Range", "bytes */%d" % len(body))
+                    self.send_header("Content-Length", "0")
+                    self.end_headers()
+                    return
+                self.send_response(206)
+                self.send_header("Content-Range", "bytes %d-%d/%d" %
+                                 (start, len(body) - 1, len(body)))
+            else:
+                self.send_response(200)
+            self.send_body(body, start)
+
+        def send_body(self, body, start):
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(len(body) - start))
+            self.send_header("x-MD5", hashlib.md5(body).hexdigest())
+            self.end_headers()
+
+            body = body[start:]
+            if drop_after:
+                # Jitter, so drops do not always land on the same boundary
+                cut = int(drop_after * random.uniform(0.5, 1.5))
+                if cut < len(body):
+                    self.wfile.write(body[:cut])
+                    self.log_message("dropped after %d bytes at %d",
+                                     cut, start + cut)
+                    self.close_connection = True
+                    return
+            self.wfile.write(body)
+
+    return Handler
+
+
+def patch_base(patch):
+    return unpack(patch)[4:20].hex()
+
+
+def unpack(data):
+    return zlib.decompress(data, 31) if data[:2] == b"\x1f\x8b" else data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("image")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--patch", help="delta patch made by make_delta.py")
+    parser.add_argument("--drop-after", type=int, default=0,
+                        help="cut each response after about this many bytes")
+    parser.add_argument("--no-range", action="store_true",
+                        help="ignore Range headers, like some proxies do")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    print("Serving %s, %d bytes, MD5 %s" %
+          (args.image, len(image), hashlib.md5(image).hexdigest()))
+
+    patch = None
+    if args.patch:
+        with open(args.patch, "rb") as f:
+            patch = f.read()
+        target = unpack(image)
+        header = unpack(patch)[:40]
+        if header[:4] != b"SLD1" or header[20:40] != (
+                struct.pack("<I", len(target)) +
+                hashlib.md5(target).digest()):
+            raise SystemExit("%s does not produce %s" % (args.patch, args.image))
+        print("Patch %s, %d bytes, for base MD5 %s" %
+              (args.patch, len(patch), patch_base(patch)))
+
+    handler = make_handler(image, patch, args.drop_after, args.no_range)
+    http.server.ThreadingHTTPServer(("", args.port), handler).serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,216 @@
+"""
+Local stand-in for the Blynk cloud, for trying out TLS session resumption.
+
+Speaks TLS 1.2, like the ESP32, accepts any login and answers pings.
+With --drop-after it closes every connection after that many seconds, so
+the device keeps reconnecting. Each handshake is logged as full or
+resumed, and so is the running hit rate:
+
+    python3 scripts/tls_standin.py --drop-after 20
+
+The certificate is issued for --host (this machine's address by default)
+by a throwaway CA kept in .tls_standin/. That CA is written to
+include/tls_standin_ca.h, which the esp32-tls-standin environment hands
+to Blynk as its root certificate, so the device checks the stand-in like
+it checks the cloud:
+
+    pio run -e esp32-tls-standin -t upload
+
+Then point the device at this machine with the host and port fields of
+the config portal. The device reports its side of the same numbers in the
+"sysinfo" console command.
+
+--no-tickets turns off session tickets, so only session ID resumption is
+left.
+"""
+
+import argparse
+import ipaddress
+import os
+import socket
+import ssl
+import struct
+import subprocess
+import threading
+import time
+
+CMD_RESPONSE = 0
+CMD_LOGIN = 2
+CMD_PING = 6
+CMD_HW_LOGIN = 29
+STATUS_SUCCESS = 200
+
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+STATE_DIR = os.path.join(ROOT, ".tls_standin")
+CA_HEADER = os.path.join(ROOT, "include", "tls_standin_ca.h")
+
+
+def openssl(*args):
+    subprocess.run(["openssl"] + list(args), check=True, capture_output=True)
+
+
+def local_address():
+    # No packet is sent, this only picks the interface of the default route
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        s.connect(("192.0.2.1", 9))
+        return s.getsockname()[0]
+
+
+def make_ca():
+    cert = os.path.join(STATE_DIR, "ca.crt")
+    key = os.path.join(STATE_DIR, "ca.key")
+    if not os.path.exists(cert):
+        os.makedirs(STATE_DIR, exist_ok=True)
+        openssl("req", "-x509", "-newkey", "ec",
+                "-pkeyopt", "ec_paramgen_curve:prime256v1", "-nodes",
+                "-days", "365", "-subj", "/CN=Blynk stand-in CA",
+                "-addext", "basicConstraints=critical,CA:TRUE",
+                "-addext", "keyUsage=critical,keyCertSign,cRLSign",
+                "-keyout", key, "-out", cert)
+    return cert, key
+
+
+def make_certificate(host):
+    ca_cert, ca_key = make_ca()
+    cert = os.path.join(STATE_DIR, "standin.crt")
+    key = os.path.join(STATE_DIR, "standin.key")
+    request = os.path.join(STATE_DIR, "standin.csr")
+    extensions = os.path.join(STATE_DIR, "standin.ext")
+
+    # mbedTLS matches the host against dNSName entries and the CN, so an
+    # address goes in as both a dNSName and an iPAddress
+    names = ["DNS:" + host]
+    try:
+        ipaddress.ip_address(host)
+        names.append("IP:" + host)
+    except ValueError:
+        pass
+    with open(extensions, "w") as f:
+        f.write("basicConstraints=CA:FALSE\n"
+                "extendedKeyUsage=serverAuth\n"
+                "subjectAltName=%s\n" % ",".join(names))
+
+    openssl("req", "-new", "-newkey", "ec",
+            "-pkeyopt", "ec_paramgen_curve:prime256v1", "-nodes",
+            "-subj", "/CN=" + host, "-keyout", key, "-out", request)
+    openssl("x509", "-req", "-in", request, "-CA", ca_cert, "-CAkey", ca_key,
+            "-CAcreateserial", "-days", "30", "-extfile", extensions,
+            "-out", cert)
+    return cert, key, ca_cert
+
+
+def write_ca_header(ca_cert):
+    with open(ca_cert) as f:
+        lines = f.read().strip().splitlines()
+    with open(CA_HEADER, "w") as f:
+        f.write("#pragma once\n\n"
+                "// Written by scripts/tls_standin.py, do not commit\n"
+                "#define BLYNK_DEFAULT_ROOT_CA \\\n")
+        f.write(" \\\n".join('    "%s\\n"' % line for line in lines))
+        f.write("\n")
+
+
+class Counters:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.full = 0
+        self.resumed = 0
+
+    def add(self, resumed):
+        with self.lock:
+            if resumed:
+                self.resumed += 1
+            else:
+                self.full += 1
+            total = self.full + self.resumed
+            return total, 100.0 * self.resumed / total
+
+
+def read_exactly(conn, n):
+    data = b""
+    while len(data) < n:
+        chunk = conn.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError("closed")
+        data += chunk
+    return data
+
+
+def serve(conn, peer, drop_after):
+    conn.settimeout(1.0)
+    deadline = time.monotonic() + drop_after if drop_after else None
+    while deadline is None or time.monotonic() < deadline:
+        try:
+            header = read_exactly(conn, 5)
+        except socket.timeout:
+            continue
+        cmd, msg_id, length = struct.unpack(">BHH", header)
+        if cmd != CMD_RESPONSE and length:
+            read_exactly(conn, length)
+        if cmd in (CMD_LOGIN, CMD_HW_LOGIN, CMD_PING):
+            conn.sendall(struct.pack(">BHH", CMD_RESPONSE, msg_id,
+                                     STATUS_SUCCESS))
+            if cmd != CMD_PING:
+                print("%s: logged in" % peer)
+    print("%s: dropping the connection" % peer)
+
+
+def handle(context, raw, peer, counters, drop_after):
+    try:
+        start = time.monotonic()
+        conn = context.wrap_socket(raw, server_side=True)
+        ms = (time.monotonic() - start) * 1000
+        total, rate = counters.add(conn.session_reused)
+        print("%s: %s handshake, %.0f ms (%d so far, %.0f%% resumed)" %
+              (peer, "resumed" if conn.session_reused else "full", ms,
+               total, rate))
+        try:
+            serve(conn, peer, drop_after)
+        finally:
+            # Without a close_notify OpenSSL drops the session ID from its
+            # cache, and only tickets would resume
+            try:
+                conn.unwrap()
+            except (ssl.SSLError, OSError):
+                pass
+            conn.close()
+    except (ssl.SSLError, ConnectionError, OSError) as e:
+        print("%s: %s" % (peer, e))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--host", help="name or address the device connects "
+                        "to, this machine's address by default")
+    parser.add_argument("--drop-after", type=float, default=0,
+                        help="close connections after this many seconds")
+    parser.add_argument("--no-tickets", action="store_true")
+    args = parser.parse_args()
+
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.minimum_version = ssl.TLSVersion.TLSv1_2
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+    if args.no_tickets:
+        context.options |= ssl.OP_NO_TICKET
+    host = args.host or local_address()
+    cert, key, ca_cert = make_certificate(host)
+    context.load_cert_chain(cert, key)
+    write_ca_header(ca_cert)
+
+    counters = Counters()
+    listener = socket.create_server(("", args.port))
+    print("Blynk stand-in on %s:%d, session tickets %s" %
+          (host, args.port, "off" if args.no_tickets else "on"))
+    print("Device build trusts %s" % os.path.relpath(CA_HEADER, ROOT))
+    while True:
+        raw, addr = listener.accept()
+        peer = "%s:%d" % addr
+        threading.Thread(target=handle, daemon=True,
+                         args=(context, raw, peer, counters,
+                               args.drop_after)).start()
+
+
+if __name__ == "__main__":
+    main()
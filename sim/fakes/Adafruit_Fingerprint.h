@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <map>
+
+/*
+ * AS608 model with the Adafruit_Fingerprint interface. A "print" is just a
+ * number: placeFinger(7) puts finger 7 on the glass, and a template stores
+ * which print it was made from. Every command costs a rough UART round trip
+ * of virtual time.
+ */
+
+#define FINGERPRINT_OK 0x00
+#define FINGERPRINT_PACKETRECIEVEERR 0x01
+#define FINGERPRINT_NOFINGER 0x02
+#define FINGERPRINT_IMAGEFAIL 0x03
+#define FINGERPRINT_IMAGEMESS 0x06
+#define FINGERPRINT_FEATUREFAIL 0x07
+#define FINGERPRINT_NOMATCH 0x08
+#define FINGERPRINT_NOTFOUND 0x09
+#define FINGERPRINT_ENROLLMISMATCH 0x0A
+#define FINGERPRINT_BADLOCATION 0x0B
+#define FINGERPRINT_DBREADFAIL 0x0C
+#define FINGERPRINT_DELETEFAIL 0x10
+#define FINGERPRINT_DBCLEARFAIL 0x11
+#define FINGERPRINT_INVALIDIMAGE 0x15
+#define FINGERPRINT_FLASHERR 0x18
+#define FINGERPRINT_TIMEOUT 0xFF
+#define FINGERPRINT_BADPACKET 0xFE
+
+#define FINGERPRINT_STARTCODE 0xEF01
+#define FINGERPRINT_COMMANDPACKET 0x1
+#define FINGERPRINT_DATAPACKET 0x2
+#define FINGERPRINT_ACKPACKET 0x7
+#define FINGERPRINT_ENDDATAPACKET 0x8
+
+#define FINGERPRINT_READINDEXTABLE 0x1F
+
+struct Adafruit_Fingerprint_Packet {
+    Adafruit_Fingerprint_Packet(uint8_t type, uint16_t length, uint8_t *data)
+        : type(type), length(length) {
+        memcpy(this->data, data, min<size_t>(length, sizeof(this->data)));
+    }
+    uint16_t start_code = FINGERPRINT_STARTCODE;
+    uint8_t address[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+    uint8_t type;
+    uint16_t length;
+    uint8_t data[64] = {};
+};
+
+class Adafruit_Fingerprint {
+   public:
+    static const uint32_t COMMAND_US = 20000;
+
+    explicit Adafruit_Fingerprint(HardwareSerial *serial) {}
+
+    void begin(uint32_t baud) {}
+    bool verifyPassword() { return command(), _present; }
+    uint8_t getParameters();
+
+    uint8_t getImage();
+    uint8_t image2Tz(uint8_t slot = 1);
+    uint8_t createModel();
+    uint8_t storeModel(uint16_t id);
+    uint8_t loadModel(uint16_t id);
+    uint8_t deleteModel(uint16_t id);
+    uint8_t emptyDatabase();
+    uint8_t fingerFastSearch();
+
+    void writeStructuredPacket(const Adafruit_Fingerprint_Packet &packet);
+    uint8_t getStructuredPacket(Adafruit_Fingerprint_Packet *packet,
+                                uint16_t timeout = 1000);
+
+    uint16_t fingerID = 0;
+    uint16_t confidence = 0;
+    uint16_t capacity = 0;
+
+    // Simulation side
+    void placeFinger(int print) { _onGlass = print; }
+    void liftFinger() { _onGlass = NONE; }
+    size_t templates() const { return _library.size(); }
+    void unplug() { _present = false; }
+
+   private:
+    static const int NONE = -1;
+    static const uint16_t LIBRARY_SIZE = 162;
+
+    void command();
+
+    bool _present = true;
+    int _onGlass = NONE;
+    int _image = NONE;
+    int _buffers[3] = {NONE, NONE, NONE};
+    std::map<uint16_t, int> _library;
+    uint8_t _request[8] = {};
+};
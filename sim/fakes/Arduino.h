@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "Sim.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Just enough of the arduino-esp32 core for the lock firmware to build on
+ * the host. Time comes from the simulator's virtual clock.
+ */
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+#define IRAM_ATTR
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+class String {
+   public:
+    String() {}
+    String(const char *s) : _s(s ? s : "") {}
+    String(const std::string &s) : _s(s) {}
+    explicit String(char c) : _s(1, c) {}
+    String(int v) : _s(std::to_string(v)) {}
+    String(unsigned v) : _s(std::to_string(v)) {}
+    String(long v) : _s(std::to_string(v)) {}
+    String(unsigned long v) : _s(std::to_string(v)) {}
+    String(long long v) : _s(std::to_string(v)) {}
+    String(unsigned long long v) : _s(std::to_string(v)) {}
+
+    const char *c_str() const { return _s.c_str(); }
+    unsigned length() const { return _s.length(); }
+    bool isEmpty() const { return _s.empty(); }
+    bool reserve(unsigned size) {
+        _s.reserve(size);
+        return true;
+    }
+
+    void remove(unsigned index) {
+        if (index < _s.size()) _s.erase(index);
+    }
+    void remove(unsigned index, unsigned count) {
+        if (index < _s.size()) _s.erase(index, count);
+    }
+    void replace(const String &find, const String &with) {
+        size_t at = 0;
+        while ((at = _s.find(find._s, at)) != std::string::npos) {
+            _s.replace(at, find._s.size(), with._s);
+            at += with._s.size();
+        }
+    }
+    long toInt() const { return atol(_s.c_str()); }
+    void toLowerCase() {
+        for (char &c : _s) c = tolower((unsigned char)c);
+    }
+    bool startsWith(const String &prefix) const {
+        return _s.compare(0, prefix._s.size(), prefix._s) == 0;
+    }
+    bool endsWith(const String &suffix) const {
+        return _s.size() >= suffix._s.size() &&
+               _s.compare(_s.size() - suffix._s.size(), suffix._s.size(),
+                          suffix._s) == 0;
+    }
+    int indexOf(char c) const {
+        size_t at = _s.find(c);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    int indexOf(const String &str) const {
+        size_t at = _s.find(str._s);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    void toCharArray(char *buf, unsigned size) const {
+        if (!size) return;
+        size_t n = min<size_t>(_s.size(), size - 1);
+        memcpy(buf, _s.data(), n);
+        buf[n] = '\0';
+    }
+    String substring(unsigned from, unsigned to = UINT_MAX) const {
+        if (from >= _s.size()) return String();
+        return String(_s.substr(from, min<size_t>(to, _s.size()) - from));
+    }
+
+    String &operator+=(const String &rhs) {
+        _s += rhs._s;
+        return *this;
+    }
+    String &operator+=(const char *rhs) {
+        _s += rhs;
+        return *this;
+    }
+    String &operator+=(char rhs) {
+        _s += rhs;
+        return *this;
+    }
+
+    bool operator==(const String &rhs) const { return _s == rhs._s; }
+    bool operator==(const char *rhs) const { return _s == rhs; }
+    bool operator!=(const String &rhs) const { return _s != rhs._s; }
+    char operator[](unsigned i) const { return _s[i]; }
+
+    std::string::const_iterator begin() const { return _s.begin(); }
+    std::string::const_iterator end() const { return _s.end(); }
+
+   private:
+    std::string _s;
+};
+
+inline String operator+(const String &lhs, const String &rhs) {
+    String s(lhs);
+    s += rhs;
+    return s;
+}
+inline String operator+(const String &lhs, const char *rhs) {
+    String s(lhs);
+    s += rhs;
+    return s;
+}
+inline String operator+(const char *lhs, const String &rhs) {
+    String s(lhs);
+    s += rhs;
+    return s;
+}
+inline String operator+(const String &lhs, char rhs) {
+    String s(lhs);
+    s += rhs;
+    return s;
+}
+// Numbers are appended in decimal, not as a char
+template <typename T, typename = typename std::enable_if<
+                          std::is_integral<T>::value &&
+                          !std::is_same<T, char>::value &&
+                          !std::is_same<T, bool>::value>::type>
+inline String operator+(const String &lhs, T rhs) {
+    return lhs + String(rhs);
+}
+
+class Print {
+   public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+};
+
+// Serial output goes to stdout, each line stamped with the virtual time
+class HardwareSerial {
+   public:
+    void begin(unsigned long baud) {}
+    int available() { return 0; }
+    int read() { return -1; }
+
+    size_t write(const char *text);
+    size_t print(const char *text) { return write(text); }
+    size_t print(const String &text) { return write(text.c_str()); }
+    size_t print(char c) {
+        char text[2] = {c, '\0'};
+        return write(text);
+    }
+    size_t print(long long v) { return write(std::to_string(v).c_str()); }
+    size_t print(unsigned long long v) {
+        return write(std::to_string(v).c_str());
+    }
+    size_t print(int v) { return print((long long)v); }
+    size_t print(unsigned v) { return print((unsigned long long)v); }
+    size_t print(long v) { return print((long long)v); }
+    size_t print(unsigned long v) { return print((unsigned long long)v); }
+
+    template <typename T>
+    size_t println(const T &v) {
+        return print(v) + write("\n");
+    }
+    size_t println() { return write("\n"); }
+
+    size_t printf(const char *format, ...)
+        __attribute__((format(printf, 2, 3)));
+
+   private:
+    bool _lineStart = true;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial2;
+
+class EspClass {
+   public:
+    uint32_t getFreeHeap() { return 200000; }
+    uint32_t getMaxAllocHeap() { return 110000; }
+    uint32_t getSketchSize() { return 1024 * 1024; }
+    String getSketchMD5() { return "0f343b0931126a20f133d67c2b018a3b"; }
+    void restart();
+};
+
+extern EspClass ESP;
+
+// 32 bits wide like on the ESP32, so wrap-around behaves the same
+inline uint32_t millis() { return sim::micros() / 1000; }
+inline int64_t esp_timer_get_time() { return sim::micros(); }
+inline void delay(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+
+void esp_fill_random(void *buf, size_t len);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg,
+                        int mode);
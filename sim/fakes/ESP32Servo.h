@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Arduino.h>
+
+class Servo {
+   public:
+    int attach(int pin) {
+        _pin = pin;
+        return 0;
+    }
+    bool attached() const { return _pin >= 0; }
+    void write(int angle);
+    int read() const { return _angle; }
+
+    // Simulation side: virtual time of the last write
+    uint64_t lastWrite() const { return _lastWrite; }
+
+   private:
+    int _pin = -1;
+    int _angle = 0;
+    uint64_t _lastWrite = 0;
+};
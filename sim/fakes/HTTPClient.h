@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <vector>
+
+/*
+ * HTTP client for the one firmware server of the simulation. The body
+ * arrives at the server's link rate from the moment of the request, and
+ * reading it costs CPU time for decryption and copying. A Range request
+ * gets a 206 answer with Content-Range, like from a static file server.
+ * Patches and gzip follow scripts/ota_server.py: the patch goes to
+ * requests whose x-Base-MD5 names its base, and bodies are gzipped for
+ * requests with "gzip" in Accept-Encoding when the server is set to.
+ */
+
+#define HTTP_CODE_OK 200
+#define HTTP_CODE_PARTIAL_CONTENT 206
+#define HTTP_CODE_NOT_FOUND 404
+
+class Client {
+   public:
+    int available();
+    bool connected();
+    int read(uint8_t *buf, size_t size);
+
+   private:
+    friend class HTTPClient;
+
+    size_t arrived() const;
+
+    std::vector<uint8_t> _body;
+    uint64_t _start = 0;  // Virtual time of the request, us
+    size_t _from = 0;
+    size_t _pos = 0;
+    size_t _end = 0;  // Where the server cuts the connection
+};
+
+class HTTPClient {
+   public:
+    bool begin(const String &url) {
+        _url = url;
+        _range = 0;
+        _baseMd5 = String();
+        _gzip = false;
+        return true;
+    }
+    void setTimeout(uint16_t timeout) {}
+    void collectHeaders(const char *headerKeys[], const size_t headerKeysCount) {}
+    void addHeader(const String &name, const String &value);
+
+    int GET();
+    int getSize() const { return _size; }
+    String header(const char *name);
+    bool hasHeader(const char *name) { return header(name).length() > 0; }
+    Client &getStream() { return _stream; }
+
+   private:
+    String _url;
+    size_t _range = 0;
+    String _baseMd5;
+    bool _gzip = false;
+    bool _plain = false;  // Sending the image as it is
+    int _code = 0;
+    int _size = -1;
+    Client _stream;
+};
+
+// Simulation side: the firmware on offer and the link that carries it
+struct SimFirmwareServer {
+    String url;
+    std::vector<uint8_t> image;
+    String md5;  // Sent as x-MD5 with the plain image when set
+    std::vector<uint8_t> patch;
+    String patchBase;  // Build the patch is offered to
+    bool gzip = false;
+    size_t dropAfter = 0;  // Cuts every response after this many bytes
+    uint32_t linkRate = 200 * 1024;
+    uint64_t bytesSent = 0;
+};
+
+extern SimFirmwareServer firmwareServer;
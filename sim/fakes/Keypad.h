@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+ * Keypad with the chris--a/Keypad interface, scanning a set of keys held
+ * by the simulation instead of the matrix. press()/release() also move the
+ * column line, so the firmware's GPIO interrupts fire as on the board.
+ */
+
+#define LIST_MAX 10
+#define NO_KEY '\0'
+#define makeKeymap(x) ((char *)x)
+
+typedef enum { IDLE, PRESSED, HOLD, RELEASED } KeyState;
+
+class Key {
+   public:
+    char kchar = NO_KEY;
+    int kcode = -1;
+    KeyState kstate = IDLE;
+    bool stateChanged = false;
+};
+
+class Keypad {
+   public:
+    static const uint8_t MAX_LINES = 8;
+
+    Keypad(char *userKeymap, byte *row, byte *col, byte numRows,
+           byte numCols);
+
+    bool getKeys();
+    char getKey();
+    void setDebounceTime(unsigned debounce) {}
+
+    // Simulation side
+    bool press(char c);
+    bool release(char c);
+
+    Key key[LIST_MAX];
+
+   private:
+    bool locate(char c, uint8_t &row, uint8_t &col) const;
+    bool held(char c) const;
+
+    char *_keymap;
+    byte *_rowPins;
+    byte *_colPins;
+    byte _rows;
+    byte _cols;
+    bool _held[MAX_LINES][MAX_LINES] = {};
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+
+// HD44780 behind a PCF8574 backpack: DDRAM contents plus the cursor
+class LiquidCrystal_I2C {
+   public:
+    static const uint8_t MAX_COLS = 20;
+    static const uint8_t MAX_ROWS = 4;
+
+    LiquidCrystal_I2C(uint8_t address, uint8_t cols, uint8_t rows)
+        : _cols(cols), _rows(rows) {
+        clear();
+    }
+
+    // The HD44780 power-on and 4-bit mode handshake waits about 70 ms
+    void init() {
+        sim::sleep(70000);
+        clear();
+    }
+    void backlight() { _backlight = true; }
+    void noBacklight() { _backlight = false; }
+
+    void clear();
+    void setCursor(uint8_t col, uint8_t row);
+    size_t write(uint8_t c);
+    size_t print(const char *text);
+    size_t print(const String &text) { return print(text.c_str()); }
+
+    // Simulation side
+    String line(uint8_t row) const;
+    bool backlightOn() const { return _backlight; }
+
+   private:
+    uint8_t _cols;
+    uint8_t _rows;
+    uint8_t _col = 0;
+    uint8_t _row = 0;
+    bool _backlight = false;
+    char _ddram[MAX_ROWS][MAX_COLS];
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+/*
+ * Storage partition stand-in. Files live under a temporary host directory
+ * created by begin() and removed by end(), and every write is flushed to
+ * the host right away, so what a power cut would leave behind is what the
+ * directory holds at that moment.
+ */
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+class File {
+   public:
+    File() {}
+    explicit File(FILE *f) : _f(f, fclose) {}
+
+    operator bool() const { return (bool)_f; }
+
+    size_t read(uint8_t *buf, size_t size);
+    size_t write(const uint8_t *buf, size_t size);
+    size_t size() const;
+    void close() { _f.reset(); }
+
+   private:
+    std::shared_ptr<FILE> _f;
+};
+
+class SimFS {
+   public:
+    bool begin();
+    void end();
+
+    File open(const char *path, const char *mode = FILE_READ);
+    bool exists(const char *path);
+    bool remove(const char *path);
+
+    // Simulation side: cuts a file short, like a write torn by a reset
+    bool truncate(const char *path, size_t size);
+    size_t fileSize(const char *path);
+
+   private:
+    std::string hostPath(const char *path) const { return _root + path; }
+
+    std::string _root;
+};
+
+extern SimFS LittleFS;
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <map>
+#include <string>
+
+// NVS namespaces kept in host memory for the lifetime of the process
+class Preferences {
+   public:
+    bool begin(const char *name, bool readOnly = false);
+    void end() { _ns = nullptr; }
+
+    bool clear();
+    bool remove(const char *key);
+    bool isKey(const char *key);
+
+    size_t putString(const char *key, const String &value);
+    String getString(const char *key, const String &defaultValue = String());
+    size_t putBool(const char *key, bool value);
+    bool getBool(const char *key, bool defaultValue = false);
+    size_t putBytes(const char *key, const void *value, size_t len);
+    size_t getBytes(const char *key, void *buf, size_t maxLen);
+    size_t getBytesLength(const char *key);
+
+   private:
+    std::map<std::string, std::string> *_ns = nullptr;
+    bool _readOnly = false;
+};
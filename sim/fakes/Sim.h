@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+/*
+ * Cooperative FreeRTOS stand-in with a virtual clock.
+ *
+ * Every task is a host thread, but only one of them runs at a time and it
+ * keeps running until it blocks (vTaskDelay, a queue receive, a notification
+ * wait, ...). The highest-priority ready task runs next. When every task is
+ * blocked the clock jumps straight to the earliest deadline, so a 60 s
+ * lockout costs as much host time as the work done during it.
+ *
+ * Code runs in zero virtual time unless it says otherwise with busy(). Busy
+ * time is preempted on tick boundaries, like FreeRTOS time slicing, except
+ * when it is exclusive: a flash erase with the caches off stops every task.
+ */
+
+struct SimTask;
+
+namespace sim {
+
+const uint64_t FOREVER = UINT64_MAX;
+
+// Virtual time since boot
+uint64_t micros();
+
+// Adopts the calling thread as the Arduino loop task
+void init();
+
+SimTask *spawn(void (*fn)(void *), const char *name, void *param,
+               unsigned priority);
+SimTask *currentTask();
+unsigned taskCount();
+
+// Parks the running task until ready() holds or the virtual clock reaches
+// deadline. Returns ready() as seen on wake-up.
+bool block(uint64_t deadline, const std::function<bool()> &ready);
+void sleep(uint64_t us);
+
+// Keeps the CPU for us of virtual time
+void busy(uint64_t us, bool exclusive = false);
+
+// Lets a ready task of the same or higher priority run
+void yield();
+
+void notify(SimTask *task);
+uint32_t takeNotify(bool clear, uint64_t deadline);
+
+// GPIO model. Edges on a pin run the handler attached with
+// attachInterruptArg(), in the context of whoever changed the level.
+void setPinLevel(uint8_t pin, int level);
+int pinLevel(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void *), void *arg,
+                     int mode);
+
+// Counters for things the firmware should not do on the hot path
+struct Counters {
+    uint32_t nvsOpens;
+    uint32_t nvsWrites;  // Values put, each an NVS entry written
+    uint32_t sensorCommands;
+    uint32_t lcdWrites;
+    uint32_t servoWrites;
+    uint32_t heapAllocs;  // operator new calls, from any thread
+    uint64_t heapBytes;
+};
+Counters &counters();
+
+}  // namespace sim
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Stand-in for BlynkEdgent.h: the Blynk API the sketch uses, Edgent's timer
+ * and console, the storage partition, and the few SysUtils/ConfigStore
+ * pieces it reaches into.
+ *
+ * Cloud commands are queued by the simulation and dispatched from
+ * BlynkEdgent.run(), on the loop task, like on the device. Everything the
+ * firmware sends to the cloud is printed and kept for inspection.
+ */
+
+#define BLYNK_FS LittleFS
+
+#define DEBUG_PRINT(...) Serial.println(__VA_ARGS__)
+// Without BLYNK_PRINT, Blynk's own log compiles to nothing
+#define BLYNK_LOG2(...)
+
+#define BLYNK_STRINGIFY(x) #x
+#define BLYNK_TOSTRING(x) BLYNK_STRINGIFY(x)
+#define BLYNK_PARAM_KV(k, v) k "\0" v "\0"
+#define BLYNK_PARAM_PLACEHOLDER_64 \
+    "PLACEHOLDER_PLACEHOLDER_PLACEHOLDER_PLACEHOLDER_PLACEHOLDER_PLAC"
+
+template <class T>
+const T &BlynkMin(const T &a, const T &b) {
+    return (b < a) ? b : a;
+}
+
+#define V0 0
+#define V1 1
+#define V2 2
+#define V3 3
+#define V4 4
+#define V5 5
+#define V6 6
+#define V7 7
+#define V8 8
+#define V9 9
+#define V10 10
+
+// Kept clear of the virtual pins
+#define InternalPinOTA 0x100
+
+class BlynkParam {
+   public:
+    // A value in a "key\0value\0..." list, invalid when the key is missing
+    class iterator {
+       public:
+        explicit iterator(const char *value = nullptr) : _value(value) {}
+        bool isValid() const { return _value != nullptr; }
+        const char *asStr() const { return _value; }
+        int asInt() const { return atoi(_value); }
+
+       private:
+        const char *_value;
+    };
+
+    explicit BlynkParam(const String &value) : _value(value) {}
+    BlynkParam(const void *list, size_t len)
+        : _list(static_cast<const char *>(list)), _len(len) {}
+    int asInt() const { return _value.toInt(); }
+    const char *asStr() const { return _value.c_str(); }
+    String asString() const { return _value; }
+
+    iterator operator[](const char *key) const {
+        for (size_t at = 0; at < _len;) {
+            const char *name = _list + at;
+            at += strlen(name) + 1;
+            if (at >= _len) break;
+            if (!strcmp(name, key)) return iterator(_list + at);
+            at += strlen(_list + at) + 1;
+        }
+        return iterator();
+    }
+
+   private:
+    String _value;
+    const char *_list = nullptr;
+    size_t _len = 0;
+};
+
+typedef void (*BlynkWriteHandler)(const BlynkParam &);
+
+struct BlynkHandlerRegistration {
+    BlynkHandlerRegistration(int pin, BlynkWriteHandler handler);
+    explicit BlynkHandlerRegistration(void (*connected)());
+};
+
+#define BLYNK_WRITE(pin)                                              \
+    static void BlynkWidgetWrite##pin(const BlynkParam &param);       \
+    static BlynkHandlerRegistration blynkWriteRegistration##pin(      \
+        pin, BlynkWidgetWrite##pin);                                  \
+    static void BlynkWidgetWrite##pin(const BlynkParam &param)
+
+#define BLYNK_CONNECTED()                                             \
+    static void BlynkOnConnected();                                   \
+    static BlynkHandlerRegistration blynkConnectedRegistration(       \
+        BlynkOnConnected);                                            \
+    static void BlynkOnConnected()
+
+struct BlynkSent {
+    uint64_t at;  // Virtual time, us
+    int pin;      // -1 for logEvent()
+    std::string name;
+    std::string value;
+};
+
+class SimBlynk {
+   public:
+    bool connected() const { return _connected; }
+    void disconnect() { setConnected(false); }
+
+    template <typename T>
+    void virtualWrite(int pin, const T &value) {
+        record(pin, "", String(value).c_str());
+    }
+
+    template <typename N, typename D>
+    void logEvent(const N &name, const D &description) {
+        record(-1, String(name).c_str(), String(description).c_str());
+    }
+
+    // Services queued cloud commands, called by BlynkEdgent.run()
+    void run();
+
+    // Simulation side. Commands for an offline device are lost.
+    void setConnected(bool connected);
+    void command(int pin, const char *value);
+    const std::vector<BlynkSent> &sent() const { return _sent; }
+
+   private:
+    void record(int pin, const char *name, const char *value);
+
+    bool _connected = false;
+    std::deque<std::pair<int, std::string>> _inbox;
+    std::vector<BlynkSent> _sent;
+};
+
+extern SimBlynk Blynk;
+
+class SimEdgent {
+   public:
+    void begin();
+    void run();
+};
+
+extern SimEdgent BlynkEdgent;
+
+class BlynkTimer {
+   public:
+    int setInterval(unsigned long interval, void (*fn)());
+    int setTimeout(unsigned long timeout, void (*fn)());
+    void enable(int id);
+    void disable(int id);
+    void run();
+
+   private:
+    struct Timer {
+        void (*fn)();
+        unsigned long interval;
+        unsigned long next;
+        bool enabled;
+        bool repeat;
+    };
+    std::vector<Timer> _timers;
+};
+
+extern BlynkTimer edgentTimer;
+
+class BlynkConsole {
+   public:
+    typedef std::function<void(int, const char **)> Command;
+
+    void addCommand(const char *name, Command fn) { _commands[name] = fn; }
+    void addCommand(const char *name, std::function<void()> fn) {
+        _commands[name] = [fn](int, const char **) { fn(); };
+    }
+    void printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    // Simulation side: runs one console line, false if unknown
+    bool run(const char *line);
+
+   private:
+    std::map<std::string, Command> _commands;
+};
+
+extern BlynkConsole edgentConsole;
+
+#define WL_CONNECTED 3
+
+class SimWiFi {
+   public:
+    int status() const { return Blynk.connected() ? WL_CONNECTED : 0; }
+};
+
+extern SimWiFi WiFi;
+
+struct SystemStats {
+    struct {
+        uint32_t total;
+    } resetCount;
+};
+
+extern SystemStats systemStats;
+extern volatile bool factoryResetPending;
+
+void systemReboot();
+uint32_t BlynkCRC32(const void *data, size_t length, uint32_t previous = 0);
+String timeSpanToStr(const uint64_t t);
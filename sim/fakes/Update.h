@@ -0,0 +1,3 @@
+#pragma once
+
+// OTA.h includes it, the download itself goes through OtaImage.h
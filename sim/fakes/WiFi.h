@@ -0,0 +1,4 @@
+#pragma once
+
+// WiFi.status() comes with the cloud stand-in
+#include <SimEdgent.h>
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * The two app partitions, held in host memory. Erasing and programming
+ * take virtual time with the caches off, so every task stops meanwhile,
+ * and programming can only clear bits, like NOR flash.
+ */
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+
+typedef struct {
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+} esp_partition_t;
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition,
+                                    size_t offset, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition,
+                              size_t dst_offset, const void *src, size_t size);
+esp_err_t esp_partition_read(const esp_partition_t *partition,
+                             size_t src_offset, void *dst, size_t size);
+
+namespace sim {
+
+// Simulation side: what the partition holds now
+const uint8_t *partitionData(const esp_partition_t *partition);
+
+// Writes an image the way the serial flasher would, in no virtual time
+void loadPartition(const esp_partition_t *partition, const uint8_t *data,
+                   size_t len);
+
+}  // namespace sim
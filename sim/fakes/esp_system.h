@@ -0,0 +1,7 @@
+#pragma once
+
+typedef int esp_err_t;
+
+// Run by ESP.restart() before the process exits
+typedef void (*shutdown_handler_t)(void);
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle);
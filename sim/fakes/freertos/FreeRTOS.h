@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Sim.h"
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_FULL pdFALSE
+
+#define configTICK_RATE_HZ 1000
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) / portTICK_PERIOD_MS)
+#define portYIELD_FROM_ISR(...)
+
+// Absolute virtual deadline for a FreeRTOS timeout
+inline uint64_t simDeadline(TickType_t ticks) {
+    return ticks == portMAX_DELAY
+               ? sim::FOREVER
+               : sim::micros() + (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Mutexes without priority inheritance, and binary semaphores, which are
+// the same thing created taken
+struct SimMutex;
+typedef SimMutex *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef SimTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define tskIDLE_PRIORITY 0
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                          uint32_t stackDepth, void *param,
+                                          UBaseType_t priority,
+                                          TaskHandle_t *handle,
+                                          BaseType_t core) {
+    TaskHandle_t task = sim::spawn(fn, name, param, priority);
+    if (handle) *handle = task;
+    return pdPASS;
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *name,
+                              uint32_t stackDepth, void *param,
+                              UBaseType_t priority, TaskHandle_t *handle) {
+    return xTaskCreatePinnedToCore(fn, name, stackDepth, param, priority,
+                                   handle, 0);
+}
+
+// Only a task deleting itself, which then never runs again
+inline void vTaskDelete(TaskHandle_t task) {
+    sim::block(sim::FOREVER, nullptr);
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    sim::sleep((uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+inline void taskYIELD() { sim::yield(); }
+
+inline TickType_t xTaskGetTickCount() {
+    return sim::micros() / 1000 / portTICK_PERIOD_MS;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return sim::currentTask(); }
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    return sim::takeNotify(clear, simDeadline(ticks));
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    sim::notify(task);
+    return pdPASS;
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    sim::notify(task);
+    if (woken) *woken = pdFALSE;
+}
+
+inline UBaseType_t uxTaskGetNumberOfTasks() { return sim::taskCount(); }
+
+// Host threads have no fixed stack to measure
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 0; }
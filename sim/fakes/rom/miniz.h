@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * The tinfl part of the ROM's miniz, as OtaInflate.h uses it, decoding
+ * with the host's zlib. Like the ROM decoder it may have pulled a few
+ * bytes past the end of the deflate stream into its bit buffer when it
+ * reports TINFL_STATUS_DONE. Only one decompressor runs at a time.
+ */
+
+typedef uint8_t mz_uint8;
+typedef uint32_t mz_uint32;
+typedef uint64_t tinfl_bit_buf_t;
+
+#define TINFL_LZ_DICT_SIZE 32768
+#define TINFL_FLAG_HAS_MORE_INPUT 2
+
+typedef enum {
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+typedef struct {
+    mz_uint32 m_state;
+    mz_uint32 m_num_bits;
+    tinfl_bit_buf_t m_bit_buf;
+} tinfl_decompressor;
+
+void tinfl_init(tinfl_decompressor *r);
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r,
+                              const mz_uint8 *pIn_buf_next,
+                              size_t *pIn_buf_size, mz_uint8 *pOut_buf_start,
+                              mz_uint8 *pOut_buf_next, size_t *pOut_buf_size,
+                              const mz_uint32 decomp_flags);
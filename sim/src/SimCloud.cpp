@@ -0,0 +1,280 @@
+#include <HTTPClient.h>
+#include <SimEdgent.h>
+#include <zlib.h>
+
+#include <sstream>
+
+#include "esp_rom_md5.h"
+
+SimBlynk Blynk;
+SimEdgent BlynkEdgent;
+BlynkTimer edgentTimer;
+BlynkConsole edgentConsole;
+SimWiFi WiFi;
+SimFirmwareServer firmwareServer;
+SystemStats systemStats = {{1}};
+
+static std::map<int, BlynkWriteHandler> &writeHandlers() {
+    static std::map<int, BlynkWriteHandler> handlers;
+    return handlers;
+}
+
+static void (*connectedHandler)() = nullptr;
+static bool connectPending = false;
+
+BlynkHandlerRegistration::BlynkHandlerRegistration(int pin,
+                                                   BlynkWriteHandler handler) {
+    writeHandlers()[pin] = handler;
+}
+
+BlynkHandlerRegistration::BlynkHandlerRegistration(void (*connected)()) {
+    connectedHandler = connected;
+}
+
+// Blynk
+
+void SimBlynk::run() {
+    if (connectPending) {
+        connectPending = false;
+        if (connectedHandler) connectedHandler();
+    }
+
+    while (!_inbox.empty()) {
+        auto command = _inbox.front();
+        _inbox.pop_front();
+
+        auto it = writeHandlers().find(command.first);
+        if (it != writeHandlers().end()) {
+            it->second(BlynkParam(String(command.second)));
+        }
+    }
+}
+
+void SimBlynk::setConnected(bool connected) {
+    if (connected && !_connected) connectPending = true;
+    _connected = connected;
+    Serial.printf("[cloud] %s\n", connected ? "connected" : "disconnected");
+}
+
+void SimBlynk::command(int pin, const char *value) {
+    Serial.printf("[cloud] V%d <- %s%s\n", pin, value,
+                  _connected ? "" : " (offline, dropped)");
+    if (_connected) _inbox.emplace_back(pin, value);
+}
+
+void SimBlynk::record(int pin, const char *name, const char *value) {
+    if (pin < 0) {
+        Serial.printf("[cloud] event %s: %s\n", name, value);
+    } else {
+        Serial.printf("[cloud] V%d -> %s\n", pin, value);
+    }
+    _sent.push_back({sim::micros(), pin, name, value});
+}
+
+// Edgent
+
+// Mounting the storage partition and starting WiFi take most of a second
+void SimEdgent::begin() {
+    LittleFS.begin();
+    sim::sleep(600000);
+    Blynk.setConnected(true);
+}
+
+void SimEdgent::run() {
+    edgentTimer.run();
+    if (Blynk.connected()) Blynk.run();
+}
+
+// Same semantics as BlynkTimer: disabled timers keep their phase
+int BlynkTimer::setInterval(unsigned long interval, void (*fn)()) {
+    _timers.push_back({fn, interval, millis() + interval, true, true});
+    return _timers.size() - 1;
+}
+
+int BlynkTimer::setTimeout(unsigned long timeout, void (*fn)()) {
+    _timers.push_back({fn, timeout, millis() + timeout, true, false});
+    return _timers.size() - 1;
+}
+
+void BlynkTimer::enable(int id) {
+    if (id >= 0 && id < (int)_timers.size()) _timers[id].enabled = true;
+}
+
+void BlynkTimer::disable(int id) {
+    if (id >= 0 && id < (int)_timers.size()) _timers[id].enabled = false;
+}
+
+void BlynkTimer::run() {
+    unsigned long now = millis();
+    for (size_t i = 0; i < _timers.size(); i++) {
+        Timer &timer = _timers[i];
+        if (!timer.fn || now < timer.next) continue;
+
+        timer.next = now + timer.interval;
+        if (!timer.enabled) continue;
+        // fn() may add timers, so do not touch `timer` after calling it
+        void (*fn)() = timer.fn;
+        if (!timer.repeat) timer.fn = nullptr;
+        fn();
+    }
+}
+
+// Console
+
+void BlynkConsole::printf(const char *format, ...) {
+    char buff[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buff, sizeof(buff), format, args);
+    va_end(args);
+    Serial.print(buff);
+}
+
+bool BlynkConsole::run(const char *line) {
+    std::istringstream stream(line);
+    std::vector<std::string> words;
+    for (std::string word; stream >> word;) words.push_back(word);
+    if (words.empty()) return false;
+
+    auto it = _commands.find(words[0]);
+    if (it == _commands.end()) return false;
+
+    std::vector<const char *> argv;
+    for (size_t i = 1; i < words.size(); i++) argv.push_back(words[i].c_str());
+    it->second(argv.size(), argv.data());
+    return true;
+}
+
+// Firmware server
+
+// TLS decryption and copying on the receiving side
+static const uint64_t RECEIVE_US_PER_KB = 400;
+
+size_t Client::arrived() const {
+    uint64_t bytes = (sim::micros() - _start) * firmwareServer.linkRate / 1000000;
+    return min<size_t>(_from + bytes, _end);
+}
+
+int Client::available() { return arrived() - _pos; }
+
+bool Client::connected() { return _pos < _end; }
+
+int Client::read(uint8_t *buf, size_t size) {
+    size_t len = min<size_t>(size, available());
+    sim::busy(len * RECEIVE_US_PER_KB / 1024);
+    memcpy(buf, _body.data() + _pos, len);
+    _pos += len;
+    firmwareServer.bytesSent += len;
+    return len;
+}
+
+// Like scripts/compress_image.py, with the size and MD5 in an "SL" field
+static std::vector<uint8_t> gzip(const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> out = {0x1f, 0x8b, 8, 0x04 | 0x08, 0, 0, 0, 0, 2, 255};
+    auto u32 = [&out](uint32_t value) {
+        for (int i = 0; i < 4; i++) out.push_back(value >> (8 * i));
+    };
+    out.insert(out.end(), {24, 0, 'S', 'L', 20, 0});
+    u32(data.size());
+    md5_context_t hash;
+    esp_rom_md5_init(&hash);
+    esp_rom_md5_update(&hash, data.data(), data.size());
+    out.resize(out.size() + ESP_ROM_MD5_DIGEST_LEN);
+    esp_rom_md5_final(out.data() + out.size() - ESP_ROM_MD5_DIGEST_LEN, &hash);
+    const char name[] = "firmware.bin";
+    out.insert(out.end(), name, name + sizeof(name));
+
+    z_stream stream = {};
+    deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 9, Z_DEFAULT_STRATEGY);
+    size_t header = out.size();
+    out.resize(header + deflateBound(&stream, data.size()));
+    stream.next_in = const_cast<uint8_t *>(data.data());
+    stream.avail_in = data.size();
+    stream.next_out = out.data() + header;
+    stream.avail_out = out.size() - header;
+    deflate(&stream, Z_FINISH);
+    out.resize(header + stream.total_out);
+    deflateEnd(&stream);
+
+    u32(crc32(0, data.data(), data.size()));
+    u32(data.size());
+    return out;
+}
+
+void HTTPClient::addHeader(const String &name, const String &value) {
+    // Range is understood as "bytes=<from>-" only
+    if (name == "Range" && value.startsWith("bytes=")) {
+        _range = value.substring(6).toInt();
+    } else if (name == "x-Base-MD5") {
+        _baseMd5 = value;
+    } else if (name == "Accept-Encoding") {
+        _gzip = value.indexOf("gzip") >= 0;
+    }
+}
+
+int HTTPClient::GET() {
+    bool patch = !firmwareServer.patch.empty() && _baseMd5.length() &&
+                 _baseMd5 == firmwareServer.patchBase;
+    bool packed = firmwareServer.gzip && _gzip;
+    const std::vector<uint8_t> &source =
+        patch ? firmwareServer.patch : firmwareServer.image;
+    _stream._body = packed ? gzip(source) : source;
+    _plain = !patch && !packed;
+
+    size_t size = _stream._body.size();
+    if (patch) _range = 0;
+    if (_url != firmwareServer.url || _range > size) {
+        _code = HTTP_CODE_NOT_FOUND;
+        _size = -1;
+    } else {
+        _code = _range ? HTTP_CODE_PARTIAL_CONTENT : HTTP_CODE_OK;
+        _size = size - _range;
+    }
+    Serial.printf("[http] GET %s from %u: %d%s%s\n", _url.c_str(),
+                  (unsigned)_range, _code, patch ? ", patch" : "",
+                  packed ? ", gzip" : "");
+
+    _stream._start = sim::micros();
+    _stream._from = _stream._pos = _range;
+    _stream._end = size;
+    if (firmwareServer.dropAfter) {
+        _stream._end = min(size, _range + firmwareServer.dropAfter);
+    }
+    return _code;
+}
+
+String HTTPClient::header(const char *name) {
+    if (_code == HTTP_CODE_NOT_FOUND) return String();
+    if (!strcmp(name, "x-MD5")) return _plain ? firmwareServer.md5 : String();
+    if (!strcmp(name, "Content-Range") && _code == HTTP_CODE_PARTIAL_CONTENT) {
+        size_t size = _stream._body.size();
+        return String("bytes ") + (unsigned)_range + "-" +
+               (unsigned)(size - 1) + "/" + (unsigned)size;
+    }
+    return String();
+}
+
+// SysUtils
+
+void systemReboot() { ESP.restart(); }
+
+uint32_t BlynkCRC32(const void *data, size_t length, uint32_t previous) {
+    uint32_t crc = ~previous;
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    while (length--) {
+        crc ^= *bytes++;
+        for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+String timeSpanToStr(const uint64_t t) {
+    unsigned secs = t % 60;
+    unsigned mins = (t / 60) % 60;
+    unsigned hrs = (t % (24UL * 3600UL)) / 3600UL;
+    unsigned days = (t / (24UL * 3600UL));
+
+    char buff[32];
+    snprintf(buff, sizeof(buff), "%ud %uh %um %us", days, hrs, mins, secs);
+    return buff;
+}
@@ -0,0 +1,302 @@
+#include <Arduino.h>
+#include <zlib.h>
+
+#include <vector>
+
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_rom_md5.h"
+#include "rom/miniz.h"
+
+// Rough costs on the ESP32's SPI flash, all with the caches off
+static const uint64_t SECTOR_ERASE_US = 45000;  // 4 KB
+static const uint64_t BLOCK_ERASE_US = 400000;  // 64 KB
+static const uint64_t PAGE_WRITE_US = 600;      // 256 bytes
+
+static const uint32_t SECTOR_SIZE = 4096;
+static const uint32_t BLOCK_SIZE = 65536;
+static const uint32_t PAGE_SIZE = 256;
+
+// Partitions
+
+static const esp_partition_t appPartitions[2] = {
+    {0x10000, 0x1E0000, "app0"},
+    {0x1F0000, 0x1E0000, "app1"},
+};
+static std::vector<uint8_t> flash[2];
+static const esp_partition_t *bootPartition = &appPartitions[0];
+
+static std::vector<uint8_t> *contents(const esp_partition_t *partition) {
+    for (int i = 0; i < 2; i++) {
+        if (partition != &appPartitions[i]) continue;
+        if (flash[i].empty()) flash[i].assign(partition->size, 0);
+        return &flash[i];
+    }
+    return nullptr;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition,
+                                    size_t offset, size_t size) {
+    std::vector<uint8_t> *data = contents(partition);
+    if (!data || offset % SECTOR_SIZE || size % SECTOR_SIZE ||
+        offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Whole aligned blocks go in one command, like spi_flash_erase_range()
+    for (size_t at = offset; at < offset + size;) {
+        bool block = at % BLOCK_SIZE == 0 && offset + size - at >= BLOCK_SIZE;
+        size_t len = block ? BLOCK_SIZE : SECTOR_SIZE;
+        sim::busy(block ? BLOCK_ERASE_US : SECTOR_ERASE_US, true);
+        memset(data->data() + at, 0xFF, len);
+        at += len;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition,
+                              size_t dst_offset, const void *src, size_t size) {
+    std::vector<uint8_t> *data = contents(partition);
+    if (!data || dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const uint8_t *bytes = static_cast<const uint8_t *>(src);
+    while (size) {
+        size_t len = min<size_t>(size, PAGE_SIZE - dst_offset % PAGE_SIZE);
+        sim::busy(PAGE_WRITE_US, true);
+        for (size_t i = 0; i < len; i++) (*data)[dst_offset + i] &= bytes[i];
+        dst_offset += len;
+        bytes += len;
+        size -= len;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition,
+                             size_t src_offset, void *dst, size_t size) {
+    std::vector<uint8_t> *data = contents(partition);
+    if (!data || src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, data->data() + src_offset, size);
+    return ESP_OK;
+}
+
+namespace sim {
+
+const uint8_t *partitionData(const esp_partition_t *partition) {
+    std::vector<uint8_t> *data = contents(partition);
+    return data ? data->data() : nullptr;
+}
+
+void loadPartition(const esp_partition_t *partition, const uint8_t *data,
+                   size_t len) {
+    std::vector<uint8_t> *flashed = contents(partition);
+    memset(flashed->data(), 0xFF, flashed->size());
+    memcpy(flashed->data(), data, len);
+}
+
+}  // namespace sim
+
+// OTA
+
+const esp_partition_t *esp_ota_get_running_partition() {
+    return &appPartitions[0];
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(
+    const esp_partition_t *start_from) {
+    return &appPartitions[1];
+}
+
+const esp_partition_t *esp_ota_get_boot_partition() { return bootPartition; }
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+    std::vector<uint8_t> *data = contents(partition);
+    if (!data || (*data)[0] != 0xE9) return ESP_FAIL;
+    bootPartition = partition;
+    return ESP_OK;
+}
+
+// CRC-32, same polynomial and conditioning as zlib
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// MD5, RFC 1321
+
+static uint32_t rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+static void md5Block(uint32_t state[4], const uint8_t block[64]) {
+    static const uint32_t K[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+        0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+        0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+        0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+        0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+        0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+        0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+        0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+        0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+    static const int R[16] = {7, 12, 17, 22, 5, 9,  14, 20,
+                              4, 11, 16, 23, 6, 10, 15, 21};
+
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = block[4 * i] | block[4 * i + 1] << 8 | block[4 * i + 2] << 16 |
+               (uint32_t)block[4 * i + 3] << 24;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+        switch (i / 16) {
+            case 0:
+                f = (b & c) | (~b & d);
+                g = i;
+                break;
+            case 1:
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) % 16;
+                break;
+            case 2:
+                f = b ^ c ^ d;
+                g = (3 * i + 5) % 16;
+                break;
+            default:
+                f = c ^ (b | ~d);
+                g = (7 * i) % 16;
+                break;
+        }
+        uint32_t next = d;
+        d = c;
+        c = b;
+        b += rotl(a + f + K[i] + m[g], R[(i / 16) * 4 + i % 4]);
+        a = next;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+void esp_rom_md5_init(md5_context_t *context) {
+    context->buf[0] = 0x67452301;
+    context->buf[1] = 0xefcdab89;
+    context->buf[2] = 0x98badcfe;
+    context->buf[3] = 0x10325476;
+    context->bits[0] = context->bits[1] = 0;
+}
+
+void esp_rom_md5_update(md5_context_t *context, const void *buf,
+                        uint32_t len) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(buf);
+    uint32_t used = (context->bits[0] >> 3) & 63;
+    uint64_t bits = ((uint64_t)context->bits[1] << 32 | context->bits[0]) +
+                    (uint64_t)len * 8;
+    context->bits[0] = bits;
+    context->bits[1] = bits >> 32;
+
+    while (len) {
+        uint32_t n = min(len, 64 - used);
+        memcpy(context->in + used, bytes, n);
+        used += n;
+        bytes += n;
+        len -= n;
+        if (used == 64) {
+            md5Block(context->buf, context->in);
+            used = 0;
+        }
+    }
+}
+
+void esp_rom_md5_final(uint8_t *digest, md5_context_t *context) {
+    uint8_t length[8];
+    for (int i = 0; i < 4; i++) {
+        length[i] = context->bits[0] >> (8 * i);
+        length[4 + i] = context->bits[1] >> (8 * i);
+    }
+
+    static const uint8_t padding[64] = {0x80};
+    uint32_t used = (context->bits[0] >> 3) & 63;
+    esp_rom_md5_update(context, padding, used < 56 ? 56 - used : 120 - used);
+    esp_rom_md5_update(context, length, 8);
+
+    for (int i = 0; i < 16; i++) digest[i] = context->buf[i / 4] >> (8 * (i % 4));
+}
+
+// Inflate, the ROM's tinfl on top of zlib
+
+// Decoding in the ROM, per KB of output
+static const uint64_t INFLATE_US_PER_KB = 100;
+
+static z_stream inflateStream;
+static bool inflateReady = false;
+static uint8_t inflateLastByte = 0;
+
+void tinfl_init(tinfl_decompressor *r) {
+    r->m_state = 0;
+    r->m_num_bits = 0;
+    r->m_bit_buf = 0;
+    if (inflateReady) {
+        inflateReset(&inflateStream);
+    } else {
+        inflateReady = inflateInit2(&inflateStream, -MAX_WBITS) == Z_OK;
+    }
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r,
+                              const mz_uint8 *pIn_buf_next,
+                              size_t *pIn_buf_size, mz_uint8 *pOut_buf_start,
+                              mz_uint8 *pOut_buf_next, size_t *pOut_buf_size,
+                              const mz_uint32 decomp_flags) {
+    if (!inflateReady || r->m_state) {
+        *pIn_buf_size = *pOut_buf_size = 0;
+        return r->m_state ? TINFL_STATUS_DONE : TINFL_STATUS_FAILED;
+    }
+
+    inflateStream.next_in = const_cast<uint8_t *>(pIn_buf_next);
+    inflateStream.avail_in = *pIn_buf_size;
+    inflateStream.next_out = pOut_buf_next;
+    inflateStream.avail_out = *pOut_buf_size;
+    int result = inflate(&inflateStream, Z_NO_FLUSH);
+
+    size_t used = *pIn_buf_size - inflateStream.avail_in;
+    if (used) inflateLastByte = pIn_buf_next[used - 1];
+    *pOut_buf_size -= inflateStream.avail_out;
+    sim::busy(*pOut_buf_size * INFLATE_US_PER_KB / 1024);
+
+    if (result == Z_STREAM_END) {
+        // The ROM decoder refills its bit buffer 32 bits at a time, so the
+        // unused top of the last byte and up to four more can sit in it
+        uint32_t spare = inflateStream.data_type & 7;
+        r->m_bit_buf = inflateLastByte >> (8 - spare);
+        r->m_num_bits = spare;
+        for (int i = 0; i < 4 && used < *pIn_buf_size; i++) {
+            r->m_bit_buf |= (tinfl_bit_buf_t)pIn_buf_next[used++]
+                            << r->m_num_bits;
+            r->m_num_bits += 8;
+        }
+        *pIn_buf_size = used;
+        r->m_state = 1;
+        return TINFL_STATUS_DONE;
+    }
+
+    *pIn_buf_size = used;
+    if (result != Z_OK && result != Z_BUF_ERROR) return TINFL_STATUS_FAILED;
+    if (!inflateStream.avail_out) return TINFL_STATUS_HAS_MORE_OUTPUT;
+    return (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT)
+               ? TINFL_STATUS_NEEDS_MORE_INPUT
+               : TINFL_STATUS_FAILED;
+}
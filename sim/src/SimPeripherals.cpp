@@ -0,0 +1,486 @@
+#include <Adafruit_Fingerprint.h>
+#include <Arduino.h>
+#include <ESP32Servo.h>
+#include <Keypad.h>
+#include <LiquidCrystal_I2C.h>
+#include <Preferences.h>
+
+#include <new>
+#include <random>
+#include <vector>
+
+#include "esp_system.h"
+#include "mbedtls/sha256.h"
+
+HardwareSerial Serial;
+HardwareSerial Serial2;
+EspClass ESP;
+
+// Arduino core
+
+size_t HardwareSerial::write(const char *text) {
+    size_t written = 0;
+    for (; *text; text++, written++) {
+        if (_lineStart) {
+            ::printf("[%9.3f] ", sim::micros() / 1e6);
+            _lineStart = false;
+        }
+        putchar(*text);
+        if (*text == '\n') _lineStart = true;
+    }
+    return written;
+}
+
+size_t HardwareSerial::printf(const char *format, ...) {
+    char buff[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buff, sizeof(buff), format, args);
+    va_end(args);
+    return write(buff);
+}
+
+static std::vector<shutdown_handler_t> shutdownHandlers;
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle) {
+    shutdownHandlers.push_back(handle);
+    return 0;
+}
+
+void EspClass::restart() {
+    for (shutdown_handler_t handler : shutdownHandlers) handler();
+    exit(0);
+}
+
+void esp_fill_random(void *buf, size_t len) {
+    // Fixed seed, so every run of the simulation is the same
+    static std::mt19937 rng(0x5EED);
+    uint8_t *bytes = static_cast<uint8_t *>(buf);
+    for (size_t i = 0; i < len; i++) bytes[i] = rng();
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) { sim::setPinLevel(pin, value); }
+
+int digitalRead(uint8_t pin) { return sim::pinLevel(pin); }
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg,
+                        int mode) {
+    sim::attachInterrupt(pin, handler, arg, mode);
+}
+
+// Heap, counted so allocation-free code can be checked
+
+void *operator new(size_t size) {
+    sim::counters().heapAllocs++;
+    sim::counters().heapBytes += size;
+    if (void *p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// Keypad
+
+Keypad::Keypad(char *userKeymap, byte *row, byte *col, byte numRows,
+               byte numCols)
+    : _keymap(userKeymap),
+      _rowPins(row),
+      _colPins(col),
+      _rows(numRows),
+      _cols(numCols) {}
+
+bool Keypad::locate(char c, uint8_t &row, uint8_t &col) const {
+    for (row = 0; row < _rows; row++) {
+        for (col = 0; col < _cols; col++) {
+            if (_keymap[row * _cols + col] == c) return true;
+        }
+    }
+    return false;
+}
+
+bool Keypad::held(char c) const {
+    uint8_t row, col;
+    return locate(c, row, col) && _held[row][col];
+}
+
+bool Keypad::press(char c) {
+    uint8_t row, col;
+    if (!locate(c, row, col) || _held[row][col]) return false;
+    _held[row][col] = true;
+    sim::setPinLevel(_colPins[col], LOW);
+    return true;
+}
+
+bool Keypad::release(char c) {
+    uint8_t row, col;
+    if (!locate(c, row, col) || !_held[row][col]) return false;
+    _held[row][col] = false;
+
+    for (uint8_t r = 0; r < _rows; r++) {
+        if (_held[r][col]) return true;
+    }
+    sim::setPinLevel(_colPins[col], HIGH);
+    return true;
+}
+
+// Same list semantics as the library: PRESSED, then RELEASED, then the
+// slot is freed as IDLE
+bool Keypad::getKeys() {
+    bool changed = false;
+    for (uint8_t i = 0; i < LIST_MAX; i++) {
+        Key &k = key[i];
+        k.stateChanged = false;
+        if (k.kchar == NO_KEY) continue;
+
+        if (k.kstate == RELEASED) {
+            k = Key();
+            k.stateChanged = changed = true;
+        } else if (!held(k.kchar)) {
+            k.kstate = RELEASED;
+            k.stateChanged = changed = true;
+        }
+    }
+
+    for (uint8_t r = 0; r < _rows; r++) {
+        for (uint8_t c = 0; c < _cols; c++) {
+            char kchar = _keymap[r * _cols + c];
+            if (!_held[r][c]) continue;
+
+            bool listed = false;
+            for (uint8_t i = 0; i < LIST_MAX; i++) {
+                if (key[i].kchar == kchar) listed = true;
+            }
+            for (uint8_t i = 0; i < LIST_MAX && !listed; i++) {
+                if (key[i].kchar != NO_KEY) continue;
+                key[i].kchar = kchar;
+                key[i].kcode = r * _cols + c;
+                key[i].kstate = PRESSED;
+                key[i].stateChanged = changed = true;
+                listed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+char Keypad::getKey() {
+    if (getKeys() && key[0].stateChanged && key[0].kstate == PRESSED) {
+        return key[0].kchar;
+    }
+    return NO_KEY;
+}
+
+// Fingerprint sensor
+
+void Adafruit_Fingerprint::command() {
+    sim::counters().sensorCommands++;
+    sim::sleep(COMMAND_US);
+}
+
+uint8_t Adafruit_Fingerprint::getParameters() {
+    command();
+    capacity = LIBRARY_SIZE;
+    return FINGERPRINT_OK;
+}
+
+uint8_t Adafruit_Fingerprint::getImage() {
+    command();
+    if (_onGlass == NONE) return FINGERPRINT_NOFINGER;
+    _image = _onGlass;
+    return FINGERPRINT_OK;
+}
+
+uint8_t Adafruit_Fingerprint::image2Tz(uint8_t slot) {
+    command();
+    if (_image == NONE || slot < 1 || slot > 2) {
+        return FINGERPRINT_FEATUREFAIL;
+    }
+    _buffers[slot] = _image;
+    return FINGERPRINT_OK;
+}
+
+uint8_t Adafruit_Fingerprint::createModel() {
+    command();
+    if (_buffers[1] == NONE || _buffers[1] != _buffers[2]) {
+        return FINGERPRINT_ENROLLMISMATCH;
+    }
+    return FINGERPRINT_OK;
+}
+
+uint8_t Adafruit_Fingerprint::storeModel(uint16_t id) {
+    command();
+    if (id >= LIBRARY_SIZE) return FINGERPRINT_BADLOCATION;
+    _library[id] = _buffers[1];
+    return FINGERPRINT_OK;
+}
+
+uint8_t Adafruit_Fingerprint::loadModel(uint16_t id) {
+    command();
+    auto it = _library.find(id);
+    if (it == _library.end()) return FINGERPRINT_DBREADFAIL;
+    _buffers[1] = it->second;
+    return FINGERPRINT_OK;
+}
+
+uint8_t Adafruit_Fingerprint::deleteModel(uint16_t id) {
+    command();
+    _library.erase(id);
+    return FINGERPRINT_OK;
+}
+
+uint8_t Adafruit_Fingerprint::emptyDatabase() {
+    command();
+    _library.clear();
+    return FINGERPRINT_OK;
+}
+
+uint8_t Adafruit_Fingerprint::fingerFastSearch() {
+    command();
+    for (const auto &entry : _library) {
+        if (entry.second == _buffers[1]) {
+            fingerID = entry.first;
+            confidence = 120;
+            return FINGERPRINT_OK;
+        }
+    }
+    return FINGERPRINT_NOTFOUND;
+}
+
+void Adafruit_Fingerprint::writeStructuredPacket(
+    const Adafruit_Fingerprint_Packet &packet) {
+    memcpy(_request, packet.data, sizeof(_request));
+}
+
+uint8_t Adafruit_Fingerprint::getStructuredPacket(
+    Adafruit_Fingerprint_Packet *packet, uint16_t timeout) {
+    command();
+    if (_request[0] != FINGERPRINT_READINDEXTABLE) return FINGERPRINT_TIMEOUT;
+
+    // One page of the occupancy bitmap, 256 slots
+    uint16_t first = _request[1] * 256;
+    packet->type = FINGERPRINT_ACKPACKET;
+    memset(packet->data, 0, sizeof(packet->data));
+    packet->data[0] = FINGERPRINT_OK;
+    for (const auto &entry : _library) {
+        uint16_t id = entry.first;
+        if (id < first || id >= first + 256) continue;
+        packet->data[1 + (id - first) / 8] |= 1 << ((id - first) % 8);
+    }
+    return FINGERPRINT_OK;
+}
+
+// LCD
+
+void LiquidCrystal_I2C::clear() {
+    memset(_ddram, ' ', sizeof(_ddram));
+    _col = _row = 0;
+}
+
+void LiquidCrystal_I2C::setCursor(uint8_t col, uint8_t row) {
+    _col = col;
+    _row = row;
+}
+
+size_t LiquidCrystal_I2C::write(uint8_t c) {
+    sim::counters().lcdWrites++;
+    if (_row < _rows && _col < MAX_COLS) _ddram[_row][_col] = c;
+    _col++;
+    return 1;
+}
+
+size_t LiquidCrystal_I2C::print(const char *text) {
+    size_t written = 0;
+    for (; *text; text++) written += write(*text);
+    return written;
+}
+
+String LiquidCrystal_I2C::line(uint8_t row) const {
+    if (row >= _rows) return String();
+    return String(std::string(_ddram[row], _cols));
+}
+
+// Servo
+
+void Servo::write(int angle) {
+    sim::counters().servoWrites++;
+    _angle = angle;
+    _lastWrite = sim::micros();
+    Serial.printf("[sim] servo -> %d\n", angle);
+}
+
+// NVS
+
+static std::map<std::string, std::map<std::string, std::string>> nvs;
+
+bool Preferences::begin(const char *name, bool readOnly) {
+    sim::counters().nvsOpens++;
+    _ns = &nvs[name];
+    _readOnly = readOnly;
+    return true;
+}
+
+bool Preferences::clear() {
+    if (!_ns || _readOnly) return false;
+    _ns->clear();
+    return true;
+}
+
+bool Preferences::remove(const char *key) {
+    if (!_ns || _readOnly) return false;
+    return _ns->erase(key) > 0;
+}
+
+bool Preferences::isKey(const char *key) { return _ns && _ns->count(key); }
+
+size_t Preferences::putString(const char *key, const String &value) {
+    if (!_ns || _readOnly) return 0;
+    sim::counters().nvsWrites++;
+    (*_ns)[key] = value.c_str();
+    return value.length();
+}
+
+String Preferences::getString(const char *key, const String &defaultValue) {
+    if (!isKey(key)) return defaultValue;
+    return String((*_ns)[key]);
+}
+
+size_t Preferences::putBool(const char *key, bool value) {
+    if (!_ns || _readOnly) return 0;
+    sim::counters().nvsWrites++;
+    (*_ns)[key] = value ? "1" : "0";
+    return 1;
+}
+
+bool Preferences::getBool(const char *key, bool defaultValue) {
+    if (!isKey(key)) return defaultValue;
+    return (*_ns)[key] == "1";
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) {
+    if (!_ns || _readOnly) return 0;
+    sim::counters().nvsWrites++;
+    (*_ns)[key].assign(static_cast<const char *>(value), len);
+    return len;
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    return isKey(key) ? (*_ns)[key].size() : 0;
+}
+
+// Like NVS, a buffer too small for the blob gets nothing
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen) {
+    if (!isKey(key) || (*_ns)[key].size() > maxLen) return 0;
+    const std::string &value = (*_ns)[key];
+    memcpy(buf, value.data(), value.size());
+    return value.size();
+}
+
+// SHA-256, FIPS 180-4
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha256Block(mbedtls_sha256_context *ctx, const uint8_t *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2],
+             d = ctx->state[3], e = ctx->state[4], f = ctx->state[5],
+             g = ctx->state[6], h = ctx->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) +
+                      ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context *ctx, int is224) {
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                        0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                        0x1f83d9ab, 0x5be0cd19};
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->total = 0;
+    return 0;
+}
+
+int mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx,
+                              const unsigned char *input, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        ctx->buffer[ctx->total++ % 64] = input[i];
+        if (ctx->total % 64 == 0) sha256Block(ctx, ctx->buffer);
+    }
+    return 0;
+}
+
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context *ctx,
+                              unsigned char output[32]) {
+    uint64_t bits = ctx->total * 8;
+    uint8_t pad = 0x80;
+    mbedtls_sha256_update_ret(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->total % 64 != 56) mbedtls_sha256_update_ret(ctx, &pad, 1);
+    for (int i = 7; i >= 0; i--) {
+        uint8_t byte = bits >> (i * 8);
+        mbedtls_sha256_update_ret(ctx, &byte, 1);
+    }
+    for (int i = 0; i < 8; i++) {
+        output[i * 4] = ctx->state[i] >> 24;
+        output[i * 4 + 1] = ctx->state[i] >> 16;
+        output[i * 4 + 2] = ctx->state[i] >> 8;
+        output[i * 4 + 3] = ctx->state[i];
+    }
+    return 0;
+}
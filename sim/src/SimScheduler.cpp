@@ -0,0 +1,271 @@
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Sim.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+struct SimTask {
+    std::string name;
+    unsigned priority;
+    std::condition_variable cv;
+    bool blocked = false;
+    uint64_t deadline = sim::FOREVER;
+    std::function<bool()> ready;
+    uint32_t notifications = 0;
+};
+
+struct SimQueue {
+    size_t length;
+    size_t itemSize;
+    std::deque<std::vector<uint8_t>> items;
+};
+
+struct SimMutex {
+    bool held;
+};
+
+namespace {
+
+const uint64_t TICK_US = 1000;
+
+std::mutex schedulerMutex;
+std::vector<SimTask *> tasks;
+SimTask *running = nullptr;
+uint64_t now = 0;
+
+struct Interrupt {
+    void (*handler)(void *);
+    void *arg;
+    int mode;
+};
+std::map<uint8_t, int> pinLevels;
+std::map<uint8_t, Interrupt> interrupts;
+
+sim::Counters simCounters = {};
+
+bool runnable(SimTask *task) {
+    return !task->blocked || now >= task->deadline ||
+           (task->ready && task->ready());
+}
+
+// Highest priority wins. Equal priorities are tried starting after the
+// task that is giving up the CPU, so peers take turns.
+SimTask *pick(SimTask *self) {
+    size_t start = 0;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        if (tasks[i] == self) start = i + 1;
+    }
+
+    SimTask *best = nullptr;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        SimTask *task = tasks[(start + i) % tasks.size()];
+        if (runnable(task) && (!best || task->priority > best->priority)) {
+            best = task;
+        }
+    }
+    return best;
+}
+
+// Called by the running task with the scheduler lock held. Returns once
+// this task has been picked to run again.
+void switchFrom(SimTask *self, std::unique_lock<std::mutex> &lock) {
+    SimTask *next;
+    while (!(next = pick(self))) {
+        uint64_t soonest = sim::FOREVER;
+        for (SimTask *task : tasks) {
+            soonest = std::min(soonest, task->deadline);
+        }
+        if (soonest == sim::FOREVER) {
+            fprintf(stderr, "sim: every task is blocked forever\n");
+            fflush(stdout);
+            _Exit(3);
+        }
+        now = std::max(now, soonest);
+    }
+
+    if (next != self) {
+        running = next;
+        next->cv.notify_one();
+        self->cv.wait(lock, [self] { return running == self; });
+    }
+}
+
+}  // namespace
+
+namespace sim {
+
+uint64_t micros() { return now; }
+
+void init() {
+    std::lock_guard<std::mutex> lock(schedulerMutex);
+    SimTask *loopTask = new SimTask();
+    loopTask->name = "loopTask";
+    loopTask->priority = 1;
+    tasks.push_back(loopTask);
+    running = loopTask;
+}
+
+SimTask *spawn(void (*fn)(void *), const char *name, void *param,
+               unsigned priority) {
+    SimTask *task = new SimTask();
+    task->name = name;
+    task->priority = priority;
+    {
+        std::lock_guard<std::mutex> lock(schedulerMutex);
+        tasks.push_back(task);
+    }
+
+    std::thread([task, fn, param] {
+        {
+            std::unique_lock<std::mutex> lock(schedulerMutex);
+            task->cv.wait(lock, [task] { return running == task; });
+        }
+        fn(param);
+        // FreeRTOS tasks never return, park this one for good
+        block(FOREVER, nullptr);
+    }).detach();
+    return task;
+}
+
+SimTask *currentTask() { return running; }
+
+unsigned taskCount() { return tasks.size(); }
+
+bool block(uint64_t deadline, const std::function<bool()> &ready) {
+    std::unique_lock<std::mutex> lock(schedulerMutex);
+    SimTask *self = running;
+    if (ready && ready()) return true;
+    if (deadline <= now) return false;
+
+    self->blocked = true;
+    self->deadline = deadline;
+    self->ready = ready;
+    switchFrom(self, lock);
+    self->blocked = false;
+    self->deadline = FOREVER;
+    self->ready = nullptr;
+    return ready && ready();
+}
+
+void sleep(uint64_t us) { block(now + us, nullptr); }
+
+void busy(uint64_t us, bool exclusive) {
+    while (us) {
+        uint64_t slice = exclusive ? us : std::min(us, TICK_US - now % TICK_US);
+        {
+            std::lock_guard<std::mutex> lock(schedulerMutex);
+            now += slice;
+        }
+        us -= slice;
+        yield();
+    }
+}
+
+void yield() {
+    std::unique_lock<std::mutex> lock(schedulerMutex);
+    switchFrom(running, lock);
+}
+
+void notify(SimTask *task) {
+    std::lock_guard<std::mutex> lock(schedulerMutex);
+    if (task) task->notifications++;
+}
+
+uint32_t takeNotify(bool clear, uint64_t deadline) {
+    SimTask *self = running;
+    block(deadline, [self] { return self->notifications > 0; });
+
+    std::lock_guard<std::mutex> lock(schedulerMutex);
+    uint32_t value = self->notifications;
+    if (value) self->notifications = clear ? 0 : value - 1;
+    return value;
+}
+
+void setPinLevel(uint8_t pin, int level) {
+    int previous = pinLevel(pin);
+    pinLevels[pin] = level;
+
+    auto it = interrupts.find(pin);
+    if (it == interrupts.end() || previous == level) return;
+    const Interrupt &interrupt = it->second;
+    bool rising = level != 0;
+    if (interrupt.mode == 0x03 || (rising && interrupt.mode == 0x01) ||
+        (!rising && interrupt.mode == 0x02)) {
+        interrupt.handler(interrupt.arg);
+    }
+}
+
+int pinLevel(uint8_t pin) {
+    auto it = pinLevels.find(pin);
+    return it == pinLevels.end() ? 1 : it->second;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void *), void *arg,
+                     int mode) {
+    interrupts[pin] = {handler, arg, mode};
+}
+
+Counters &counters() { return simCounters; }
+
+}  // namespace sim
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    return new SimQueue{length, itemSize, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    if (!sim::block(simDeadline(ticks), [queue] {
+            return queue->items.size() < queue->length;
+        })) {
+        return errQUEUE_FULL;
+    }
+    const uint8_t *bytes = static_cast<const uint8_t *>(item);
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    if (!sim::block(simDeadline(ticks),
+                    [queue] { return !queue->items.empty(); })) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    return queue->items.size();
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    queue->items.clear();
+    return pdPASS;
+}
+
+// Only one task runs at a time, so whoever wakes up to a free mutex can
+// take it before anyone else looks
+SemaphoreHandle_t xSemaphoreCreateMutex() { return new SimMutex{false}; }
+
+SemaphoreHandle_t xSemaphoreCreateBinary() { return new SimMutex{true}; }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks) {
+    if (!sim::block(simDeadline(ticks), [mutex] { return !mutex->held; })) {
+        return pdFALSE;
+    }
+    mutex->held = true;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) {
+    if (!mutex->held) return pdFALSE;
+    mutex->held = false;
+    return pdTRUE;
+}
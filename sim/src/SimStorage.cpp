@@ -0,0 +1,74 @@
+#include <LittleFS.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SimFS LittleFS;
+
+// File
+
+size_t File::read(uint8_t *buf, size_t size) {
+    return _f ? fread(buf, 1, size, _f.get()) : 0;
+}
+
+size_t File::write(const uint8_t *buf, size_t size) {
+    if (!_f) return 0;
+    size_t written = fwrite(buf, 1, size, _f.get());
+    fflush(_f.get());
+    return written;
+}
+
+size_t File::size() const {
+    struct stat st;
+    if (!_f || fstat(fileno(_f.get()), &st) != 0) return 0;
+    return st.st_size;
+}
+
+// Filesystem
+
+bool SimFS::begin() {
+    if (!_root.empty()) return true;
+    char root[] = "/tmp/smartlock-sim-XXXXXX";
+    if (!mkdtemp(root)) return false;
+    _root = root;
+    return true;
+}
+
+void SimFS::end() {
+    if (_root.empty()) return;
+    if (DIR *dir = opendir(_root.c_str())) {
+        while (dirent *entry = readdir(dir)) {
+            if (entry->d_name[0] == '.') continue;
+            unlink((_root + "/" + entry->d_name).c_str());
+        }
+        closedir(dir);
+    }
+    rmdir(_root.c_str());
+    _root.clear();
+}
+
+File SimFS::open(const char *path, const char *mode) {
+    if (_root.empty()) return File();
+    FILE *f = fopen(hostPath(path).c_str(), mode);
+    return f ? File(f) : File();
+}
+
+bool SimFS::exists(const char *path) {
+    struct stat st;
+    return !_root.empty() && stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool SimFS::remove(const char *path) {
+    return !_root.empty() && unlink(hostPath(path).c_str()) == 0;
+}
+
+bool SimFS::truncate(const char *path, size_t size) {
+    return !_root.empty() && ::truncate(hostPath(path).c_str(), size) == 0;
+}
+
+size_t SimFS::fileSize(const char *path) {
+    struct stat st;
+    if (_root.empty() || stat(hostPath(path).c_str(), &st) != 0) return 0;
+    return st.st_size;
+}
@@ -0,0 +1,806 @@
+#include <Adafruit_Fingerprint.h>
+#include <Arduino.h>
+#include <ESP32Servo.h>
+#include <JsonWriter.h>
+#include <Keypad.h>
+#include <LiquidCrystal_I2C.h>
+#include <SimEdgent.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+// The sketch owns eventJournal, the journal scenario drives its own copy
+// over the same files once the sketch's journal has drained
+#define eventJournal scenarioJournal
+#include <EventJournal.h>
+#undef eventJournal
+
+// The firmware update code as shipped, fetching from firmwareServer
+#include <BlynkState.h>
+#include <HTTPClient.h>
+#include <OTA.h>
+
+// The config record as shipped, over the NVS fake. The sketch gets these
+// from Settings.h.
+#define BLYNK_FIRMWARE_VERSION "0.1.0"
+#define CONFIG_DEFAULT_SERVER "blynk.cloud"
+#define CONFIG_DEFAULT_PORT 443
+#include <ConfigStore.h>
+
+// BlynkEdgent.h runs the state machine on the device
+void BlynkState::set(State m) { state = m; }
+
+/*
+ * Host run of the lock firmware. setup() and loop() run on the simulated
+ * loop task, while the Stimulus task plays a user at the door and a phone
+ * on the other end of the cloud. Each scenario prints what it observed in
+ * virtual time; the whole script covers about ten minutes of device time.
+ */
+
+void setup();
+void loop();
+
+extern Keypad keypad;
+extern Adafruit_Fingerprint finger;
+extern LiquidCrystal_I2C lcd;
+extern Servo lockServo;
+
+namespace {
+
+const int LOCKED = 90;  // LOCK_POSITION in the sketch
+const int UNLOCKED = 0;
+
+const uint32_t OTA_IMAGE_SIZE = 0x1C0000;
+
+unsigned failures = 0;
+
+void wait(unsigned long ms) { sim::sleep((uint64_t)ms * 1000); }
+
+// Polls every 5 ms of virtual time, returns the wait in ms or -1
+long waitFor(const std::function<bool()> &condition, unsigned long timeout) {
+    uint64_t start = sim::micros();
+    while (!condition()) {
+        if (sim::micros() - start >= (uint64_t)timeout * 1000) return -1;
+        wait(5);
+    }
+    return (sim::micros() - start) / 1000;
+}
+
+bool showing(const char *text) {
+    return strstr(lcd.line(0).c_str(), text) ||
+           strstr(lcd.line(1).c_str(), text);
+}
+
+bool cloudSaw(int pin, const char *text) {
+    for (const BlynkSent &sent : Blynk.sent()) {
+        if (sent.pin == pin && strstr(sent.value.c_str(), text)) return true;
+    }
+    return false;
+}
+
+void scenario(const char *name) { Serial.printf("[sim] === %s\n", name); }
+
+void check(bool ok, const char *what) {
+    Serial.printf("[sim] %s: %s\n", ok ? "ok" : "FAILED", what);
+    if (!ok) failures++;
+}
+
+// Leaves no files behind, and skips the destructors of running tasks
+void finish() {
+    fflush(stdout);
+    LittleFS.end();
+    _Exit(failures ? 1 : 0);
+}
+
+void type(const char *keys) {
+    for (; *keys; keys++) {
+        keypad.press(*keys);
+        wait(60);
+        keypad.release(*keys);
+        wait(120);
+    }
+}
+
+// A portal scan reply: 15 networks, one name that needs escaping
+struct ScanResult {
+    const char *ssid;
+    const char *bssid;
+    int rssi;
+    int ch;
+};
+
+const ScanResult SCAN[] = {
+    {"Cafe \"Guest\" \\ 5G", "AA:BB:CC:00:00:01", -41, 6},
+    {"HomeNet", "AA:BB:CC:00:00:02", -48, 1},
+    {"Office-2.4", "AA:BB:CC:00:00:03", -52, 11},
+    {"Printer_7F", "AA:BB:CC:00:00:04", -55, 6},
+    {"TP-Link_9C42", "AA:BB:CC:00:00:05", -58, 3},
+    {"Neighbour", "AA:BB:CC:00:00:06", -61, 1},
+    {"Guest", "AA:BB:CC:00:00:07", -63, 9},
+    {"IoT", "AA:BB:CC:00:00:08", -66, 6},
+    {"Hallway AP", "AA:BB:CC:00:00:09", -68, 11},
+    {"Mesh-Node-3", "AA:BB:CC:00:00:0A", -70, 1},
+    {"FreeWiFi", "AA:BB:CC:00:00:0B", -73, 13},
+    {"DIRECT-TV", "AA:BB:CC:00:00:0C", -75, 6},
+    {"Garage", "AA:BB:CC:00:00:0D", -79, 4},
+    {"Shop Floor", "AA:BB:CC:00:00:0E", -84, 8},
+    {"Far Away", "AA:BB:CC:00:00:0F", -90, 12},
+};
+
+// Keeps what it is given in a fixed buffer, like the portal's chunk buffer
+class CapturePrint : public Print {
+   public:
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t len) override {
+        for (size_t i = 0; i < len && _len + 1 < sizeof(_text); i++) {
+            _text[_len++] = data[i];
+        }
+        _text[_len] = '\0';
+        return len;
+    }
+    const char *text() const { return _text; }
+
+   private:
+    char _text[2048];
+    size_t _len = 0;
+};
+
+void benchmarkJson() {
+    // The /wifi_scan.json body as it used to be built
+    sim::Counters before = sim::counters();
+    String result = "[\n";
+    char buff[256];
+    for (size_t i = 0; i < sizeof(SCAN) / sizeof(SCAN[0]); i++) {
+        String ssid = SCAN[i].ssid;
+        ssid.replace("\"", "\\\"");
+        snprintf(buff, sizeof(buff),
+                 R"json(  {"ssid":"%s","bssid":"%s","rssi":%i,"sec":"%s","ch":%i})json",
+                 ssid.c_str(), SCAN[i].bssid, SCAN[i].rssi, "WPA2",
+                 SCAN[i].ch);
+        result += buff;
+        if (i != sizeof(SCAN) / sizeof(SCAN[0]) - 1) result += ",\n";
+    }
+    result = result + "\n]";
+    uint32_t stringAllocs = sim::counters().heapAllocs - before.heapAllocs;
+    uint64_t stringBytes = sim::counters().heapBytes - before.heapBytes;
+
+    before = sim::counters();
+    CapturePrint out;
+    JsonWriter json(out);
+    json.beginArray();
+    for (const ScanResult &net : SCAN) {
+        json.beginObject()
+            .member("ssid", net.ssid)
+            .member("bssid", net.bssid)
+            .member("rssi", net.rssi)
+            .member("sec", "WPA2")
+            .member("ch", net.ch)
+            .endObject();
+    }
+    json.endArray();
+    uint32_t writerAllocs = sim::counters().heapAllocs - before.heapAllocs;
+
+    Serial.printf("[sim] String: %u allocations, %llu bytes for %u bytes\n",
+                  stringAllocs, (unsigned long long)stringBytes,
+                  result.length());
+    Serial.printf("[sim] JsonWriter: %u allocations, %zu bytes written\n",
+                  writerAllocs, json.written());
+    check(writerAllocs == 0, "JsonWriter does not allocate");
+    check(strstr(out.text(), R"("ssid":"Cafe \"Guest\" \\ 5G")") != nullptr,
+          "quotes and backslashes escaped");
+    Serial.printf("[sim] String builder escaped backslashes: %s\n",
+                  strstr(result.c_str(), R"(\" \ 5G")") ? "no" : "yes");
+}
+
+std::vector<std::string> replayed;
+
+bool collect(const JournalRecord &record) {
+    replayed.push_back(record.text);
+    return true;
+}
+
+void appendNumbered(int from, int to) {
+    for (int i = from; i <= to; i++) {
+        String text = "#" + String(i);
+        scenarioJournal.append(JOURNAL_EVENT, 0, "test", text.c_str());
+    }
+}
+
+bool replayedRange(size_t at, int from, int to) {
+    for (int i = from; i <= to; i++, at++) {
+        if (at >= replayed.size() || replayed[at] != "#" + std::to_string(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Wrap-around, a write torn by a reset and the replay cursor, with begin()
+// standing in for a reboot
+void journalScenario() {
+    const char *active = "/journal0.bin";
+    scenarioJournal.begin(100);
+    check(scenarioJournal.pending() == 0, "journal starts empty");
+
+    // Two segments of 32: the 65th record reuses the first segment
+    appendNumbered(1, 70);
+    check(scenarioJournal.pending() == 38 &&
+              scenarioJournal.stats().dropped == 32,
+          "a full ring drops its oldest segment");
+
+    appendNumbered(71, 71);
+    size_t size = LittleFS.fileSize(active);
+    LittleFS.truncate(active, size - sizeof(JournalRecord) / 2);
+    scenarioJournal.begin(101);
+    check(scenarioJournal.pending() == 38, "torn record skipped on boot");
+
+    replayed.clear();
+    scenarioJournal.replay(10, collect);
+    check(replayedRange(0, 33, 42), "oldest surviving records replay first");
+    scenarioJournal.begin(102);
+    check(scenarioJournal.pending() == 28, "replay cursor survives a reboot");
+
+    // Lands after padding over the torn tail
+    appendNumbered(72, 72);
+    replayed.clear();
+    scenarioJournal.replay(64, collect);
+    check(replayed.size() == 29 && replayedRange(0, 43, 70) &&
+              replayedRange(28, 72, 72),
+          "replay resumes in order past the torn record");
+    check(!LittleFS.exists("/journal0.bin") &&
+              !LittleFS.exists("/journal1.bin"),
+          "drained journal deleted");
+}
+
+void md5(const std::vector<uint8_t> &data,
+         uint8_t digest[ESP_ROM_MD5_DIGEST_LEN]) {
+    md5_context_t hash;
+    esp_rom_md5_init(&hash);
+    esp_rom_md5_update(&hash, data.data(), data.size());
+    esp_rom_md5_final(digest, &hash);
+}
+
+// Offers image as the plain firmware, with its x-MD5
+void serve(std::vector<uint8_t> image) {
+    image[0] = 0xE9;  // ESP image magic
+    firmwareServer.image = std::move(image);
+
+    uint8_t digest[ESP_ROM_MD5_DIGEST_LEN];
+    md5(firmwareServer.image, digest);
+    char hex[2 * ESP_ROM_MD5_DIGEST_LEN + 1];
+    for (int i = 0; i < ESP_ROM_MD5_DIGEST_LEN; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    }
+    firmwareServer.md5 = hex;
+}
+
+// ConfigStore.h's NVS record: the CRC, the schema 1 migration and the
+// coalescing of changes into one write
+void configScenario() {
+    Preferences prefs;
+    config_load();
+    check(!memcmp(&configStore, &configDefault, sizeof(configStore)),
+          "first boot loads the defaults");
+
+    CopyString("sim-token", configStore.cloudToken);
+    configStore.setFlag(CONFIG_FLAG_VALID, true);
+    check(config_save(), "config saved");
+    config_load();
+    check(!strcmp(configStore.cloudToken, "sim-token") &&
+              configStore.getFlag(CONFIG_FLAG_VALID),
+          "saved config loads");
+
+    // One flipped bit in the token
+    uint8_t record[sizeof(ConfigHeader) + sizeof(ConfigStore)];
+    prefs.begin("blynk");
+    size_t len = prefs.getBytes("cfg", record, sizeof(record));
+    record[sizeof(ConfigHeader) + offsetof(ConfigStore, cloudToken)] ^= 0x01;
+    prefs.putBytes("cfg", record, len);
+    prefs.end();
+    config_load();
+    check(len == sizeof(record) &&
+              !memcmp(&configStore, &configDefault, sizeof(configStore)),
+          "corrupt record loads as defaults");
+
+    // What firmware before the versioned record left behind
+    ConfigStore legacy = configDefault;
+    CopyString("legacy-token", legacy.cloudToken);
+    prefs.begin("blynk");
+    prefs.remove("cfg");
+    prefs.putBytes("config", &legacy, sizeof(legacy));
+    prefs.end();
+    config_load();
+    check(!strcmp(configStore.cloudToken, "legacy-token"),
+          "schema 1 record loads");
+    config_run();
+    prefs.begin("blynk", true);
+    check(prefs.isKey("cfg") && !prefs.isKey("config"),
+          "migration rewrites the record and drops the old key");
+    prefs.end();
+    config_load();
+    check(!strcmp(configStore.cloudToken, "legacy-token") && !configDirty,
+          "migrated record loads as it is");
+
+    // Failed connection attempts in quick succession, unprovisioned
+    configStore = configDefault;
+    config_save();
+    uint32_t writes = sim::counters().nvsWrites;
+    uint32_t coalesced = configStats.coalesced;
+    for (int i = 0; i < 500; i++) {
+        config_set_last_error(i % 2 ? BLYNK_PROV_ERR_NETWORK
+                                    : BLYNK_PROV_ERR_CLOUD);
+        config_run();
+        wait(10);
+    }
+    check(sim::counters().nvsWrites == writes,
+          "nothing written within the save delay");
+    wait(CONFIG_SAVE_DELAY);
+    config_run();
+    check(sim::counters().nvsWrites == writes + 1 &&
+              configStats.coalesced == coalesced + 499,
+          "500 failures cost one write");
+
+    writes = sim::counters().nvsWrites;
+    for (int i = 0; i < 500; i++) {
+        config_set_last_error(BLYNK_PROV_ERR_NETWORK);
+        config_run();
+        wait(10);
+    }
+    wait(CONFIG_SAVE_DELAY);
+    config_run();
+    check(sim::counters().nvsWrites == writes,
+          "the same error again writes nothing");
+}
+
+// Plain image for the OTA scenario, the seed tells two apart
+void makeFirmware(uint32_t seed) {
+    std::mt19937 random(seed);
+    std::vector<uint8_t> image(OTA_IMAGE_SIZE);
+    for (uint8_t &byte : image) byte = random();
+    serve(std::move(image));
+}
+
+bool firmwareFlashed() {
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    return esp_ota_get_boot_partition() == partition &&
+           memcmp(sim::partitionData(partition), firmwareServer.image.data(),
+                  firmwareServer.image.size()) == 0;
+}
+
+// The update as it used to run: ota_start() dropped the cloud connection
+// and the loop task downloaded without a rate cap until the reboot. Played
+// by today's otaDownload() on a task at the loop task's priority, so its
+// pipeline writer is the current idle-priority one.
+volatile bool foregroundStop = false;
+volatile bool foregroundDone = false;
+
+void foregroundOtaTask(void *) {
+    Blynk.disconnect();
+    otaRateLimit = 0;
+    while (!foregroundStop && otaDownload()) {
+    }
+    foregroundDone = true;
+    vTaskDelete(NULL);
+}
+
+struct UnlockLatency {
+    double keypadMax;
+    double cloudMax;
+    int cloudUnlocks;
+};
+
+// Stimulus runs late when flash stalls the CPU, so latencies count from
+// the moment it meant to act
+uint64_t waitUntilDue(unsigned long ms) {
+    uint64_t due = sim::micros() + (uint64_t)ms * 1000;
+    wait(ms);
+    return due;
+}
+
+// Keypad and cloud unlocks at different phases of whatever else is running.
+// Offline, V7 cannot lock again and the auto-lock has to.
+UnlockLatency measureUnlocks(int rounds) {
+    UnlockLatency worst = {0, 0, 0};
+    auto locked = [] { return lockServo.read() == LOCKED; };
+    auto unlocked = [] { return lockServo.read() == UNLOCKED; };
+    for (int i = 0; i < rounds; i++) {
+        wait(2500 + 37 * i);
+        type("123456");
+        uint64_t pressed = waitUntilDue(20);
+        type("#");
+        check(waitFor(unlocked, 2000) >= 0, "PIN unlocks");
+        worst.keypadMax = std::max(
+            worst.keypadMax, (lockServo.lastWrite() - pressed) / 1000.0);
+        Blynk.command(V7, "1");
+        waitFor(locked, 20000);
+
+        uint64_t sent = waitUntilDue(1500 + 23 * i);
+        Blynk.command(V0, "1");
+        if (waitFor(unlocked, 2000) < 0) continue;
+        worst.cloudMax = std::max(worst.cloudMax,
+                                  (lockServo.lastWrite() - sent) / 1000.0);
+        worst.cloudUnlocks++;
+        Blynk.command(V7, "1");
+        waitFor(locked, 2000);
+    }
+    return worst;
+}
+
+// Unlocks while OTA.h downloads from firmwareServer and writes through
+// OtaPipeline and OtaImage into the simulated flash
+void benchmarkOta() {
+    const int ROUNDS = 8;
+    firmwareServer.url = "https://ota.sim/firmware.bin";
+    UnlockLatency idle = measureUnlocks(ROUNDS);
+
+    makeFirmware(1);
+    overTheAirURL = firmwareServer.url;
+    sim::spawn(foregroundOtaTask, "OtaForeground", nullptr, 1);
+    uint64_t start = sim::micros();
+    uint64_t sentBefore = firmwareServer.bytesSent;
+    UnlockLatency foreground = measureUnlocks(ROUNDS);
+    double foregroundRate = (firmwareServer.bytesSent - sentBefore) / 1024.0 /
+                            ((sim::micros() - start) / 1e6);
+    foregroundStop = true;
+    check(waitFor([] { return foregroundDone; }, 120000) >= 0 &&
+              firmwareFlashed(),
+          "foreground OTA flashes the image");
+    Blynk.setConnected(true);
+
+    // The way the cloud starts it, with the default rate cap
+    makeFirmware(2);
+    otaRateLimit = OTA_DEFAULT_RATE;
+    Blynk.command(InternalPinOTA, "https://ota.sim/firmware.bin");
+    check(waitFor([] { return otaJobState == OTA_JOB_RUNNING; }, 3000) >= 0,
+          "cloud starts the OTA job");
+    start = sim::micros();
+    sentBefore = firmwareServer.bytesSent;
+    UnlockLatency background = measureUnlocks(ROUNDS);
+    double backgroundRate = (firmwareServer.bytesSent - sentBefore) / 1024.0 /
+                            ((sim::micros() - start) / 1e6);
+    check(otaJobState == OTA_JOB_RUNNING,
+          "background OTA outlasts the measurement");
+    check(waitFor([] { return otaJobState == OTA_JOB_DONE; }, 120000) >= 0 &&
+              firmwareFlashed(),
+          "background OTA flashes the image");
+
+    Serial.printf("[sim] worst '#' to servo: idle %.1f ms, foreground OTA "
+                  "%.1f ms, background OTA %.1f ms\n",
+                  idle.keypadMax, foreground.keypadMax, background.keypadMax);
+    Serial.printf("[sim] worst V0 to servo: idle %.1f ms, background OTA "
+                  "%.1f ms, foreground OTA served %d of %d\n",
+                  idle.cloudMax, background.cloudMax, foreground.cloudUnlocks,
+                  ROUNDS);
+    Serial.printf("[sim] download rate: foreground %.1f KB/s, background "
+                  "%.1f KB/s (capped at %u)\n",
+                  foregroundRate, backgroundRate, OTA_DEFAULT_RATE / 1024);
+    check(foreground.cloudUnlocks == 0,
+          "foreground OTA keeps V0 from the lock");
+    check(background.cloudUnlocks == ROUNDS,
+          "V0 unlocks throughout a background OTA");
+    check(background.keypadMax < 100 && background.cloudMax < 100,
+          "unlocks stay under 100 ms during a background OTA");
+    check(backgroundRate > 28 && backgroundRate < 34,
+          "background OTA holds its rate cap");
+}
+
+// Bytes that compress like code: a skewed mix of values and many short
+// repeats, so deflate uses both back references and Huffman codes
+std::vector<uint8_t> makeCode(uint32_t seed, size_t size) {
+    std::mt19937 random(seed);
+    std::vector<uint8_t> code(size);
+    for (size_t i = 0; i < size;) {
+        if (i >= 4096 && random() % 4 == 0) {
+            size_t from = i - 1 - random() % 4096;
+            for (size_t n = 4 + random() % 28; n && i < size; n--) {
+                code[i++] = code[from++];
+            }
+        } else {
+            code[i++] = random() % 96;
+        }
+    }
+    return code;
+}
+
+void put32(std::vector<uint8_t> &out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out.push_back(value >> (8 * i));
+}
+
+// A patch in the OtaDelta.h format from the running app in app0 to a new
+// image, which it also serves as the plain firmware. The new image keeps
+// the start of the app, has the next part moved by a few bytes here and
+// there, new code, and the rest of the app again. baseMd5 goes in the
+// header as the build the patch was made for.
+std::vector<uint8_t> makePatch(const char *baseMd5) {
+    const uint32_t KEEP = 512 * 1024, MOVED = 256 * 1024, ADDED = 64 * 1024;
+    std::vector<uint8_t> base = makeCode(3, ESP.getSketchSize());
+    base[0] = 0xE9;
+    sim::loadPartition(esp_ota_get_running_partition(), base.data(),
+                       base.size());
+
+    std::vector<uint8_t> target(base.begin(), base.begin() + KEEP);
+    std::vector<uint8_t> ops = {OTA_DELTA_COPY};
+    put32(ops, 0);
+    put32(ops, KEEP);
+
+    ops.push_back(OTA_DELTA_DIFF);
+    put32(ops, KEEP);
+    put32(ops, MOVED);
+    for (uint32_t i = 0; i < MOVED; i++) {
+        uint8_t diff = (i % 64 == 0) ? 4 : 0;
+        target.push_back(base[KEEP + i] + diff);
+        ops.push_back(diff);
+    }
+
+    std::vector<uint8_t> added = makeCode(4, ADDED);
+    target.insert(target.end(), added.begin(), added.end());
+    ops.push_back(OTA_DELTA_INSERT);
+    put32(ops, ADDED);
+    ops.insert(ops.end(), added.begin(), added.end());
+
+    target.insert(target.end(), base.begin() + KEEP + MOVED, base.end());
+    ops.push_back(OTA_DELTA_COPY);
+    put32(ops, KEEP + MOVED);
+    put32(ops, base.size() - KEEP - MOVED);
+    serve(target);
+    target = firmwareServer.image;
+
+    std::vector<uint8_t> patch = {'S', 'L', 'D', '1'};
+    for (int i = 0; i < ESP_ROM_MD5_DIGEST_LEN; i++) {
+        char byte[3] = {baseMd5[2 * i], baseMd5[2 * i + 1], 0};
+        patch.push_back(strtoul(byte, nullptr, 16));
+    }
+    put32(patch, target.size());
+    patch.resize(patch.size() + ESP_ROM_MD5_DIGEST_LEN);
+    md5(target, &patch[patch.size() - ESP_ROM_MD5_DIGEST_LEN]);
+    patch.insert(patch.end(), ops.begin(), ops.end());
+    return patch;
+}
+
+// One update job straight through otaDownload() on a task of its own,
+// without the rate cap. Each job gets its own URL, so none resumes
+// another's checkpoint.
+volatile int otaJobResult;
+
+void otaJobTask(void *) {
+    otaJobResult = otaDownload();
+    vTaskDelete(NULL);
+}
+
+bool runOta(const char *url) {
+    firmwareServer.url = url;
+    firmwareServer.bytesSent = 0;
+    overTheAirURL = url;
+    otaRateLimit = 0;
+    otaJobResult = -1;
+    sim::spawn(otaJobTask, "OtaJob", nullptr, 0);
+    waitFor([] { return otaJobResult >= 0; }, 600000);
+    Serial.printf("[sim] %u bytes sent for a %u byte image\n",
+                  (unsigned)firmwareServer.bytesSent,
+                  (unsigned)firmwareServer.image.size());
+    return otaJobResult == 1 && firmwareFlashed();
+}
+
+// Compressed and delta downloads through OtaPayload, OtaInflate and
+// OtaDelta, all of them rebuilt on the device
+void otaPayloads() {
+    scenario("OTA gzipped image");
+    serve(makeCode(5, OTA_IMAGE_SIZE));
+    firmwareServer.gzip = true;
+    check(runOta("https://ota.sim/gzip.bin"), "gzipped image flashed");
+    check(firmwareServer.bytesSent < firmwareServer.image.size() / 2,
+          "gzip halves the download");
+
+    scenario("OTA delta patch");
+    firmwareServer.gzip = false;
+    firmwareServer.patch = makePatch(ESP.getSketchMD5().c_str());
+    firmwareServer.patchBase = ESP.getSketchMD5();
+    check(runOta("https://ota.sim/delta.bin"), "patched image flashed");
+    check(firmwareServer.bytesSent == firmwareServer.patch.size(),
+          "only the patch is downloaded");
+
+    scenario("OTA gzipped delta");
+    firmwareServer.gzip = true;
+    check(runOta("https://ota.sim/delta-gzip.bin"),
+          "gzipped patch flashed");
+    check(firmwareServer.bytesSent < firmwareServer.patch.size() / 2,
+          "gzip shrinks the patch");
+
+    scenario("OTA patch for another build");
+    firmwareServer.gzip = false;
+    firmwareServer.patch = makePatch(firmwareServer.md5.c_str());
+    size_t imageSize = firmwareServer.image.size();
+    check(runOta("https://ota.sim/wrong-base.bin"),
+          "full image flashed instead");
+    check(firmwareServer.bytesSent > imageSize &&
+              firmwareServer.bytesSent < imageSize + 16 * 1024,
+          "patch abandoned after its header");
+    firmwareServer.patch.clear();
+
+    scenario("OTA drop in a compressed download");
+    serve(makeCode(6, OTA_IMAGE_SIZE));
+    firmwareServer.gzip = true;
+    firmwareServer.dropAfter = 400 * 1024;
+    check(runOta("https://ota.sim/dropped.bin"),
+          "plain image resumed to the end");
+    check(firmwareServer.bytesSent <= firmwareServer.image.size() + 400 * 1024,
+          "only the first compressed try is lost");
+    firmwareServer.gzip = false;
+    firmwareServer.dropAfter = 0;
+}
+
+void stimulusTask(void *) {
+    auto wallStart = std::chrono::steady_clock::now();
+
+    scenario("boot");
+    check(waitFor([] { return showing("Enter Passcode"); }, 5000) >= 0,
+          "passcode prompt shown");
+    Serial.printf("[sim] keypad ready %.1f ms after reset\n",
+                  sim::micros() / 1000.0);
+    check(sim::micros() < 500000, "keypad ready within 500 ms");
+
+    scenario("keypad unlock and auto-lock");
+    uint32_t nvsOpens = sim::counters().nvsOpens;
+    type("123456");
+    uint64_t pressed = sim::micros();
+    type("#");
+    check(waitFor([] { return lockServo.read() == UNLOCKED; }, 1000) >= 0,
+          "correct PIN unlocks");
+    Serial.printf("[sim] '#' to servo: %.1f ms\n",
+                  (lockServo.lastWrite() - pressed) / 1000.0);
+    check(sim::counters().nvsOpens == nvsOpens, "no NVS access on unlock");
+    long relock = waitFor([] { return lockServo.read() == LOCKED; }, 20000);
+    check(relock >= 14000 && relock <= 16000, "auto-locks after ~15 s");
+
+    scenario("lockout after three wrong PINs");
+    for (int i = 0; i < 3; i++) {
+        type("000000#");
+        if (i == 0) {
+            // A key typed under the result is dropped with the entry
+            wait(500);
+            type("1");
+            waitFor([] { return showing("Enter Passcode"); }, 2500);
+            check(showing("______"), "entry cleared once the result is gone");
+        }
+        wait(2500);
+    }
+    check(showing("System Locked"), "lockout shown");
+    type("123456#");
+    wait(1000);
+    check(lockServo.read() == LOCKED, "keys ignored during lockout");
+    check(waitFor([] { return showing("Lockout Ended"); }, 61000) >= 0,
+          "lockout ends after LOCKOUT_DURATION");
+    wait(2500);
+    type("123456#");
+    check(waitFor([] { return lockServo.read() == UNLOCKED; }, 1000) >= 0,
+          "PIN accepted again");
+
+    scenario("cloud lock and unlock");
+    Blynk.command(V7, "1");
+    check(waitFor([] { return lockServo.read() == LOCKED; }, 1000) >= 0,
+          "V7 locks");
+    wait(1500);
+    uint64_t sent = sim::micros();
+    Blynk.command(V0, "1");
+    check(waitFor([] { return lockServo.read() == UNLOCKED; }, 1000) >= 0,
+          "V0 unlocks");
+    Serial.printf("[sim] V0 to servo: %.1f ms\n",
+                  (lockServo.lastWrite() - sent) / 1000.0);
+    Blynk.command(V7, "1");
+    waitFor([] { return lockServo.read() == LOCKED; }, 1000);
+
+    scenario("fingerprint enrollment");
+    wait(2500);
+    Blynk.command(V2, "1");
+    check(waitFor([] { return showing("Place finger"); }, 2000) >= 0,
+          "asks for a finger");
+    finger.placeFinger(7);
+    check(waitFor([] { return showing("Remove finger"); }, 2000) >= 0,
+          "first capture");
+    finger.liftFinger();
+    check(waitFor([] { return showing("finger again"); }, 2000) >= 0,
+          "asks for the same finger");
+    finger.placeFinger(7);
+    check(waitFor([] { return cloudSaw(V4, "registered successfully"); },
+                  3000) >= 0,
+          "reports success on V4");
+    finger.liftFinger();
+    check(finger.templates() == 1, "template stored");
+
+    scenario("fingerprint access");
+    wait(2500);
+    // The firmware decides once the finger has been lifted
+    finger.placeFinger(7);
+    check(waitFor([] { return showing("Remove your"); }, 2000) >= 0,
+          "enrolled finger recognised");
+    finger.liftFinger();
+    check(waitFor([] { return lockServo.read() == UNLOCKED; }, 1000) >= 0,
+          "enrolled finger unlocks");
+    Blynk.command(V7, "1");
+    waitFor([] { return lockServo.read() == LOCKED; }, 1000);
+    wait(2500);
+    finger.placeFinger(3);
+    waitFor([] { return showing("Remove your"); }, 2000);
+    finger.liftFinger();
+    check(waitFor([] { return showing("Access Denied"); }, 1000) >= 0,
+          "unknown finger denied");
+
+    scenario("offline events");
+    Blynk.setConnected(false);
+    wait(2500);
+    size_t sentBefore = Blynk.sent().size();
+    type("123456#");
+    check(waitFor([] { return lockServo.read() == UNLOCKED; }, 1000) >= 0,
+          "PIN unlocks while offline");
+    check(Blynk.sent().size() == sentBefore && LittleFS.exists("/journal0.bin"),
+          "event journaled");
+    waitFor([] { return lockServo.read() == LOCKED; }, 20000);
+    Blynk.setConnected(true);
+    check(waitFor([] { return cloudSaw(-1, "passcode (queued"); }, 3000) >= 0,
+          "journaled event replayed on reconnect");
+    check(waitFor([] { return !LittleFS.exists("/journal0.bin"); }, 3000) >= 0,
+          "journal drained");
+
+    scenario("journal wrap and torn tail");
+    journalScenario();
+
+    scenario("config record");
+    configScenario();
+
+    scenario("console");
+    edgentConsole.run("input");
+    edgentConsole.run("lcd");
+    edgentConsole.run("latency");
+    edgentConsole.run("boot");
+    edgentConsole.run("journal");
+
+    scenario("json writer");
+    benchmarkJson();
+
+    scenario("OTA download");
+    benchmarkOta();
+    otaPayloads();
+
+    double wall = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - wallStart)
+                      .count();
+    Serial.printf("[sim] %.1f s simulated in %.2f s, %u failed\n",
+                  sim::micros() / 1e6, wall, failures);
+    finish();
+}
+
+
+// A second boot, with the sensor unplugged
+void noSensorTask(void *) {
+    scenario("factory reset without a fingerprint sensor");
+    check(waitFor([] { return showing("Enter Passcode"); }, 5000) >= 0,
+          "boots without the sensor");
+    wait(1000);
+    factoryResetPending = true;
+    check(waitFor([] { return showing("Not cleared"); }, 5000) >= 0,
+          "template wipe skipped");
+    check(waitFor([] { return showing("Factory Reset"); }, 5000) >= 0 &&
+              !factoryResetPending,
+          "factory reset finishes");
+    type("123456#");
+    check(waitFor([] { return lockServo.read() == UNLOCKED; }, 1000) >= 0,
+          "default PIN unlocks");
+
+    Serial.printf("[sim] %.1f s simulated, %u failed\n", sim::micros() / 1e6,
+                  failures);
+    finish();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    sim::init();
+    bool noSensor = argc > 1 && strcmp(argv[1], "no-sensor") == 0;
+    if (noSensor) finger.unplug();
+    // Started first, so it sees the keypad come up while setup() runs
+    sim::spawn(noSensor ? noSensorTask : stimulusTask, "Stimulus", nullptr, 2);
+    setup();
+    for (;;) loop();
+}
@@ -6,24 +6,43 @@
 
 #define DEFAULT_PIN "123456"
 
+#include <AccessTrace.h>
 #include <Adafruit_Fingerprint.h>
 #include <Arduino.h>
+#ifdef SMARTLOCK_SIM
+#include <SimEdgent.h>
+#else
 #include <BlynkEdgent.h>
+#endif
+#include <BootTimeline.h>
+#include <DisplayQueue.h>
+#include <EnrollJob.h>
 #include <ESP32Servo.h>
+#include <EventJournal.h>
+#include <FingerSlots.h>
+#include <InputEvents.h>
 #include <Keypad.h>
+#include <LcdRenderer.h>
 #include <LiquidCrystal_I2C.h>
+#include <PinCache.h>
 #include <Preferences.h>
 
 #include <atomic>
-#include <mutex>
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 
 // Hardware initialization
 Adafruit_Fingerprint finger = Adafruit_Fingerprint(&Serial2);
+// Set once initFinger() is done with the sensor, found or not
+std::atomic<bool> fingerReady{false};
+// Held around every command sequence on the sensor's UART: matching on
+// inputTask, enrollment steps and deletes from the loop task
+SemaphoreHandle_t fingerLock = NULL;
+const unsigned long FINGER_LOCK_WAIT = 1000;
 LiquidCrystal_I2C lcd(0x27, 16, 2);
-std::mutex displayMutex;
 Servo lockServo;
 Preferences prefs;
 
@@ -55,10 +74,12 @@ Keypad keypad =
 TaskHandle_t inputTaskHandle = NULL;
 
 String currentPasscode = "";
+// Set once an entry has been verified or timed out. Keys are ignored until
+// the message about it leaves the display, which clears the entry.
+bool passcodeSpent = false;
 
 int pinFailedAttempts = 0;
 int fingerFailedAttempts = 0;
-const int FINGER_ENROLL_ATTEMPTS = 3;
 bool isLocked = true;
 bool backlightEnabled = true;
 bool autoLockPending = false;
@@ -70,39 +91,46 @@ unsigned long lastKeyPressTime = 0;
 unsigned long lastPinFailTime = 0;
 unsigned long lastFingerFailTime = 0;
 const unsigned long ATTEMPT_RESET_TIME = 120000;
-std::atomic<bool> isRegistering{false};
-
-void displayUpdate(uint8_t col, uint8_t row, const String &text,
-                   bool clearFirst = false) {
-    std::lock_guard<std::mutex> lock(displayMutex);
-    if (clearFirst) lcd.clear();
-    lcd.setCursor(col, row);
-    lcd.print(text);
-}
 
+// Never blocks: without a display time the message becomes the status line
 void displayMessage(const String &line1, const String &line2 = "",
-                    uint16_t displayTime = 0) {
-    std::lock_guard<std::mutex> lock(displayMutex);
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(line1);
-
-    if (line2.length() > 0) {
-        lcd.setCursor(0, 1);
-        lcd.print(line2);
-    }
-
-    if (displayTime > 0) delay(displayTime);
+                    uint16_t displayTime = 0,
+                    DisplayPriority priority = DISPLAY_NORMAL) {
+    displayQueue.post(line1.c_str(), line2.c_str(), displayTime, priority);
 }
 
 unsigned long lastServoCommandTime = 0;
 const unsigned long SERVO_COMMAND_DEBOUNCE = 500;
 
+// Time from a cloud lock/unlock command reaching its handler to the servo
+// write, plus how long the loop went without servicing Blynk
+struct CommandLatency {
+    uint32_t last;  // ms
+    uint32_t max;
+    uint32_t count;
+    uint64_t sum;
+    uint32_t loopGapMax;  // ms
+};
+
+CommandLatency commandLatency = {};
+std::atomic<int64_t> cloudCommandAt{0};
+
+void markCloudCommand() { cloudCommandAt = esp_timer_get_time(); }
+
 void setLockPosition(bool lock) {
     if (isLocked != lock) {
         lockServo.write(lock ? LOCK_POSITION : UNLOCK_POSITION);
         isLocked = lock;
         Serial.println(lock ? "Door locked" : "Door unlocked");
+
+        int64_t commandAt = cloudCommandAt.exchange(0);
+        if (commandAt) {
+            uint32_t latency = (esp_timer_get_time() - commandAt) / 1000;
+            commandLatency.last = latency;
+            commandLatency.max = max(commandLatency.max, latency);
+            commandLatency.count++;
+            commandLatency.sum += latency;
+        }
     }
 }
 
@@ -111,8 +139,8 @@ void unlockTemporarily() {
     autoLockTime = millis() + UNLOCK_DURATION;
     autoLockPending = true;
 
-    displayUpdate(0, 0, "Door Unlocked", true);
-    displayUpdate(0, 1, "Locks in: " + String(UNLOCK_DURATION / 1000) + "s");
+    displayMessage("Door Unlocked",
+                   "Locks in: " + String(UNLOCK_DURATION / 1000) + "s");
 }
 
 bool isLockoutActive() { return millis() < lockoutUntil; }
@@ -140,7 +168,8 @@ bool savePin(const String &newPin) {
         prefs.putString("pin", newPin);
         prefs.end();
 
-        Serial.println("PIN saved: " + newPin);
+        pinCache.set(newPin);
+        Serial.println("PIN saved");
         return true;
     } else {
         Serial.println("Failed to save PIN to preferences");
@@ -148,61 +177,151 @@ bool savePin(const String &newPin) {
     }
 }
 
-void sendBlynkEvent(String eventName, String eventDescription) {
-    if (Blynk.connected()) {
-        Blynk.logEvent(eventName, eventDescription);
-        Serial.println("Event sent: " + String(eventName));
+// Events raised on inputTask are handed to the loop task, which owns the
+// Blynk connection, so an unlock never waits on the network or on a
+// journal write to flash
+struct CloudEvent {
+    char name[sizeof(JournalRecord::name)];
+    char text[sizeof(JournalRecord::text)];
+};
+
+const uint8_t CLOUD_EVENT_QUEUE_LENGTH = 8;
+QueueHandle_t cloudEventQueue = NULL;
+
+void sendBlynkEvent(const char *eventName, const char *eventDescription) {
+    CloudEvent event = {};
+    strncpy(event.name, eventName, sizeof(event.name) - 1);
+    strncpy(event.text, eventDescription, sizeof(event.text) - 1);
+    if (xQueueSend(cloudEventQueue, &event, 0) != pdTRUE) {
+        Serial.println("Event queue full, can't send event: " +
+                       String(eventName));
+    }
+}
+
+// Events go through the journal while offline, or while older ones are
+// still being replayed so the cloud sees them in order
+void deliverBlynkEvent(const CloudEvent &event) {
+    if (Blynk.connected() && !eventJournal.pending()) {
+        Blynk.logEvent(event.name, event.text);
+        Serial.println("Event sent: " + String(event.name));
+    } else if (eventJournal.append(JOURNAL_EVENT, 0, event.name, event.text)) {
+        Serial.println("Blynk offline, event queued: " + String(event.name));
     } else {
-        Serial.println("Blynk offline, can't send event: " + String(eventName));
+        Serial.println("Blynk offline, can't send event: " +
+                       String(event.name));
     }
 }
 
-void resetPasscodeEntry() {
+void deliverBlynkEvents() {
+    CloudEvent event;
+    while (xQueueReceive(cloudEventQueue, &event, 0) == pdTRUE) {
+        deliverBlynkEvent(event);
+    }
+}
+
+const unsigned long JOURNAL_REPLAY_INTERVAL = 1000;
+const uint8_t JOURNAL_REPLAY_BATCH = 4;
+int journalReplayTimer = -1;
+
+bool replayJournalRecord(const JournalRecord &record) {
+    if (!Blynk.connected()) return false;
+
+    if (record.kind == JOURNAL_VIRTUAL_WRITE) {
+        Blynk.virtualWrite(record.pin, record.text);
+        return true;
+    }
+
+    String description = record.text;
+    if (record.boot == eventJournal.bootId()) {
+        description += " (queued " +
+                       timeSpanToStr(millis() / 1000 - record.uptime) +
+                       " ago)";
+    } else {
+        description += " (queued before reboot)";
+    }
+    Blynk.logEvent(record.name, description);
+    return true;
+}
+
+// Drains the journal a few records per tick, not to trip cloud rate limits
+void replayJournal() {
+    if (!Blynk.connected() || !eventJournal.pending()) {
+        edgentTimer.disable(journalReplayTimer);
+        return;
+    }
+    uint8_t sent =
+        eventJournal.replay(JOURNAL_REPLAY_BATCH, replayJournalRecord);
+    Serial.println("Replayed " + String(sent) + " journaled events, " +
+                   String(eventJournal.pending()) + " left");
+}
+
+BLYNK_CONNECTED() {
+    if (eventJournal.pending()) edgentTimer.enable(journalReplayTimer);
+}
+
+// The display falls back to this prompt whenever no message is up
+void updatePasscodePrompt(int64_t echoTimestamp = 0) {
+    char line2[LcdRenderer::COLS + 1] = "     ______";
+    memcpy(line2 + 5, currentPasscode.c_str(), currentPasscode.length());
+    displayQueue.setPrompt(currentPasscode.length() == PASSCODE_LENGTH
+                               ? "Press # to verify"
+                               : "Enter Passcode:",
+                           line2, echoTimestamp);
+}
+
+// Called for INPUT_EVENT_PROMPT, posted by the display's fallback hook
+void clearPasscodeEntry() {
+    if (currentPasscode.length() == 0 && !passcodeSpent) return;
     currentPasscode = "";
-    displayUpdate(0, 0, "Enter Passcode:", true);
-    displayUpdate(5, 1, "______");
+    passcodeSpent = false;
+    updatePasscodePrompt();
 }
 
-bool handleKeypadInput() {
-    if (currentPasscode.length() > 0 &&
+void checkKeypadTimeout() {
+    if (currentPasscode.length() > 0 && !passcodeSpent &&
         millis() - lastKeyPressTime >= KEYPAD_TIMEOUT) {
         displayMessage("Timeout", "Input cleared", 1500);
-        resetPasscodeEntry();
-        return false;
+        passcodeSpent = true;
     }
+}
+
+bool handleKeypadInput(const InputEvent &event) {
+    if (passcodeSpent) return false;
 
-    char key = keypad.getKey();
-    if (!key) return false;
+    char key = event.key;
     lastKeyPressTime = millis();
 
     if (isdigit(key) && currentPasscode.length() < PASSCODE_LENGTH) {
         // Add digit to the string
         currentPasscode += key;
-        displayUpdate(5 + currentPasscode.length() - 1, 1, String(key));
-
-        if (currentPasscode.length() == PASSCODE_LENGTH) {
-            displayUpdate(0, 0, "Press # to verify", false);
-        }
+        updatePasscodePrompt(event.timestamp);
         return false;
     }
 
     // Handle backspace (*)
     if (key == '*' && currentPasscode.length() > 0) {
         // Remove last character from string
-        displayUpdate(5 + currentPasscode.length() - 1, 1, "_");
         currentPasscode.remove(currentPasscode.length() - 1);
+        updatePasscodePrompt(event.timestamp);
         return false;
     }
 
     // Handle enter key (#)
     if (key == '#' && currentPasscode.length() == PASSCODE_LENGTH) {
-        // Direct string comparison
-        if (currentPasscode == loadPin()) {
+        accessTrace.begin(TRACE_KEYPAD, event.timestamp);
+        bool verified = pinCache.verify(currentPasscode);
+        accessTrace.mark(TRACE_KEYPAD, TRACE_VERIFY);
+
+        if (verified) {
             pinFailedAttempts = 0;
-            sendBlynkEvent("access_granted", "Access granted via passcode");
             unlockTemporarily();
-            displayMessage("Access Granted!", "Door Unlocked", 2000);
-            resetPasscodeEntry();
+            accessTrace.mark(TRACE_KEYPAD, TRACE_SERVO);
+            sendBlynkEvent("access_granted", "Access granted via passcode");
+            accessTrace.mark(TRACE_KEYPAD, TRACE_EVENT);
+            displayMessage("Access Granted!", "Door Unlocked", 2000,
+                           DISPLAY_HIGH);
+            accessTrace.mark(TRACE_KEYPAD, TRACE_DISPLAY);
+            passcodeSpent = true;
             return true;
         } else {
             pinFailedAttempts++;
@@ -211,16 +330,21 @@ bool handleKeypadInput() {
             if (pinFailedAttempts >= 3) {
                 sendBlynkEvent("send_alarm",
                                "Access denied, too many attempts");
-                displayMessage("Too Many Attempts");
+                accessTrace.mark(TRACE_KEYPAD, TRACE_EVENT);
+                displayMessage("Too Many Attempts", "Locking out", 2000,
+                               DISPLAY_ALARM);
+                accessTrace.mark(TRACE_KEYPAD, TRACE_DISPLAY);
                 lockoutUntil = millis() + LOCKOUT_DURATION;
                 pinFailedAttempts = 0;
             } else {
                 sendBlynkEvent("access_denied", "Access denied via passcode");
+                accessTrace.mark(TRACE_KEYPAD, TRACE_EVENT);
                 displayMessage("Access Denied!",
                                String(3 - pinFailedAttempts) + " attempts left",
-                               2000);
+                               2000, DISPLAY_HIGH);
+                accessTrace.mark(TRACE_KEYPAD, TRACE_DISPLAY);
             }
-            resetPasscodeEntry();
+            passcodeSpent = true;
             return false;
         }
     }
@@ -229,32 +353,24 @@ bool handleKeypadInput() {
 }
 
 bool isFingerprintExist(int id) {
-    uint8_t p = finger.loadModel(id);
-    return p == FINGERPRINT_OK;
-}
-
-uint8_t findAvailableFingerID() {
-    finger.getTemplateCount();
-
-    for (uint8_t id = 1; id < 128; id++) {
-        uint8_t p = finger.loadModel(id);
-        Serial.println("ID: " + String(id) + " - " + String(p));
-        if (!isFingerprintExist(id)) {
-            return id;
-        }
-    }
-
-    return 0;
+    return fingerReady && id >= 0 && id < fingerSlots.capacity() &&
+           fingerSlots.isOccupied(id);
 }
 
 int getFingerprintIDez() {
+    // Most polls find no finger, only those that do start an attempt
+    int64_t polledAt = esp_timer_get_time();
     uint8_t p = finger.getImage();
     if (p != FINGERPRINT_OK) return -1;
+    accessTrace.begin(TRACE_FINGER, polledAt);
+    accessTrace.mark(TRACE_FINGER, TRACE_IMAGE);
 
     p = finger.image2Tz();
+    accessTrace.mark(TRACE_FINGER, TRACE_FEATURES);
     if (p != FINGERPRINT_OK) return -1;
 
     p = finger.fingerFastSearch();
+    accessTrace.mark(TRACE_FINGER, TRACE_SEARCH);
     if (p != FINGERPRINT_OK) return -2;
 
     Serial.print("Found ID #");
@@ -264,218 +380,38 @@ int getFingerprintIDez() {
     return finger.fingerID;
 }
 
-bool getFingerprintEnroll() {
-    int p = -1;
-    int id = findAvailableFingerID();
-    int attemptCount = 0;
-
-    if (id == 0) {
-        displayMessage("No free slots", "Clear database first", 2000);
-        return false;
-    }
-
-    displayMessage("Enrolling ID #" + String(id), "Place finger");
-    Serial.println("Waiting for valid finger to enroll as #" + String(id));
-
-    attemptCount = 0;
-    while (p != FINGERPRINT_OK && attemptCount < FINGER_ENROLL_ATTEMPTS) {
-        p = finger.getImage();
-        switch (p) {
-            case FINGERPRINT_OK:
-                displayMessage("Image taken", "Processing...");
-                Serial.println("Image taken");
-                break;
-            case FINGERPRINT_NOFINGER:
-                delay(100);
-                break;
-            case FINGERPRINT_PACKETRECIEVEERR:
-                displayMessage("Comm error", "Try again");
-                Serial.println("Communication error");
-                attemptCount++;
-                delay(500);
-                break;
-            case FINGERPRINT_IMAGEFAIL:
-                displayMessage("Imaging error", "Try again");
-                Serial.println("Imaging error");
-                attemptCount++;
-                delay(500);
-                break;
-            default:
-                displayMessage("Unknown error", String(p));
-                Serial.println("Unknown error");
-                attemptCount++;
-                delay(500);
-                break;
-        }
-
-        if (attemptCount >= FINGER_ENROLL_ATTEMPTS) {
-            displayMessage("Too many errors", "Registration canceled", 2000);
-            return false;
-        }
-    }
-
-    p = finger.image2Tz(1);
-    if (p != FINGERPRINT_OK) {
-        String errorMsg = "Processing failed";
-        switch (p) {
-            case FINGERPRINT_IMAGEMESS:
-                errorMsg = "Image too messy";
-                break;
-            case FINGERPRINT_PACKETRECIEVEERR:
-                errorMsg = "Communication error";
-                break;
-            case FINGERPRINT_FEATUREFAIL:
-            case FINGERPRINT_INVALIDIMAGE:
-                errorMsg = "No features found";
-                break;
-        }
-        displayMessage(errorMsg, "Try again", 2000);
-        return false;
-    }
-
-    p = finger.fingerFastSearch();
-    if (p == FINGERPRINT_OK) {
-        displayMessage("Already exists", "ID #" + String(finger.fingerID),
-                       2000);
-        Serial.println("Fingerprint already exists with ID #" +
-                       String(finger.fingerID));
-        return false;
-    }
-    Serial.println("No duplicate found, continuing enrollment");
-
-    displayMessage("Remove finger", "from sensor");
-    Serial.println("Remove finger");
-    delay(1000);
-    p = 0;
-
-    attemptCount = 0;
-    while (p != FINGERPRINT_NOFINGER && attemptCount < FINGER_ENROLL_ATTEMPTS) {
-        p = finger.getImage();
-        if (p != FINGERPRINT_NOFINGER) {
-            delay(1000);
-            attemptCount++;
-        }
-
-        if (attemptCount >= FINGER_ENROLL_ATTEMPTS) {
-            displayMessage("Finger not removed", "Registration canceled", 2000);
-            return false;
-        }
-    }
-
-    displayMessage("Place same", "finger again");
-    Serial.println("Place same finger again for ID #" + String(id));
-    p = -1;
-
-    attemptCount = 0;
-    while (p != FINGERPRINT_OK && attemptCount < FINGER_ENROLL_ATTEMPTS) {
-        p = finger.getImage();
-        switch (p) {
-            case FINGERPRINT_OK:
-                displayMessage("Image taken", "Processing...");
-                Serial.println("Image taken");
-                break;
-            case FINGERPRINT_NOFINGER:
-                delay(100);
-                break;
-            case FINGERPRINT_PACKETRECIEVEERR:
-                displayMessage("Comm error", "Try again");
-                Serial.println("Communication error");
-                attemptCount++;
-                delay(500);
-                break;
-            case FINGERPRINT_IMAGEFAIL:
-                displayMessage("Imaging error", "Try again");
-                Serial.println("Imaging error");
-                attemptCount++;
-                delay(500);
-                break;
-            default:
-                displayMessage("Unknown error", String(p));
-                Serial.println("Unknown error");
-                attemptCount++;
-                delay(500);
-                break;
-        }
-
-        if (attemptCount >= FINGER_ENROLL_ATTEMPTS) {
-            displayMessage("Too many errors", "Registration canceled", 2000);
-            return false;
-        }
-    }
-
-    p = finger.image2Tz(2);
-    if (p != FINGERPRINT_OK) {
-        String errorMsg = "Processing failed";
-        switch (p) {
-            case FINGERPRINT_IMAGEMESS:
-                errorMsg = "Image too messy";
-                break;
-            case FINGERPRINT_PACKETRECIEVEERR:
-                errorMsg = "Communication error";
-                break;
-            case FINGERPRINT_FEATUREFAIL:
-            case FINGERPRINT_INVALIDIMAGE:
-                errorMsg = "No features found";
-                break;
-        }
-        displayMessage(errorMsg, "Try again", 2000);
+bool handleFingerprint() {
+    if (!fingerReady || !isLocked || isLockoutActive()) {
         return false;
     }
-
-    displayMessage("Creating model", "Please wait");
-    p = finger.createModel();
-    if (p != FINGERPRINT_OK) {
-        if (p == FINGERPRINT_ENROLLMISMATCH) {
-            displayMessage("Fingers didn't", "match - Try again", 2000);
-        } else {
-            displayMessage("Model error", String(p), 2000);
-        }
+    // Skip this poll while an enrollment step or a delete has the sensor
+    if (xSemaphoreTake(fingerLock, 0) != pdTRUE) return false;
+    if (enrollJob.active()) {
+        xSemaphoreGive(fingerLock);
         return false;
     }
 
-    displayMessage("Storing as ID #" + String(id), "Please wait");
-    p = finger.storeModel(id);
-    if (p == FINGERPRINT_OK) {
-        displayMessage("Success!", "Fingerprint stored", 2000);
-        return true;
-    } else {
-        String errorMsg = "Storage failed";
-        switch (p) {
-            case FINGERPRINT_PACKETRECIEVEERR:
-                errorMsg = "Communication error";
-                break;
-            case FINGERPRINT_BADLOCATION:
-                errorMsg = "Invalid location";
-                break;
-            case FINGERPRINT_FLASHERR:
-                errorMsg = "Flash write error";
-                break;
+    int fingerID = getFingerprintIDez();
+    if (fingerID != -1) {
+        displayMessage("Remove your", "finger to process");
+        while (finger.getImage() != FINGERPRINT_NOFINGER) {
+            vTaskDelay(100 / portTICK_PERIOD_MS);
         }
-        displayMessage(errorMsg, "Try again", 2000);
-        return false;
-    }
-}
-
-bool handleFingerprint() {
-    if (isRegistering.load() || !isLocked || isLockoutActive()) {
-        return false;
+        accessTrace.mark(TRACE_FINGER, TRACE_LIFTED);
     }
-
-    int fingerID = getFingerprintIDez();
+    xSemaphoreGive(fingerLock);
     if (fingerID == -1) {
         return false;
     }
 
-    displayMessage("Remove your", "finger to process");
-    while (finger.getImage() != FINGERPRINT_NOFINGER) {
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-    }
-
     if (fingerID > 0) {
         fingerFailedAttempts = 0;
-        displayMessage("Access Granted!", "Door Unlocked", 2000);
+        displayMessage("Access Granted!", "Door Unlocked", 2000, DISPLAY_HIGH);
+        accessTrace.mark(TRACE_FINGER, TRACE_DISPLAY);
         unlockTemporarily();
+        accessTrace.mark(TRACE_FINGER, TRACE_SERVO);
         sendBlynkEvent("access_granted", "Access granted via fingerprint");
+        accessTrace.mark(TRACE_FINGER, TRACE_EVENT);
         return true;
     } else if (fingerID == -2) {
         fingerFailedAttempts++;
@@ -483,63 +419,100 @@ bool handleFingerprint() {
 
         if (fingerFailedAttempts >= 5) {
             sendBlynkEvent("send_alarm", "Access denied, too many attempts");
-            displayMessage("Too Many Attempts", "Locking out", 2000);
+            accessTrace.mark(TRACE_FINGER, TRACE_EVENT);
+            displayMessage("Too Many Attempts", "Locking out", 2000,
+                           DISPLAY_ALARM);
+            accessTrace.mark(TRACE_FINGER, TRACE_DISPLAY);
             lockoutUntil = millis() + LOCKOUT_DURATION;
             fingerFailedAttempts = 0;
         } else {
             sendBlynkEvent("access_denied", "Access denied via fingerprint");
+            accessTrace.mark(TRACE_FINGER, TRACE_EVENT);
             displayMessage("Access Denied!",
                            String(5 - fingerFailedAttempts) + " attempts left",
-                           2000);
+                           2000, DISPLAY_HIGH);
+            accessTrace.mark(TRACE_FINGER, TRACE_DISPLAY);
         }
-        resetPasscodeEntry();
     }
 
     return false;
 }
 
 void blynkVirtualWrite(const int pin, String value) {
-    if (WiFi.status() == WL_CONNECTED && Blynk.connected()) {
+    if (WiFi.status() == WL_CONNECTED && Blynk.connected() &&
+        !eventJournal.pending()) {
         Blynk.virtualWrite(pin, value);
+    } else if (eventJournal.append(JOURNAL_VIRTUAL_WRITE, pin, "",
+                                   value.c_str())) {
+        Serial.println("Blynk offline, write queued: " + String(pin));
     } else {
         Serial.println("Blynk offline, can't send event: " + String(pin));
     }
 }
 
 const unsigned long MOTION_DEBOUNCE = 80;
+const unsigned long FINGER_SCAN_INTERVAL = 250;
+const unsigned long LOCKOUT_REFRESH_INTERVAL = 500;
+
+// How long inputTask may sleep before a timer needs servicing
+TickType_t nextInputWakeup(unsigned long lastFingerScan) {
+    unsigned long now = millis();
+
+    if (isLockoutActive()) {
+        return pdMS_TO_TICKS(min(LOCKOUT_REFRESH_INTERVAL, lockoutUntil - now));
+    }
+
+    unsigned long wait = ULONG_MAX;
+    if (autoLockPending) {
+        // Wake when the countdown shows the next second, or when it expires
+        wait = (autoLockTime > now) ? (autoLockTime - now) % 1000 + 1 : 0;
+    }
+    if (isLocked) {
+        // The fingerprint sensor has no interrupt line, so it is polled
+        unsigned long sinceScan = now - lastFingerScan;
+        wait = min(wait, sinceScan < FINGER_SCAN_INTERVAL
+                             ? FINGER_SCAN_INTERVAL - sinceScan
+                             : 0UL);
+    }
+    return (wait == ULONG_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(wait);
+}
 
 void inputTask(void *parameter) {
     unsigned long lastMotionTime = 0;
-
-    int fingerScanCounter = 0;
-    int pinStateCurrent = digitalRead(MOVEMENT_PIN);
-    int pinStatePrevious = pinStateCurrent;
+    unsigned long lastFingerScan = 0;
+    unsigned long lastLockoutRefresh = 0;
     long lastDisplayedTime = -1;
     bool wasLocked = false;
 
     for (;;) {
+        InputEvent event;
+        bool hasEvent =
+            inputEvents.receive(event, nextInputWakeup(lastFingerScan));
+        if (hasEvent && event.type == INPUT_EVENT_PROMPT) clearPasscodeEntry();
+
         unsigned long currentTime = millis();
         if (isLockoutActive()) {
+            // Keys typed during a lockout are discarded
             wasLocked = true;
-            unsigned long remainingSecs = (lockoutUntil - currentTime) / 1000;
-            displayMessage("System Locked",
-                           String(remainingSecs) + "s remaining");
-
-            vTaskDelay(500 / portTICK_PERIOD_MS);
+            if (!hasEvent ||
+                currentTime - lastLockoutRefresh >= LOCKOUT_REFRESH_INTERVAL) {
+                lastLockoutRefresh = currentTime;
+                unsigned long remainingSecs =
+                    (lockoutUntil - currentTime) / 1000;
+                displayMessage("System Locked",
+                               String(remainingSecs) + "s remaining", 0,
+                               DISPLAY_LOW);
+            }
             continue;
         }
 
         if (wasLocked) {
             wasLocked = false;
             displayMessage("Lockout Ended", "System Available", 2000);
-            resetPasscodeEntry();
         }
 
         if (autoLockPending) {
-            pinStatePrevious = pinStateCurrent;
-            pinStateCurrent = digitalRead(MOVEMENT_PIN);
-
-            if (pinStatePrevious == LOW && pinStateCurrent == HIGH &&
+            if (hasEvent && event.type == INPUT_EVENT_MOTION &&
                 (currentTime - lastMotionTime > MOTION_DEBOUNCE)) {
                 lastMotionTime = currentTime;
                 Serial.println("Motion detected!");
@@ -550,14 +523,14 @@ void inputTask(void *parameter) {
                 setLockPosition(true);
                 autoLockPending = false;
                 displayMessage("Door Locked", "Auto-lock complete", 1000);
-                resetPasscodeEntry();
                 lastDisplayedTime = -1;
             } else {
                 long remainingTime = (autoLockTime - currentTime) / 1000;
                 if (remainingTime != lastDisplayedTime && remainingTime >= 0) {
                     lastDisplayedTime = remainingTime;
                     displayMessage("Auto-Lock in:",
-                                   String(remainingTime) + "s");
+                                   String(remainingTime) + "s", 0,
+                                   DISPLAY_LOW);
                 }
             }
         }
@@ -575,28 +548,33 @@ void inputTask(void *parameter) {
         }
 
         if (isLocked) {
-            bool keypadSuccess = handleKeypadInput();
-            if (keypadSuccess || isLockoutActive()) {
-                vTaskDelay(50 / portTICK_PERIOD_MS);
-                continue;
+            checkKeypadTimeout();
+
+            if (hasEvent && event.type == INPUT_EVENT_KEY) {
+                bool keypadSuccess = handleKeypadInput(event);
+                if (keypadSuccess || isLockoutActive()) continue;
             }
 
-            fingerScanCounter++;
-            if (fingerScanCounter >= 5) {
-                fingerScanCounter = 0;
+            // Queued keys go first, the sensor round trip takes a while
+            if (!inputEvents.pending() &&
+                millis() - lastFingerScan >= FINGER_SCAN_INTERVAL) {
+                lastFingerScan = millis();
                 handleFingerprint();
             }
         }
-        vTaskDelay(50 / portTICK_PERIOD_MS);
     }
 }
 
 BLYNK_WRITE(V0) {
     if (param.asInt()) {
-        displayMessage("Door Unlocked", "Blynk Command");
+        markCloudCommand();
+        accessTrace.begin(TRACE_CLOUD);
+        displayMessage("Door Unlocked", "Blynk Command", 2000);
+        accessTrace.mark(TRACE_CLOUD, TRACE_DISPLAY);
         lockoutUntil = 0;
         unlockTemporarily();
-        resetPasscodeEntry();
+        accessTrace.mark(TRACE_CLOUD, TRACE_SERVO);
+        inputEvents.wake();
     }
 }
 
@@ -634,16 +612,43 @@ BLYNK_WRITE(V1) {
         displayMessage("PIN Change", "Failed", 3000);
         blynkVirtualWrite(V3, "PIN change failed");
     }
-
-    resetPasscodeEntry();
 }
 
 const unsigned long FINGERPRINT_REGISTER_COOLDOWN = 60000;
 unsigned long lastRegistrationAttempt = 0;
+const unsigned long ENROLL_PROGRESS_INTERVAL = 200;
+int enrollProgressTimer = -1;
+
+// Forwards enrollment progress to the app from the loop task
+void reportEnrollProgress() {
+    // Sampled first so the final report is never left in the queue
+    bool running = enrollJob.active();
+    EnrollProgress progress;
+    while (enrollJob.poll(progress)) {
+        if (!progress.finished) {
+            blynkVirtualWrite(V4, progress.text);
+            continue;
+        }
+
+        lastRegistrationAttempt = millis();
+        if (progress.success) {
+            displayMessage("Registration", "Successful", 2000);
+            blynkVirtualWrite(V4, "Fingerprint registered successfully");
+
+            blynkVirtualWrite(
+                V5, String(fingerSlots.count()) + " fingerprints now stored");
+        } else {
+            displayMessage("Registration", "Failed", 2000);
+            blynkVirtualWrite(
+                V4, "Fingerprint registration failed - try again in 60s");
+        }
+    }
+    if (!running) edgentTimer.disable(enrollProgressTimer);
+}
 
 BLYNK_WRITE(V2) {
     if (param.asInt()) {
-        if (isRegistering) {
+        if (enrollJob.active()) {
             blynkVirtualWrite(V4, "Registration already in progress");
             return;
         }
@@ -663,25 +668,25 @@ BLYNK_WRITE(V2) {
             return;
         }
 
-        isRegistering = true;
-        bool success = getFingerprintEnroll();
-        isRegistering = false;
-
-        lastRegistrationAttempt = millis();
-
-        if (success) {
-            displayMessage("Registration", "Successful", 2000);
-            blynkVirtualWrite(V4, "Fingerprint registered successfully");
+        // Runs in the enrollment task, progress comes back through
+        // reportEnrollProgress()
+        if (enrollJob.start()) {
+            edgentTimer.enable(enrollProgressTimer);
+        } else {
+            blynkVirtualWrite(V4, "Fingerprint sensor not available");
+        }
+    }
+}
 
-            finger.getTemplateCount();
-            blynkVirtualWrite(
-                V5, String(finger.templateCount) + " fingerprints now stored");
+// Cancel a registration in progress
+BLYNK_WRITE(V9) {
+    if (param.asInt()) {
+        if (enrollJob.active()) {
+            enrollJob.cancel();
+            blynkVirtualWrite(V4, "Canceling registration...");
         } else {
-            displayMessage("Registration", "Failed", 2000);
-            blynkVirtualWrite(
-                V4, "Fingerprint registration failed - try again in 60s");
+            blynkVirtualWrite(V4, "No registration in progress");
         }
-        resetPasscodeEntry();
     }
 }
 
@@ -695,15 +700,21 @@ BLYNK_WRITE(V6) {
             return;
         }
 
-        uint8_t result = finger.deleteModel(id);
+        if (xSemaphoreTake(fingerLock, pdMS_TO_TICKS(FINGER_LOCK_WAIT)) !=
+            pdTRUE) {
+            displayMessage("Sensor busy", "Try again", 2000);
+            blynkVirtualWrite(V5, "Fingerprint sensor busy, try again");
+            return;
+        }
+        uint8_t result = fingerSlots.remove(id);
+        xSemaphoreGive(fingerLock);
         if (result == FINGERPRINT_OK) {
             displayMessage("Fingerprint", "Deleted", 2000);
-            finger.getTemplateCount();
 
             String detailedMsg =
                 "Fingerprint ID #" + String(id) + " successfully deleted";
             detailedMsg +=
-                " (" + String(finger.templateCount) + " fingerprints stored)";
+                " (" + String(fingerSlots.count()) + " fingerprints stored)";
 
             blynkVirtualWrite(V5, detailedMsg);
             Serial.println(detailedMsg);
@@ -733,7 +744,6 @@ BLYNK_WRITE(V6) {
         displayMessage("Invalid ID", "Try again", 2000);
         blynkVirtualWrite(V5, "Invalid fingerprint ID: must be greater than 0");
     }
-    resetPasscodeEntry();
 }
 
 BLYNK_WRITE(V7) {
@@ -741,108 +751,259 @@ BLYNK_WRITE(V7) {
         if (isLocked) {
             blynkVirtualWrite(V8, "Door already locked");
         } else {
+            markCloudCommand();
             autoLockTime = 0;
+            inputEvents.wake();
             blynkVirtualWrite(V8, "Door locked successfully");
         }
     }
 }
 
-void setup() {
-    Serial.begin(115200);
+// A reset requested right before a power loss is only recorded in NVS
+void loadResetFlag() {
+    if (prefs.begin("smartlock", true)) {
+        if (prefs.getBool("flag_reset", false)) factoryResetPending = true;
+        prefs.end();
+    }
+}
+
+void handleReset() {
+    // Clearing the templates has to wait for the sensor
+    if (!factoryResetPending || !fingerReady) return;
+    if (xSemaphoreTake(fingerLock, 0) != pdTRUE) return;
+    factoryResetPending = false;
+
+    Preferences prefs;
+    if (prefs.begin("smartlock", false)) {
+        prefs.remove("pin");
+        pinCache.set(DEFAULT_PIN);
+        Serial.println("PIN removed from preferences");
+        displayMessage("PIN Reset", "Done", 2000);
+
+        if (fingerSlots.clear() == FINGERPRINT_OK) {
+            Serial.println("Fingerprint database cleared");
+            displayMessage("Fingerprint DB", "Cleared", 2000);
+        } else {
+            // Templates stay on a sensor that is missing or not answering
+            Serial.println("Fingerprint database not cleared");
+            displayMessage("Fingerprint DB", "Not cleared", 2000);
+        }
 
-    // Initialize LCD
+        prefs.putBool("flag_reset", false);
+        Serial.println("Reset to factory defaults");
+
+        displayMessage("Factory Reset", "Done", 4000);
+
+        prefs.end();
+    }
+    xSemaphoreGive(fingerLock);
+}
+
+// Debug memory - written by Claude AI
+void reportMemory() {
+    Serial.println("---------------------------------");
+    Serial.println("Memory report:");
+    Serial.printf("Free heap: %d bytes, Largest block: %d bytes\n",
+                  ESP.getFreeHeap(), ESP.getMaxAllocHeap());
+    Serial.printf("Task Count: %u\n", uxTaskGetNumberOfTasks());
+
+    Serial.printf("Input Task Stack HWM: %u\n",
+                  uxTaskGetStackHighWaterMark(inputTaskHandle));
+    Serial.println("---------------------------------");
+}
+
+void checkHeap() {
+    if (ESP.getFreeHeap() < 10000) {  // Critical threshold
+        Serial.println("WARNING: Low memory detected");
+        // Optional: Take recovery action or restart
+        // ESP.restart();
+    }
+}
+// End debug memory
+
+// Boot steps, see setup() for what depends on what
+
+void initLcd() {
     lcd.init();
     lcd.backlight();
-    displayMessage("Initializing...", "Please wait");
+    lcdRenderer.begin(lcd);
+    lcdRenderer.setEchoHook(
+        [](int64_t timestamp) { inputEvents.recordLatency(timestamp); });
+    displayQueue.setFallbackHook(
+        [] { inputEvents.notify(INPUT_EVENT_PROMPT); });
+    displayQueue.begin();
+}
 
-    // Setup servo
+void initServo() {
+    // Drives the lock position from the first pulse
     lockServo.attach(SERVO_PIN);
-    delay(1000);
     lockServo.write(LOCK_POSITION);
+}
 
-    // Setup I/O and interfaces
-    pinMode(MOVEMENT_PIN, INPUT);
-    resetPasscodeEntry();
-    lastKeyPressTime = millis();
+void initInput() {
+    inputEvents.begin(keypad, rowPins, colPins, 4, 4, MOVEMENT_PIN);
+}
+
+void initPin() {
+    // Only the salted hash of the PIN stays in RAM
+    pinCache.set(loadPin());
+    Serial.println("PIN loaded");
+    loadResetFlag();
+}
 
-    // Initialize fingerprint sensor
+void initFinger() {
     finger.begin(57600);
     if (finger.verifyPassword()) {
         Serial.println("Fingerprint sensor connected");
-        finger.getTemplateCount();
-        Serial.println("Found " + String(finger.templateCount) + " templates");
+        fingerSlots.begin(finger);
+        Serial.println("Found " + String(fingerSlots.count()) + " templates");
+        enrollJob.begin(finger, fingerSlots, fingerLock);
     } else {
         Serial.println("Fingerprint sensor not found!");
     }
+    fingerReady = true;
+}
 
-    // Load PIN from preferences
-    Serial.println("Current PIN: " + loadPin());
+// Once every boot step is done, after the banner Edgent prints
+void printBootTimeline() {
+    static bool printed = false;
+    if (printed || !bootTimeline.finished()) return;
+    printed = true;
+    bootTimeline.print(Serial);
+    Serial.println("----------------------------------------------------");
+}
 
-    // Initialize Blynk
-    BlynkEdgent.begin();
+void setup() {
+    bootTimeline.begin();
+    Serial.begin(115200);
 
-    // Create input handling task
+    // The sensor handshake, and the slot scan on sensors without an index
+    // table, take the longest and nothing at boot waits for them
+    fingerLock = xSemaphoreCreateMutex();
+    bootTimeline.spawn("finger", initFinger);
+    int8_t lcdStep = bootTimeline.spawn("lcd", initLcd);
+    bootTimeline.run("servo", initServo);
+    bootTimeline.run("input", initInput);
+    bootTimeline.run("pin", initPin);
+
+    // The input task posts to the display queue
+    bootTimeline.join(lcdStep);
+    currentPasscode.reserve(PASSCODE_LENGTH + 1);
+    updatePasscodePrompt();
+    cloudEventQueue =
+        xQueueCreate(CLOUD_EVENT_QUEUE_LENGTH, sizeof(CloudEvent));
+    lastKeyPressTime = millis();
     xTaskCreatePinnedToCore(inputTask, "InputTask", 4096, NULL, 1,
                             &inputTaskHandle, 0);
-
-    currentPasscode.reserve(PASSCODE_LENGTH + 1);
-}
-
-void handleReset() {
-    Preferences prefs;
-    if (prefs.begin("smartlock", false)) {
-        if (prefs.getBool("flag_reset", false)) {
-            prefs.remove("pin");
-            Serial.println("PIN removed from preferences");
-            displayMessage("PIN Reset", "Done", 2000);
-
-            finger.emptyDatabase();
-            Serial.println("Fingerprint database cleared");
-            displayMessage("Fingerprint DB", "Cleared", 2000);
-
-            prefs.putBool("flag_reset", false);
-            Serial.println("Reset to factory defaults");
-
-            displayMessage("Factory Reset", "Done", 4000);
-            resetPasscodeEntry();
+    bootTimeline.mark("keypad ready");
+
+    // Storage and WiFi, while the keypad already works
+    bootTimeline.run("edgent", [] { BlynkEdgent.begin(); });
+
+    // The storage partition is mounted by BlynkEdgent.begin()
+    bootTimeline.run("journal",
+                     [] { eventJournal.begin(systemStats.resetCount.total); });
+    journalReplayTimer =
+        edgentTimer.setInterval(JOURNAL_REPLAY_INTERVAL, replayJournal);
+    edgentTimer.disable(journalReplayTimer);
+    enrollProgressTimer =
+        edgentTimer.setInterval(ENROLL_PROGRESS_INTERVAL, reportEnrollProgress);
+    edgentTimer.disable(enrollProgressTimer);
+    edgentTimer.setInterval(30000L, reportMemory);
+    edgentTimer.setInterval(10000L, checkHeap);
+
+    edgentConsole.addCommand("input", [](int argc, const char **argv) {
+        if (argc > 0 && 0 == strcmp(argv[0], "clear")) {
+            inputEvents.clearStats();
+            return;
         }
-
-        prefs.end();
-    }
+        InputStats stats = inputEvents.stats();
+        edgentConsole.printf(" Keys:            %lu\n",
+                             (unsigned long)stats.keys);
+        edgentConsole.printf(" Motion events:   %lu\n",
+                             (unsigned long)stats.motions);
+        edgentConsole.printf(" Dropped events:  %lu\n",
+                             (unsigned long)stats.dropped);
+        edgentConsole.printf(
+            " Echo latency:    last %lu us, avg %lu us, max %lu us\n",
+            (unsigned long)stats.latencyLast,
+            stats.latencyCount
+                ? (unsigned long)(stats.latencySum / stats.latencyCount)
+                : 0UL,
+            (unsigned long)stats.latencyMax);
+    });
+
+    edgentConsole.addCommand("lcd", [](int argc, const char **argv) {
+        if (argc > 0 && 0 == strcmp(argv[0], "clear")) {
+            lcdRenderer.clearStats();
+            displayQueue.clearStats();
+            return;
+        }
+        const LcdStats &stats = lcdRenderer.stats();
+        edgentConsole.printf(" Frames:          %lu\n",
+                             (unsigned long)stats.frames);
+        edgentConsole.printf(" Cells written:   %lu\n",
+                             (unsigned long)stats.cells);
+        edgentConsole.printf(" Cursor moves:    %lu\n",
+                             (unsigned long)stats.cursorMoves);
+        const DisplayStats &messages = displayQueue.stats();
+        edgentConsole.printf(" Messages shown:  %lu\n",
+                             (unsigned long)messages.shown);
+        edgentConsole.printf("       preempted: %lu\n",
+                             (unsigned long)messages.preempted);
+        edgentConsole.printf("       expired:   %lu\n",
+                             (unsigned long)messages.expired);
+        edgentConsole.printf("       dropped:   %lu\n",
+                             (unsigned long)messages.dropped);
+    });
+
+    edgentConsole.addCommand("latency", [](int argc, const char **argv) {
+        if (argc > 0 && 0 == strcmp(argv[0], "clear")) {
+            commandLatency = {};
+            return;
+        }
+        edgentConsole.printf(
+            " Cloud to servo:  last %lu ms, avg %lu ms, max %lu ms\n",
+            (unsigned long)commandLatency.last,
+            commandLatency.count
+                ? (unsigned long)(commandLatency.sum / commandLatency.count)
+                : 0UL,
+            (unsigned long)commandLatency.max);
+        edgentConsole.printf(" Commands:        %lu\n",
+                             (unsigned long)commandLatency.count);
+        edgentConsole.printf(" Loop gap max:    %lu ms\n",
+                             (unsigned long)commandLatency.loopGapMax);
+    });
+
+    edgentConsole.addCommand("journal", []() {
+        const JournalStats &stats = eventJournal.stats();
+        edgentConsole.printf(" Queued:          %lu\n",
+                             (unsigned long)stats.queued);
+        edgentConsole.printf(" Replayed:        %lu\n",
+                             (unsigned long)stats.replayed);
+        edgentConsole.printf(" Dropped:         %lu\n",
+                             (unsigned long)stats.dropped);
+        edgentConsole.printf(" Pending:         %lu\n",
+                             (unsigned long)eventJournal.pending());
+    });
+
+    edgentConsole.addCommand("boot",
+                             []() { bootTimeline.print(edgentConsole); });
+    printBootTimeline();
 }
 
 void loop() {
-    handleReset();
-
-    static unsigned long lastMemReport = 0;
-    static unsigned long lastHeapCheck = 0;
+    static unsigned long lastRun = millis();
     unsigned long now = millis();
+    uint32_t gap = now - lastRun;
+    commandLatency.loopGapMax = max(commandLatency.loopGapMax, gap);
+    lastRun = now;
 
-    // Debug memory - written by Claude AI
-    if (now - lastMemReport > 30000) {
-        Serial.println("---------------------------------");
-        Serial.println("Memory report:");
-        Serial.printf("Free heap: %d bytes, Largest block: %d bytes\n",
-                      ESP.getFreeHeap(), ESP.getMaxAllocHeap());
-        lastMemReport = now;
-        Serial.printf("Task Count: %u\n", uxTaskGetNumberOfTasks());
-
-        Serial.printf("Input Task Stack HWM: %u\n",
-                      uxTaskGetStackHighWaterMark(inputTaskHandle));
-        Serial.println("---------------------------------");
-    }
-
-    if (now - lastHeapCheck > 10000) {  // Check every 10 seconds
-        lastHeapCheck = now;
-        if (ESP.getFreeHeap() < 10000) {  // Critical threshold
-            Serial.println("WARNING: Low memory detected");
-            // Optional: Take recovery action or restart
-            // ESP.restart();
-        }
-    }
-
-    // End debug memory
-
+    handleReset();
     BlynkEdgent.run();
-    delay(1000);
-}
\ No newline at end of file
+    deliverBlynkEvents();
+    printBootTimeline();
+
+    // Give the idle task a tick, Blynk is serviced again right after
+    vTaskDelay(1);
+}